@@ -0,0 +1,1050 @@
+#pragma once
+
+#include "client.h"
+#include "cores.h"
+#include "handoff.h"
+#include "inventory.h"
+#include "journal.h"
+#include "numa.h"
+#include "persistent_inventory.h"
+#include "query.h"
+#include "reservations.h"
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <malloc.h>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Throughput and latency distribution of a benchmarked operation.
+struct BenchResult
+{
+        std::size_t   ops {0};
+        double        seconds {0};
+        std::uint64_t p50_ns {0};
+        std::uint64_t p99_ns {0};
+        std::uint64_t max_ns {0};
+};
+
+/// @brief Runs `fn(thread, i)` `ops` times on each of `nthreads` threads and records how long every call took.
+///
+/// If `idle` is given, a thread that has finished calls `idle(thread)` until every thread has, for threads that serve each other.
+template<typename Fn>
+auto run_bench(std::size_t nthreads, std::size_t ops, Fn&& fn, const std::function<void(std::size_t)>& idle = {})
+{
+        std::vector<std::vector<std::uint64_t>> latencies(nthreads, std::vector<std::uint64_t>(ops));
+        std::vector<std::thread>                threads;
+        std::atomic<std::size_t>                finished {0};
+
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t t = 0; t < nthreads; ++t)
+        {
+                threads.emplace_back([&, t] {
+                        for (std::size_t i = 0; i < ops; ++i)
+                        {
+                                const auto op_start = std::chrono::steady_clock::now();
+                                fn(t, i);
+                                const auto elapsed = std::chrono::steady_clock::now() - op_start;
+                                latencies[t][i]    = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                        }
+
+                        ++finished;
+                        while (idle && finished < nthreads) { idle(t); }
+                });
+        }
+        for (auto& thread : threads) { thread.join(); }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        std::vector<std::uint64_t> all;
+        for (const auto& thread_latencies : latencies) { all.insert(all.end(), thread_latencies.begin(), thread_latencies.end()); }
+        std::sort(all.begin(), all.end());
+
+        BenchResult result;
+        result.ops     = all.size();
+        result.seconds = std::chrono::duration<double>(elapsed).count();
+        if (!all.empty())
+        {
+                result.p50_ns = all[all.size() / 2];
+                result.p99_ns = all[all.size() * 99 / 100];
+                result.max_ns = all.back();
+        }
+        return result;
+}
+
+/// @brief Prints the header of a benchmark results table.
+inline auto print_bench_header()
+{
+        std::printf("%-40s%12s%14s%12s%12s%12s\n", "Benchmark", "Ops", "Ops/s", "p50 (us)", "p99 (us)", "Max (us)");
+}
+
+/// @brief Prints one row of a benchmark results table.
+inline auto print_bench_result(const std::string& name, const BenchResult& result)
+{
+        std::printf("%-40s%12zu%14.0f%12.1f%12.1f%12.1f\n", name.c_str(), result.ops, static_cast<double>(result.ops) / result.seconds,
+                    static_cast<double>(result.p50_ns) / 1e3, static_cast<double>(result.p99_ns) / 1e3, static_cast<double>(result.max_ns) / 1e3);
+}
+
+/// @brief Measures the cost of journalling a stock change at each durability level.
+///
+/// Single threaded runs go through `Inventory::update` like a till would. Multi-threaded runs append to the journal directly, which is
+/// where group commit pays off: concurrent writers share one sync instead of queueing for their own.
+inline auto bench_durability(const std::string& dir)
+{
+        constexpr std::size_t OPS      = 2000;
+        constexpr std::size_t NTHREADS = 8;
+
+        print_bench_header();
+        for (std::size_t level = 0; level < std::size(DURABILITY_NAMES); ++level)
+        {
+                const auto durability = static_cast<Durability>(level);
+                const auto name       = std::string {DURABILITY_NAMES[level]};
+
+                std::filesystem::remove_all(dir);
+                Inventory inventory;
+                auto      journal = Journal::open(dir, inventory);
+                if (!journal)
+                {
+                        std::printf("Could not open journal in '%s'.\n", dir.c_str());
+                        return;
+                }
+                inventory.on_mutation = [&](const Mutation& mutation) { return journal->append(mutation); };
+
+                inventory.add({Product::Jeans, "BENCH-0001", 29.99F, 1000000}, Durability::Sync);
+                const auto handle = inventory.handles.back();
+                const auto single = run_bench(1, OPS, [&](std::size_t, std::size_t) {
+                        auto pitem = inventory.find(handle);
+                        auto item  = *pitem;
+                        --item.nstock;
+                        inventory.update(pitem, item, durability);
+                });
+                print_bench_result("update, 1 thread, " + name, single);
+
+                const Item item {Product::Jeans, "BENCH-0001", 29.99F, 1};
+                const auto concurrent = run_bench(NTHREADS, OPS / NTHREADS, [&](std::size_t, std::size_t) {
+                        journal->append({Mutation::Op::Update, handle, &item, durability});
+                });
+                print_bench_result("append, " + std::to_string(NTHREADS) + " threads, " + name, concurrent);
+        }
+        std::filesystem::remove_all(dir);
+}
+
+/// @brief Measures how much space a stock decrement heavy workload takes in the journal, and how long replaying it takes.
+///
+/// Changes are flushed in groups of `GROUP` records, as group commit would under load, so each journal block holds that many records.
+inline auto bench_journal(const std::string& dir)
+{
+        constexpr std::size_t NITEMS = 1000;
+        constexpr std::size_t OPS    = 200000;
+        constexpr std::size_t GROUP  = 64;
+
+        std::filesystem::remove_all(dir);
+        Inventory inventory;
+        auto      journal = Journal::open(dir, inventory);
+        if (!journal)
+        {
+                std::printf("Could not open journal in '%s'.\n", dir.c_str());
+                return;
+        }
+        journal->compact_bytes = UINT64_MAX;
+        inventory.on_mutation  = [&](const Mutation& mutation) { return journal->append(mutation); };
+
+        for (std::size_t i = 0; i < NITEMS; ++i) { inventory.add({Product::Jeans, "BENCH-" + std::to_string(i), 29.99F, 1000000}, Durability::Memory); }
+        journal->start_compaction(inventory);
+        journal->maintain(inventory, true);
+
+        print_bench_header();
+        std::uint64_t state {1};
+        const auto    result = run_bench(1, OPS, [&](std::size_t, std::size_t i) {
+                // mostly decrements of a few popular items, like a busy Saturday
+                state      = state * 6364136223846793005U + 1442695040888963407U;
+                auto pitem = inventory.items.begin() + static_cast<std::ptrdiff_t>((state >> 33U) % (i % 4 == 0 ? NITEMS : 32));
+                auto item  = *pitem;
+                --item.nstock;
+                inventory.update(pitem, item, Durability::Buffered);
+                if (i % GROUP == GROUP - 1) { journal->flush(false); }
+        });
+        print_bench_result("stock decrement, blocks of " + std::to_string(GROUP), result);
+        journal->flush(true);
+
+        std::printf("Journal: %" PRIu64 " bytes encoded, %" PRIu64 " bytes written (%.2f bytes per change)\n", journal->raw_bytes, journal->stored_bytes,
+                    static_cast<double>(journal->stored_bytes) / OPS);
+        journal.reset();
+
+        Inventory     recovered;
+        RecoveryStats stats;
+        journal = Journal::open(dir, recovered, &stats);
+        const auto matches = recovered.items.size() == inventory.items.size() && recovered.items.front().nstock == inventory.items.front().nstock;
+        std::printf("Replayed %" PRIu64 " changes from %" PRIu64 " bytes in %" PRIu64 " us, inventory %s\n", stats.replayed, stats.bytes_read,
+                    stats.duration_us, matches ? "matches" : "differs");
+        journal.reset();
+        std::filesystem::remove_all(dir);
+}
+
+/// @brief Generates load against an inventory server through the client library, comparing one blocking request at a time per
+/// connection with pooled, batched and pipelined requests.
+///
+/// Without an address, a server is started on a thread of this process.
+inline auto bench_client(std::optional<Address> address)
+{
+        constexpr std::size_t NKEYS    = 10000;
+        constexpr std::size_t OPS      = 40000;
+        constexpr std::size_t NTHREADS = 8;
+        constexpr std::size_t POOL     = 4;
+        constexpr std::size_t BATCH    = 16;
+        constexpr std::size_t DEPTH    = 64;
+
+        Inventory        inventory;
+        InventoryService service {inventory};
+        FrameServer      server;
+        std::thread      server_thread;
+        if (!address)
+        {
+                if (!server.listen(0))
+                {
+                        std::printf("Could not start a server.\n");
+                        return;
+                }
+                server.handler = [&](const FrameView& request, std::string& out) { return service.handle(request, out); };
+                address        = Address {"127.0.0.1", local_port(server.listener.fd)};
+                server_thread  = std::thread {[&] { server.run(); }};
+        }
+        const auto stop_server = [&] {
+                server.stopping = true;
+                if (server_thread.joinable()) { server_thread.join(); }
+        };
+
+        ClientPool pool {*address, POOL};
+        const auto key = [](std::size_t t, std::size_t i) { return "LOAD-" + std::to_string((t * 7919 + i * 104729) % NKEYS); };
+        if (const auto loader = pool.acquire())
+        {
+                std::vector<std::pair<MessageType, std::string>> puts;
+                for (std::size_t i = 0; i < NKEYS; ++i)
+                {
+                        encode_item(puts.emplace_back(MessageType::Put, std::string {}).second,
+                                    {static_cast<Product>(i % std::size(PRODUCT_NAMES)), "LOAD-" + std::to_string(i), 19.99F, 1000});
+                }
+                for (auto& future : loader->submit_batch(puts)) { future.wait(); }
+        }
+        else
+        {
+                std::printf("Could not connect to '%s'.\n", address->to_string().c_str());
+                stop_server();
+                return;
+        }
+
+        print_bench_header();
+
+        std::vector<std::optional<Connection>> conns(NTHREADS);
+        for (auto& conn : conns) { conn = Connection::open(*address); }
+        const auto blocking = run_bench(NTHREADS, OPS / NTHREADS, [&](std::size_t t, std::size_t i) { conns[t]->call(MessageType::Get, key(t, i)); });
+        print_bench_result("get, connection per thread", blocking);
+        conns.clear();
+
+        const auto pooled = run_bench(NTHREADS, OPS / NTHREADS, [&](std::size_t t, std::size_t i) { pool.acquire()->get(key(t, i)); });
+        print_bench_result("get, " + std::to_string(POOL) + " pooled clients", pooled);
+
+        const auto mixed = run_bench(NTHREADS, OPS / NTHREADS, [&](std::size_t t, std::size_t i) {
+                const auto client = pool.acquire();
+                if (i % 10 == 0) { client->put({Product::Jeans, key(t, i), 17.99F, static_cast<int>(i)}); }
+                else { client->get(key(t, i)); }
+        });
+        print_bench_result("90% get, 10% put, pooled", mixed);
+
+        // each op is a whole batch, so ops/s times the batch size gives items/s
+        const auto batched = run_bench(NTHREADS, OPS / NTHREADS / BATCH, [&](std::size_t t, std::size_t i) {
+                std::vector<std::string> names;
+                for (std::size_t k = 0; k < BATCH; ++k) { names.push_back(key(t, i * BATCH + k)); }
+                pool.acquire()->multi_get(names);
+        });
+        print_bench_result("multi-get of " + std::to_string(BATCH) + ", pooled", batched);
+
+        // latencies here are only the time to submit, plus waiting for the oldest response once the window is full
+        const auto                        client = pool.acquire();
+        std::deque<std::future<Response>> in_flight;
+        const auto                        pipelined = run_bench(1, OPS, [&](std::size_t, std::size_t i) {
+                if (in_flight.size() == DEPTH)
+                {
+                        in_flight.front().wait();
+                        in_flight.pop_front();
+                }
+                in_flight.push_back(client->submit(MessageType::Get, key(0, i)));
+        });
+        for (auto& future : in_flight) { future.wait(); }
+        print_bench_result("async get, " + std::to_string(DEPTH) + " in flight, 1 thread", pipelined);
+
+        // back-office clients pipeline full listings as fast as they are answered while the tills look items up; admission control should
+        // keep the tills' latency close to the unloaded runs and shed the listings that do not fit in their queue
+        std::atomic<bool>        flooding {true};
+        std::vector<std::thread> flood;
+        for (std::size_t t = 0; t < NTHREADS / 2; ++t)
+        {
+                flood.emplace_back([&] {
+                        const auto                        office = Client::connect(*address);
+                        std::deque<std::future<Response>> listings;
+                        std::string                       all;
+                        put(all, std::int32_t {-1});
+                        while (office && flooding)
+                        {
+                                if (listings.size() == MAX_CLIENT_IN_FLIGHT)
+                                {
+                                        listings.front().wait();
+                                        listings.pop_front();
+                                }
+                                listings.push_back(office->submit(MessageType::List, all));
+                        }
+                        for (auto& listing : listings) { listing.wait(); }
+                });
+        }
+        const auto till = run_bench(NTHREADS / 2, OPS / NTHREADS, [&](std::size_t t, std::size_t i) { pool.acquire()->get(key(t, i)); });
+        flooding        = false;
+        for (auto& thread : flood) { thread.join(); }
+        print_bench_result("get during a listing flood", till);
+
+        // the same with the whole catalogue being imported over and over; the server runs imports in slices, so tills wait for at most
+        // one slice rather than a whole import
+        std::atomic<bool>        importing {true};
+        std::vector<std::thread> importers;
+        for (std::size_t t = 0; t < NTHREADS / 2; ++t)
+        {
+                importers.emplace_back([&] {
+                        std::vector<Item> catalogue;
+                        for (std::size_t i = 0; i < NKEYS; ++i)
+                        {
+                                catalogue.push_back({static_cast<Product>(i % std::size(PRODUCT_NAMES)), "LOAD-" + std::to_string(i), 18.99F, 500});
+                        }
+                        const auto office = Client::connect(*address);
+                        while (office && importing && office->import(catalogue)) {}
+                });
+        }
+        const auto imported = run_bench(NTHREADS / 2, OPS / NTHREADS, [&](std::size_t t, std::size_t i) { pool.acquire()->get(key(t, i)); });
+        importing           = false;
+        for (auto& thread : importers) { thread.join(); }
+        print_bench_result("get during a catalogue import", imported);
+
+        if (auto conn = Connection::open(*address))
+        {
+                if (const auto response = conn->call(MessageType::Stats, {}); response && response->payload.size() == sizeof(ServerStats))
+                {
+                        ServerStats stats {};
+                        std::memcpy(&stats, response->payload.data(), sizeof(stats));
+                        print_server_stats(stats);
+                }
+        }
+
+        stop_server();
+}
+
+/// @brief Compares an inventory shared by `nthreads` threads under a lock with the same items split between as many cores that share
+/// nothing, with tills on every thread looking items up and changing them. Uses as many threads as the machine has cores by default.
+///
+/// Each till asks for any item, as it would when connections land on cores at random, so on the split inventory all but one in
+/// `nthreads` of its requests go to another core through the queues.
+inline auto bench_cores(std::size_t nthreads)
+{
+        constexpr std::size_t NKEYS = 100000;
+        constexpr std::size_t OPS   = 400000;
+
+        if (nthreads == 0) { nthreads = std::max(std::thread::hardware_concurrency(), 2U); }
+
+        Inventory inventory;
+        for (std::size_t i = 0; i < NKEYS; ++i)
+        {
+                inventory.add({static_cast<Product>(i % std::size(PRODUCT_NAMES)), "CORE-" + std::to_string(i), 19.99F, 1000});
+        }
+        std::vector<std::string> names;
+        for (const auto& item : inventory.items) { names.push_back(item.name); }
+        const auto name = [&](std::size_t t, std::size_t i) -> const std::string& { return names[(t * 7919 + i * 104729) % NKEYS]; };
+
+        print_bench_header();
+
+        {
+                Inventory        shared = inventory;
+                InventoryService service {shared};
+                std::mutex       mutex;
+                const auto       locked = run_bench(nthreads, OPS / nthreads, [&](std::size_t t, std::size_t i) {
+                        std::lock_guard lock {mutex};
+                        if (i % 10 == 0) { service.put({Product::Jeans, name(t, i), 17.99F, static_cast<int>(i)}); }
+                        else { static_cast<void>(service.get(name(t, i))->nstock); }
+                });
+                print_bench_result("90% get, 10% put, " + std::to_string(nthreads) + " threads, locked", locked);
+        }
+
+        CoreGroup  group {nthreads};
+        group.load(inventory);
+        const auto split = run_bench(
+                nthreads, OPS / nthreads,
+                [&](std::size_t t, std::size_t i) {
+                        if (i % 10 == 0) { group.put(t, {Product::Jeans, name(t, i), 17.99F, static_cast<int>(i)}); }
+                        else { group.get(t, name(t, i)); }
+                },
+                [&](std::size_t t) {
+                        if (!group.serve_forwarded(t)) { std::this_thread::yield(); }
+                });
+        print_bench_result("90% get, 10% put, " + std::to_string(nthreads) + " cores, shared nothing", split);
+}
+
+/// @brief Measures how much keeping each shared-nothing core's items on its own NUMA node is worth, against allocating every core's items
+/// on node 0 while the cores still run spread over all nodes.
+///
+/// Each core only looks up the items it owns, so the difference is purely where their memory lives. On a machine with one node the two
+/// placements are the same.
+inline auto bench_numa(std::size_t ncores)
+{
+        constexpr std::size_t NKEYS = 1000000;
+        constexpr std::size_t OPS   = 2000000;
+
+        const auto topology = NumaTopology::discover();
+        if (ncores == 0) { ncores = std::max<std::size_t>(topology.cpus(), 2); }
+        const auto slots = topology.spread(ncores);
+        topology.print();
+
+        Inventory inventory;
+        for (std::size_t i = 0; i < NKEYS; ++i)
+        {
+                inventory.add({static_cast<Product>(i % std::size(PRODUCT_NAMES)), "NUMA-" + std::to_string(i), 19.99F, 1000});
+        }
+
+        print_bench_header();
+        for (const auto local : {true, false})
+        {
+                CoreGroup group {ncores};
+                if (local)
+                {
+                        std::vector<std::thread> threads;
+                        for (std::size_t core = 0; core < ncores; ++core)
+                        {
+                                threads.emplace_back([&, core] {
+                                        place_thread(slots[core]);
+                                        group.load(core, inventory);
+                                });
+                        }
+                        for (auto& thread : threads) { thread.join(); }
+                }
+                else
+                {
+                        std::thread {[&] {
+                                place_thread(slots[0]);
+                                group.load(inventory);
+                        }}.join();
+                }
+
+                // pages of each core's items that are on the node it runs on, sampled
+                std::size_t sampled {0};
+                std::size_t on_node {0};
+                for (std::size_t core = 0; core < ncores; ++core)
+                {
+                        const auto& items = group.cores[core]->inventory.items;
+                        for (std::size_t i = 0; i < items.size(); i += 1024, ++sampled)
+                        {
+                                on_node += node_of(&items[i]) == static_cast<int>(slots[core].node) ? 1 : 0;
+                        }
+                }
+
+                std::vector<std::vector<std::string>> names(ncores);
+                for (std::size_t core = 0; core < ncores; ++core)
+                {
+                        for (const auto& item : group.cores[core]->inventory.items) { names[core].push_back(item.name); }
+                }
+                const auto result = run_bench(ncores, OPS / ncores, [&](std::size_t t, std::size_t i) {
+                        if (i == 0) { place_thread(slots[t]); }
+                        const auto& owned = names[t];
+                        static_cast<void>(group.get(t, owned[(i * 104729) % owned.size()])->nstock);
+                });
+                print_bench_result("local get, " + std::to_string(ncores) + " cores, " + (local ? "node-local" : "all on node 0"), result);
+                std::printf("%-40s%11zu%%\n", "  item pages on the core's node", sampled ? on_node * 100 / sampled : 0);
+        }
+}
+
+/// @brief Measures how fast the filter of each query shape scans a million items in either scan mode, with the kernel compiled for it and
+/// interpreting the same filter. Shapes without a kernel are only interpreted. Then sweeps the share of items a price range selects, which
+/// branching scans are sensitive to and masked scans are not.
+inline auto bench_query()
+{
+        constexpr std::size_t NKEYS = 1000000;
+        constexpr std::size_t SCANS = 20;
+
+        Inventory inventory;
+        for (std::size_t i = 0; i < NKEYS; ++i)
+        {
+                const auto price = 5.0F + static_cast<float>((i * 7919) % 10000) / 100.0F;
+                inventory.add({static_cast<Product>(i % std::size(PRODUCT_NAMES)), "QUERY-" + std::to_string(i), price, static_cast<int>(i % 97)});
+        }
+
+        const auto query = [](std::int32_t category, float min_price, float max_price, std::int32_t below_stock) {
+                Query query {};
+                query.category    = category;
+                query.min_price   = min_price;
+                query.max_price   = max_price;
+                query.below_stock = below_stock;
+                return query;
+        };
+        const auto jeans  = static_cast<std::int32_t>(Product::Jeans);
+        const std::pair<const char*, Query> shapes[] = {
+                {"all", query(-1, -FLT_MAX, FLT_MAX, 0)},         {"category", query(jeans, -FLT_MAX, FLT_MAX, 0)},
+                {"price", query(-1, 20.0F, 40.0F, 0)},           {"category+price", query(jeans, 20.0F, 40.0F, 0)},
+                {"low stock", query(-1, -FLT_MAX, FLT_MAX, 5)},  {"category+low stock", query(jeans, -FLT_MAX, FLT_MAX, 5)},
+        };
+
+        const auto scan = [&](const std::string& name, const Query& shape, ScanMode mode, bool interpret) {
+                const auto filter = QueryFilter::compile(shape, mode, interpret);
+                const auto result = run_bench(1, SCANS, [&](std::size_t, std::size_t) {
+                        std::size_t matches {0};
+                        filter.for_each_match(inventory.columns, 0, inventory.items.size(), [&](std::size_t) { return ++matches != 0; });
+                });
+                const auto kind = std::string {mode == ScanMode::Masked ? ", masked" : ", branching"} + (filter.compiled() ? "" : ", interp.");
+                print_bench_result(name + kind, result);
+        };
+
+        print_bench_header();
+        for (const auto& [name, shape] : shapes)
+        {
+                for (const auto mode : {ScanMode::Branching, ScanMode::Masked})
+                {
+                        scan(name, shape, mode, false);
+                        if (QueryFilter::compile(shape, mode).compiled()) { scan(name, shape, mode, true); }
+                }
+        }
+
+        // prices are spread evenly over 5 to 105
+        for (const auto percent : {1, 10, 50, 90, 99})
+        {
+                const auto max_price = 5.0F + static_cast<float>(percent);
+                for (const auto mode : {ScanMode::Branching, ScanMode::Masked})
+                {
+                        scan("price, " + std::to_string(percent) + "% match", query(-1, 5.0F, max_price, 0), mode, false);
+                }
+        }
+}
+
+/// @brief Measures how fast totals over two million items are estimated from their sample, against computing them exactly with a full
+/// scan, and how far off the estimates are, for queries of several shapes. Items are changed, removed and added after loading, so the
+/// sample has to have followed them.
+inline auto bench_aggregate()
+{
+        constexpr std::size_t NKEYS = 2000000;
+        constexpr std::size_t RUNS  = 20;
+
+        // four in ten items are dresses, so that the categories differ in size
+        const auto make = [](std::size_t i) {
+                const auto prod  = i % 10 < 4 ? Product::Dresses : static_cast<Product>(i % std::size(PRODUCT_NAMES));
+                const auto price = 5.0F + static_cast<float>((i * 7919) % 10000) / 100.0F;
+                return Item {prod, "AGG-" + std::to_string(i), price, static_cast<int>((i * 31) % 97)};
+        };
+        Inventory inventory;
+        for (std::size_t i = 0; i < NKEYS; ++i) { inventory.add(make(i)); }
+        for (std::size_t i = 0; i < NKEYS / 10; ++i) { inventory.remove(inventory.items.end() - 1); }
+        for (std::size_t pos = 0; pos < inventory.items.size(); pos += 7)
+        {
+                auto item = inventory.items[pos];
+                item.price *= 1.5F;
+                if (pos % 11 == 0) { item.id = Product::Jeans; }
+                inventory.update(inventory.items.begin() + static_cast<std::ptrdiff_t>(pos), item);
+        }
+        for (std::size_t i = NKEYS; i < NKEYS + NKEYS / 20; ++i) { inventory.add(make(i)); }
+
+        const auto exact = [&](const Query& query) {
+                AggregateResult result;
+                QueryFilter::compile(query).for_each_match(inventory.columns, 0, inventory.items.size(), [&](std::size_t pos) {
+                        const auto& item = inventory.items[pos];
+                        result.count.total += 1;
+                        result.units.total += item.nstock;
+                        result.value.total += static_cast<double>(item.price) * item.nstock;
+                        result.price.total += static_cast<double>(item.price);
+                        return true;
+                });
+                result.items = result.sampled = inventory.items.size();
+                return result;
+        };
+
+        const auto query = [](std::int32_t category, float min_price, float max_price, std::int32_t below_stock) {
+                Query query {};
+                query.category    = category;
+                query.min_price   = min_price;
+                query.max_price   = max_price;
+                query.below_stock = below_stock;
+                return query;
+        };
+        const auto jeans  = static_cast<std::int32_t>(Product::Jeans);
+        const auto skirts = static_cast<std::int32_t>(Product::Skirts);
+        const std::pair<const char*, Query> shapes[] = {
+                {"all", query(-1, -FLT_MAX, FLT_MAX, 0)},          {"category", query(jeans, -FLT_MAX, FLT_MAX, 0)},
+                {"price", query(-1, 20.0F, 40.0F, 0)},            {"category+low stock", query(jeans, -FLT_MAX, FLT_MAX, 5)},
+                {"rare", query(skirts, 5.0F, 10.0F, 10)},
+        };
+
+        print_bench_header();
+        for (const auto& [name, shape] : shapes)
+        {
+                AggregateResult truth;
+                AggregateResult estimate;
+                print_bench_result(std::string {name} + ", exact", run_bench(1, RUNS, [&](std::size_t, std::size_t) { truth = exact(shape); }));
+                print_bench_result(std::string {name} + ", sampled", run_bench(1, RUNS, [&](std::size_t, std::size_t) {
+                                           estimate = estimate_aggregate(inventory, shape);
+                                   }));
+
+                const auto compare = [](const char* what, double exact, const Estimate& estimate) {
+                        const auto off = std::abs(estimate.total - exact);
+                        std::printf("  %-22s%16.1f%16.1f +/- %-14.1f%s\n", what, exact, estimate.total, estimate.error(),
+                                    off <= estimate.error() ? "within bound" : "OUTSIDE bound");
+                };
+                compare("items", truth.count.total, estimate.count);
+                compare("stock value (GBP)", truth.value.total, estimate.value);
+                compare("average price (GBP)", truth.average_price().total, estimate.average_price());
+        }
+        const auto sampled = estimate_aggregate(inventory, Query {});
+        std::printf("%" PRIu64 " of %" PRIu64 " items sampled\n", sampled.sampled, sampled.items);
+}
+
+/// @brief Measures how long starting from a snapshot of ten million items takes when the indexes saved with it are loaded as they are,
+/// against rebuilding them from the items, and checks that both find the same items.
+inline auto bench_startup(const std::string& dir)
+{
+        constexpr std::size_t NKEYS    = 10000000;
+        constexpr std::size_t NLOOKUPS = 100000;
+
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        const auto path = dir + "/startup.snapshot";
+        {
+                Inventory inventory;
+                for (std::size_t i = 0; i < NKEYS; ++i)
+                {
+                        const auto prod  = static_cast<Product>(i % std::size(PRODUCT_NAMES));
+                        const auto price = 5.0F + static_cast<float>((i * 7919) % 10000) / 100.0F;
+                        inventory.add({prod, "START-" + std::to_string(i), price, static_cast<int>(i % 97)});
+                }
+                const auto stats = write_snapshot(inventory, path);
+                if (!stats.ok)
+                {
+                        std::printf("Could not write snapshot to '%s'.\n", path.c_str());
+                        return;
+                }
+                std::printf("Snapshot of %zu items, %" PRIu64 " MB\n", NKEYS, stats.bytes >> 20U);
+        }
+
+        std::printf("%-40s%12s%12s%12s\n", "Startup", "Load (ms)", "Found", "Sampled");
+        for (const auto rebuild : {true, false})
+        {
+                const auto start    = std::chrono::steady_clock::now();
+                auto       loaded   = load_snapshot(path, nullptr, rebuild);
+                const auto elapsed  = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                if (!loaded)
+                {
+                        std::printf("Could not load snapshot from '%s'.\n", path.c_str());
+                        return;
+                }
+
+                std::size_t found {0};
+                for (std::size_t i = 0; i < NLOOKUPS; ++i)
+                {
+                        const auto name = "START-" + std::to_string((i * 104729) % NKEYS);
+                        found += loaded->find_by<ModelCodeKey>(name) != loaded->items.end() ? 1 : 0;
+                }
+                const auto sampled = estimate_aggregate(*loaded, Query {}).sampled;
+                std::printf("%-40s%12.0f%12zu%12" PRIu64 "\n", rebuild ? "rebuilding indexes" : "saved indexes", elapsed, found, sampled);
+        }
+        std::filesystem::remove_all(dir);
+}
+
+/// @brief Restarts a server of 1M items while a client keeps sending requests, once by handing the server off to a new one and once by
+/// loading the snapshot from disk, as a restart without handoff would, and compares how long the client waits in each case.
+inline auto bench_handoff(const std::string& dir)
+{
+        constexpr std::size_t NKEYS = 1000000;
+
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        const auto snapshot_path = dir + "/handoff.snapshot";
+        const auto handoff_path  = dir + "/handoff.sock";
+
+        Inventory old_inventory;
+        for (std::size_t i = 0; i < NKEYS; ++i)
+        {
+                const auto prod  = static_cast<Product>(i % std::size(PRODUCT_NAMES));
+                const auto price = 5.0F + static_cast<float>((i * 7919) % 10000) / 100.0F;
+                old_inventory.add({prod, "HANDOFF-" + std::to_string(i), price, static_cast<int>(i % 97)});
+        }
+
+        // what a restart without handoff leaves clients waiting for, on top of starting the process
+        const auto cold_start = std::chrono::steady_clock::now();
+        write_snapshot(old_inventory, snapshot_path);
+        const auto cold_loaded = load_snapshot(snapshot_path);
+        const auto cold_ms     = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cold_start).count();
+
+        InventoryService old_service {old_inventory};
+        FrameServer      old_server;
+        auto             point = HandoffPoint::listen(handoff_path);
+        if (!cold_loaded || !point || !old_server.listen(0))
+        {
+                std::printf("Could not start a server to hand off.\n");
+                return;
+        }
+        old_server.handler    = [&](const FrameView& request, std::string& out) { return old_service.handle(request, out); };
+        old_server.background = [&] {
+                point->poll(old_server, old_service, nullptr);
+                return false;
+        };
+        std::thread old_thread {[&] { old_server.run(); }};
+
+        // a client sending one request at a time, alternating lookups and updates, and reconnecting if its connection is dropped
+        const Address     address {"127.0.0.1", local_port(old_server.listener.fd)};
+        std::atomic<bool> done {false};
+        std::size_t       requests {0};
+        std::size_t       failed {0};
+        std::size_t       reconnects {0};
+        double            longest_ms {0};
+        std::thread       client_thread {[&] {
+                auto client = Client::connect(address);
+                auto last   = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; !done; ++i)
+                {
+                        if (!client || !client->ok())
+                        {
+                                client = Client::connect(address);
+                                ++reconnects;
+                                continue;
+                        }
+                        auto item = client->get("HANDOFF-" + std::to_string((i * 104729) % NKEYS));
+                        if (item && i % 2 == 1)
+                        {
+                                ++item->nstock;
+                                item = client->put(*item) ? item : std::nullopt;
+                        }
+                        ++requests;
+                        failed += item ? 0 : 1;
+
+                        const auto now = std::chrono::steady_clock::now();
+                        longest_ms     = std::max(longest_ms, std::chrono::duration<double, std::milli>(now - last).count());
+                        last           = now;
+                }
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds {300});
+
+        const auto       start    = std::chrono::steady_clock::now();
+        auto             takeover = Takeover::from(handoff_path);
+        InventoryService new_service {takeover ? takeover->inventory : old_inventory};
+        FrameServer      new_server;
+        if (takeover && !new_service.load_state(takeover->state)) { takeover.reset(); }
+        if (takeover)
+        {
+                new_server.listener = std::move(takeover->listener);
+                new_server.handler  = [&](const FrameView& request, std::string& out) { return new_service.handle(request, out); };
+                for (auto& sock : takeover->clients) { new_server.adopt(std::move(sock)); }
+                takeover->confirm();
+        }
+        const auto handoff_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::thread new_thread {[&] { new_server.run(); }};
+        old_thread.join();
+
+        std::this_thread::sleep_for(std::chrono::milliseconds {300});
+        done = true;
+        client_thread.join();
+        new_server.stopping = true;
+        new_thread.join();
+        if (!takeover)
+        {
+                std::printf("Could not take over the server.\n");
+                return;
+        }
+
+        std::printf("%-40s%12s\n", "Restart of 1M items", "Wait (ms)");
+        std::printf("%-40s%12.1f\n", "snapshot written and loaded", cold_ms);
+        std::printf("%-40s%12.1f\n", "handoff", handoff_ms);
+        std::printf("%-40s%12.1f\n", "longest wait for a response", longest_ms);
+        std::printf("Requests %zu, failed %zu, reconnects %zu, items taken over %zu\n", requests, failed, reconnects,
+                    takeover->inventory.items.size());
+        std::filesystem::remove_all(dir);
+}
+
+/// @brief Runs "what if" simulations on copies of an inventory of 10M items: copying it outright against cloning a persistent one, then
+/// removing a supplier's items in 24 clones at once on as many threads, and repricing a whole category in one.
+inline auto bench_simulation()
+{
+        constexpr std::size_t NKEYS          = 10000000;
+        constexpr std::size_t SUPPLIER_ITEMS = 1000;        // items a supplier has, added together
+        constexpr std::size_t NSIMULATIONS   = 24;
+
+        const auto ms_since = [](auto start) { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+        const auto dirty_mb = [] {
+                malloc_trim(0);
+                return static_cast<double>(private_dirty_bytes(getpid())) / (1U << 20U);
+        };
+        const auto stock_value = [](const PersistentInventory& inventory) {
+                double value {0};
+                inventory.for_each([&](Handle, const Item& item) { value += static_cast<double>(item.price) * item.nstock; });
+                return value;
+        };
+
+        std::printf("%-40s%12s%12s%12s\n", "Simulation", "Time (ms)", "Memory (MB)", "Changed");
+        PersistentInventory base;
+        {
+                Inventory live;
+                for (std::size_t i = 0; i < NKEYS; ++i)
+                {
+                        const auto prod  = static_cast<Product>(i % std::size(PRODUCT_NAMES));
+                        const auto price = 5.0F + static_cast<float>((i * 7919) % 10000) / 100.0F;
+                        const auto name  = "S" + std::to_string(i / SUPPLIER_ITEMS) + "-" + std::to_string(i);
+                        live.add({prod, name, price, static_cast<int>(i % 97)});
+                }
+
+                const auto before = dirty_mb();
+                const auto start  = std::chrono::steady_clock::now();
+                const auto copy   = live;
+                const auto copied = ms_since(start);
+                std::printf("%-40s%12.1f%12.0f%12zu\n", "copy of the inventory", copied, dirty_mb() - before, copy.items.size());
+
+                base = PersistentInventory::from(live);
+        }
+
+        const auto base_value = stock_value(base);
+        auto       before     = dirty_mb();
+        auto       start      = std::chrono::steady_clock::now();
+        auto       clone      = base.clone();
+        auto       elapsed    = ms_since(start);
+        std::printf("%-40s%12.4f%12.0f%12zu\n", "clone of the persistent inventory", elapsed, dirty_mb() - before, clone.size());
+
+        // every thread removes another supplier's items from its own clone and values what is left
+        std::vector<PersistentInventory> simulations(NSIMULATIONS);
+        std::vector<std::size_t>         removed(NSIMULATIONS);
+        std::vector<double>              values(NSIMULATIONS);
+        std::vector<std::thread>         threads;
+        before = dirty_mb();
+        start  = std::chrono::steady_clock::now();
+        for (std::size_t s = 0; s < NSIMULATIONS; ++s)
+        {
+                threads.emplace_back([&, s] {
+                        const auto prefix = "S" + std::to_string(s * 397 % (NKEYS / SUPPLIER_ITEMS)) + "-";
+                        simulations[s]    = base.clone();
+                        removed[s]        = simulations[s].remove_if([&](const Item& item) { return item.name.rfind(prefix, 0) == 0; });
+                        values[s]         = stock_value(simulations[s]);
+                });
+        }
+        for (auto& thread : threads) { thread.join(); }
+        elapsed = ms_since(start);
+
+        std::size_t total_removed {0};
+        for (const auto n : removed) { total_removed += n; }
+        std::printf("%-40s%12.1f%12.1f%12zu\n", "supplier removed, per simulation", elapsed / NSIMULATIONS, (dirty_mb() - before) / NSIMULATIONS,
+                    total_removed / NSIMULATIONS);
+        simulations.clear();
+
+        // a category is spread over all the handles, so repricing it copies most of the trie
+        before             = dirty_mb();
+        start              = std::chrono::steady_clock::now();
+        auto       reprice = base.clone();
+        const auto changed = reprice.update_if([](Item& item) {
+                if (item.id != Product::Dresses) { return false; }
+
+                item.price *= 0.9F;
+                return true;
+        });
+        const auto value   = stock_value(reprice);
+        elapsed            = ms_since(start);
+        std::printf("%-40s%12.1f%12.0f%12zu\n", "category repriced by 10%", elapsed, dirty_mb() - before, changed);
+
+        std::printf("Stock value %.0f, %.0f with Dresses repriced, %.0f without supplier S0; base %s\n", base_value, value, values[0],
+                    stock_value(base) == base_value ? "unchanged" : "CHANGED");
+}
+
+/// @brief Holds 4M reservations with deadlines spread over 15 minutes, checks half of them out and expires the rest, with the deadlines
+/// on a `TimerWheel` against a `std::multimap` ordered by deadline, then holds and expires stock through `Reservations`.
+inline auto bench_reservations()
+{
+        constexpr std::size_t   NRESERVATIONS = 4000000;
+        constexpr std::uint64_t SPREAD_TICKS  = 15 * 60 * 1000 / RESERVATION_TICK_MS;
+        constexpr std::uint64_t STEP_TICKS    = 1000 / RESERVATION_TICK_MS;        // expired once a second
+
+        const auto ms_since = [](auto start) { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+        std::vector<std::uint64_t> deadlines(NRESERVATIONS);
+        std::vector<std::size_t>   checkouts(NRESERVATIONS / 2);
+        for (std::size_t i = 0; i < NRESERVATIONS; ++i) { deadlines[i] = 1 + (i * 2654435761U) % SPREAD_TICKS; }
+        for (std::size_t i = 0; i < checkouts.size(); ++i) { checkouts[i] = (i * 48271) % NRESERVATIONS; }
+        std::sort(checkouts.begin(), checkouts.end());
+        checkouts.erase(std::unique(checkouts.begin(), checkouts.end()), checkouts.end());
+
+        std::printf("%-34s%12s%12s%12s%12s\n", "Deadlines", "Arm (ns)", "Cancel (ns)", "Expire (ns)", "Expired");
+        const auto report = [&](const char* name, double arm_ms, double cancel_ms, double expire_ms, std::size_t expired) {
+                const auto per = [](double ms, std::size_t n) { return n == 0 ? 0.0 : ms * 1e6 / static_cast<double>(n); };
+                std::printf("%-34s%12.1f%12.1f%12.1f%12zu\n", name, per(arm_ms, NRESERVATIONS), per(cancel_ms, checkouts.size()),
+                            per(expire_ms, expired), expired);
+        };
+
+        {
+                TimerWheel<Reservation> wheel;
+                std::vector<TimerId>    ids(NRESERVATIONS);
+                auto                    start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < NRESERVATIONS; ++i) { ids[i] = wheel.arm(deadlines[i], {static_cast<Handle>(i), 1}); }
+                const auto arm_ms = ms_since(start);
+
+                start = std::chrono::steady_clock::now();
+                for (const auto i : checkouts) { wheel.cancel(ids[i]); }
+                const auto cancel_ms = ms_since(start);
+
+                std::size_t units {0};
+                start = std::chrono::steady_clock::now();
+                for (std::uint64_t now = 0; now <= SPREAD_TICKS; now += STEP_TICKS)
+                {
+                        wheel.advance(now, [&](const Reservation& r) { units += static_cast<std::size_t>(r.quantity); });
+                }
+                report("hierarchical timer wheel", arm_ms, cancel_ms, ms_since(start), units);
+        }
+
+        {
+                using ByDeadline = std::multimap<std::uint64_t, Reservation>;
+                ByDeadline                        by_deadline;
+                std::vector<ByDeadline::iterator> ids(NRESERVATIONS);
+                auto                              start = std::chrono::steady_clock::now();
+                for (std::size_t i = 0; i < NRESERVATIONS; ++i)
+                {
+                        ids[i] = by_deadline.emplace(deadlines[i], Reservation {static_cast<Handle>(i), 1});
+                }
+                const auto arm_ms = ms_since(start);
+
+                start = std::chrono::steady_clock::now();
+                for (const auto i : checkouts) { by_deadline.erase(ids[i]); }
+                const auto cancel_ms = ms_since(start);
+
+                std::size_t units {0};
+                start = std::chrono::steady_clock::now();
+                for (std::uint64_t now = 0; now <= SPREAD_TICKS; now += STEP_TICKS)
+                {
+                        const auto end = by_deadline.upper_bound(now);
+                        for (auto pos = by_deadline.begin(); pos != end; ++pos) { units += static_cast<std::size_t>(pos->second.quantity); }
+                        by_deadline.erase(by_deadline.begin(), end);
+                }
+                report("multimap by deadline", arm_ms, cancel_ms, ms_since(start), units);
+        }
+
+        // through the inventory: every reservation holds a unit of an item and its expiry gives it back
+        constexpr std::size_t NITEMS = 100000;
+        Inventory             inventory;
+        for (std::size_t i = 0; i < NITEMS; ++i) { inventory.add({Product::Skirts, "R" + std::to_string(i), 10.0F, 1000}); }
+
+        Reservations reservations {inventory};
+        const auto   origin = std::chrono::steady_clock::now();
+        auto         start  = origin;
+        std::size_t  held {0};
+        for (std::size_t i = 0; i < NRESERVATIONS / 4; ++i)
+        {
+                const auto pitem = inventory.find_by<ModelCodeKey>("R" + std::to_string(i % NITEMS));
+                const auto ttl   = std::chrono::milliseconds {deadlines[i] * RESERVATION_TICK_MS};
+                held += reservations.reserve(pitem, 1, ttl) ? 1 : 0;
+        }
+        const auto reserve_ms = ms_since(start);
+
+        start                = std::chrono::steady_clock::now();
+        const auto expired   = reservations.expire(origin + std::chrono::minutes {16});
+        const auto expire_ms = ms_since(start);
+
+        auto available = std::int64_t {0};
+        for (auto pitem = inventory.items.begin(); pitem != inventory.items.end(); ++pitem) { available += reservations.available(pitem); }
+        std::printf("Reservations: %zu held in %.1f ns each, %zu expired in %.1f ns each, stock %s\n", held,
+                    reserve_ms * 1e6 / static_cast<double>(held), expired, expire_ms * 1e6 / static_cast<double>(expired),
+                    available == static_cast<std::int64_t>(NITEMS * 1000) ? "available again" : "LOST");
+}
+
+/// @brief Puts 100k of a server's 1M items on sale while a client keeps reading three of them, once with an edit per item and once
+/// with a price change per item scheduled to take effect together, and counts the reads that saw some of the three on sale and some not.
+inline auto bench_prices()
+{
+        constexpr std::size_t NKEYS      = 1000000;
+        constexpr std::size_t SALE_ITEMS = 100000;        // every tenth item
+        constexpr float       PRICE      = 20.0F;
+
+        const auto ms_since = [](auto start) { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+        const auto name_of  = [](std::size_t i) { return "SALE-" + std::to_string(i); };
+
+        Inventory inventory;
+        for (std::size_t i = 0; i < NKEYS; ++i) { inventory.add({static_cast<Product>(i % std::size(PRODUCT_NAMES)), name_of(i), PRICE, 10}); }
+
+        InventoryService service {inventory};
+        FrameServer      server;
+        double           pass_ms {0};
+        if (!server.listen(0))
+        {
+                std::printf("Could not start a server.\n");
+                return;
+        }
+        server.handler    = [&](const FrameView& request, std::string& out) { return service.handle(request, out); };
+        server.background = [&] {
+                const auto start = std::chrono::steady_clock::now();
+                if (service.apply_price_changes() != 0) { pass_ms = ms_since(start); }
+                return false;
+        };
+        const Address address {"127.0.0.1", local_port(server.listener.fd)};
+        std::thread   server_thread {[&] { server.run(); }};
+
+        const auto writer = Client::connect(address);
+        const auto reader = Client::connect(address);
+        if (!writer || !reader)
+        {
+                std::printf("Could not connect to the server.\n");
+                server.stopping = true;
+                server_thread.join();
+                return;
+        }
+
+        // reads the first, a middle and the last item of the sale together until the last has `price`
+        const auto watch = [&](float price) {
+                const std::vector<std::string> names {name_of(0), name_of(NKEYS / 2), name_of((SALE_ITEMS - 1) * 10)};
+                std::size_t                    reads {0};
+                std::size_t                    mixed {0};
+                for (auto done = false; !done; ++reads)
+                {
+                        const auto items = reader->multi_get(names);
+                        const auto on    = std::count_if(items.begin(), items.end(), [&](const auto& item) { return item && item->price == price; });
+                        mixed += on != 0 && on != static_cast<long>(names.size()) ? 1 : 0;
+                        done = items.back() && items.back()->price == price;
+                }
+                return std::pair {reads, mixed};
+        };
+
+        std::printf("%-34s%14s%14s%14s%14s\n", "Sale of 100k items", "Sent (ms)", "Switch (ms)", "Reads", "Mixed reads");
+        {
+                std::vector<std::pair<MessageType, std::string>> puts;
+                for (std::size_t i = 0; i < NKEYS; i += 10)
+                {
+                        encode_item(puts.emplace_back(MessageType::Put, std::string {}).second,
+                                    {static_cast<Product>(i % std::size(PRODUCT_NAMES)), name_of(i), PRICE * 0.8F, 10});
+                }
+
+                auto       watcher = std::async(std::launch::async, watch, PRICE * 0.8F);
+                const auto start   = std::chrono::steady_clock::now();
+                for (auto& future : writer->submit_batch(puts)) { future.wait(); }
+                const auto sent           = ms_since(start);
+                const auto [reads, mixed] = watcher.get();
+                std::printf("%-34s%14.1f%14.1f%14zu%14zu\n", "an edit per item", sent, sent, reads, mixed);
+        }
+        {
+                std::vector<std::pair<std::string, float>> prices;
+                for (std::size_t i = 0; i < NKEYS; i += 10) { prices.emplace_back(name_of(i), PRICE * 0.5F); }
+
+                const auto effective      = PriceSchedule::ms_of(PriceSchedule::Clock::now()) + 2000;
+                auto       watcher        = std::async(std::launch::async, watch, PRICE * 0.5F);
+                const auto start          = std::chrono::steady_clock::now();
+                const auto scheduled      = writer->schedule_prices(prices, effective);
+                const auto sent           = ms_since(start);
+                const auto [reads, mixed] = watcher.get();
+                std::printf("%-34s%14.1f%14.1f%14zu%14zu\n", "price changes scheduled", sent, pass_ms, reads, mixed);
+                if (scheduled != SALE_ITEMS) { std::printf("Only %zu of the price changes were scheduled.\n", scheduled.value_or(0)); }
+        }
+
+        server.stopping = true;
+        server_thread.join();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/// @brief 32-bit FNV-1a hash, used to detect torn blocks and messages. Pass the hash of the bytes before `data` as `hash` to continue it.
+inline auto fnv1a(const char* data, std::size_t size, std::uint32_t hash = 2166136261U)
+{
+        for (std::size_t i = 0; i < size; ++i)
+        {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 16777619U;
+        }
+        return hash;
+}
+
+/// @brief Appends the bytes of `value` to `out`.
+template<typename T>
+auto put(std::string& out, const T& value)
+{
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/// @brief Reads a `T` from `data` and advances it.
+///
+/// @returns false if fewer than `sizeof(T)` bytes are left before `end`.
+template<typename T>
+auto get(const char*& data, const char* end, T& value)
+{
+        if (static_cast<std::size_t>(end - data) < sizeof(T)) { return false; }
+
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return true;
+}
+
+/// @brief Appends `value` as a LEB128 varint.
+inline auto put_varint(std::string& out, std::uint64_t value)
+{
+        for (; value >= 0x80U; value >>= 7U) { out.push_back(static_cast<char>((value & 0x7FU) | 0x80U)); }
+        out.push_back(static_cast<char>(value));
+}
+
+/// @brief Reads a LEB128 varint and advances `data`.
+///
+/// @returns false if the varint runs past `end`.
+inline auto get_varint(const char*& data, const char* end, std::uint64_t& value)
+{
+        value = 0;
+        for (unsigned shift = 0; data < end && shift < 64; shift += 7)
+        {
+                const auto byte = static_cast<std::uint8_t>(*data++);
+                value |= static_cast<std::uint64_t>(byte & 0x7FU) << shift;
+                if ((byte & 0x80U) == 0) { return true; }
+        }
+        return false;
+}
+
+/// @brief Maps signed to unsigned so that values near zero, e.g. a stock decrement, encode as a short varint.
+constexpr auto zigzag(std::int64_t value) { return (static_cast<std::uint64_t>(value) << 1U) ^ static_cast<std::uint64_t>(value >> 63); }
+constexpr auto unzigzag(std::uint64_t value) { return static_cast<std::int64_t>(value >> 1U) ^ -static_cast<std::int64_t>(value & 1U); }
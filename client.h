@@ -0,0 +1,393 @@
+#pragma once
+
+#include "inventory.h"
+#include "net.h"
+#include "protocol.h"
+#include "wire.h"
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+constexpr auto IMPORT_FRAME_ITEMS = std::size_t {16384};        // items per request of `Client::import`, room for model codes up to 4 KiB
+
+/// The final frame answering a request made through `Client`, with the payloads of a streamed result joined, or std::nullopt if the
+/// connection failed before it arrived.
+using Response = std::optional<Frame>;
+
+/// A pipelined connection to an inventory server or router, safe to share between threads.
+///
+/// Requests are written as soon as they are submitted, without waiting for the responses to earlier ones. A reader thread hands each
+/// response to the request with its id; servers may answer a till request before a listing sent ahead of it.
+struct Client
+{
+        /// A request that has been sent and is waiting for its response.
+        struct Pending
+        {
+                std::promise<Response> promise;
+                std::string            payload;        // joined payloads of the `Partial` frames received so far
+        };
+
+        UniqueFd                                   sock;
+        std::mutex                                 send_mutex;        // keeps requests whole on the socket
+        std::mutex                                 mutex;             // guards `pending`, `next_id` and `broken`
+        std::unordered_map<std::uint32_t, Pending> pending;           // by request id
+        std::uint32_t                              next_id {1};
+        bool                                       broken {false};
+        std::thread                                reader;
+
+        Client()              = default;
+        Client(const Client&) = delete;
+        ~Client()
+        {
+                // wakes the reader up from recv(), failing whatever is still outstanding
+                if (sock) { shutdown(sock.fd, SHUT_RDWR); }
+                if (reader.joinable()) { reader.join(); }
+        }
+
+        auto operator=(const Client&) -> Client& = delete;
+
+        /// @brief Connects to `address` and starts the reader thread.
+        ///
+        /// @returns nullptr if the connection failed.
+        static auto connect(const Address& address) -> std::unique_ptr<Client>
+        {
+                auto client  = std::make_unique<Client>();
+                client->sock = connect_tcp(address);
+                if (!client->sock) { return nullptr; }
+
+                client->reader = std::thread {[raw = client.get()] { raw->receive(); }};
+                return client;
+        }
+
+        /// @brief Checks whether the connection is still usable.
+        auto ok()
+        {
+                std::lock_guard lock {mutex};
+                return !broken;
+        }
+
+        /// @brief Sends a request without waiting for the response. A server that has not started on the request `deadline_ms` after
+        /// it arrived answers it with `Expired` instead; 0 waits however long it takes.
+        auto submit(MessageType type, std::string_view payload, std::uint16_t deadline_ms = 0) -> std::future<Response>
+        {
+                return std::move(submit_batch({{type, std::string {payload}}}, deadline_ms).front());
+        }
+
+        /// @brief Sends several requests with a single write, without waiting for the responses.
+        auto submit_batch(const std::vector<std::pair<MessageType, std::string>>& requests, std::uint16_t deadline_ms = 0)
+                -> std::vector<std::future<Response>>
+        {
+                std::vector<std::future<Response>> futures;
+                std::string                        buffer;
+                std::lock_guard                    send_lock {send_mutex};
+                {
+                        std::lock_guard lock {mutex};
+                        for (const auto& [type, payload] : requests)
+                        {
+                                const auto id = next_id++;
+                                futures.push_back(pending[id].promise.get_future());
+                                encode_frame(buffer, type, Status::Ok, id, payload, deadline_ms);
+                        }
+                        if (broken) { fail_pending(); }
+                }
+
+                if (!send_all(sock.fd, buffer.data(), buffer.size())) { shutdown(sock.fd, SHUT_RDWR); }
+                return futures;
+        }
+
+        /// @brief Looks up the item with the given model code.
+        ///
+        /// @returns std::nullopt if there is no such item or the request failed.
+        auto get(const std::string& name) -> std::optional<Item>
+        {
+                return to_item(submit(MessageType::Get, name).get());
+        }
+
+        /// @brief Looks up several items in one round trip, pipelining a `Get` per model code.
+        ///
+        /// @returns the items in the order of `names`, std::nullopt for those that were not found.
+        auto multi_get(const std::vector<std::string>& names)
+        {
+                std::vector<std::pair<MessageType, std::string>> requests;
+                requests.reserve(names.size());
+                for (const auto& name : names) { requests.emplace_back(MessageType::Get, name); }
+
+                std::vector<std::optional<Item>> items;
+                for (auto& future : submit_batch(requests)) { items.push_back(to_item(future.get())); }
+                return items;
+        }
+
+        /// @brief Pages through the items matching `filter`, calling `fn` with each, `page` items per request.
+        ///
+        /// The next page is requested before `fn` sees the current one, so at most two pages are held at a time however many items
+        /// there are, and the server only sends as fast as `fn` consumes.
+        ///
+        /// @returns false if a request failed, after `fn` has seen the items of the pages before it.
+        template<typename Fn>
+        auto scan(const Query& filter, std::uint32_t page, Fn&& fn)
+        {
+                ScanRequest request {0, filter, page, 0};
+                std::string payload;
+                ::put(payload, request);
+                auto next = submit(MessageType::Scan, payload);
+                while (true)
+                {
+                        const auto  response = next.get();
+                        ScanHeader  header {};
+                        const auto* data     = response ? response->payload.data() : nullptr;
+                        if (!response || response->header.status != Status::Ok || !::get(data, data + response->payload.size(), header))
+                        {
+                                return false;
+                        }
+
+                        const auto items = ItemsView::parse(std::string_view {response->payload}.substr(sizeof(header)));
+                        if (!items) { return false; }
+
+                        if (header.done == 0)
+                        {
+                                request.after = header.next;
+                                payload.clear();
+                                ::put(payload, request);
+                                next = submit(MessageType::Scan, payload);
+                        }
+                        for (const auto item : *items) { fn(item); }
+                        if (header.done != 0) { return true; }
+                }
+        }
+
+        /// @brief Adds the item, or replaces the item with the same model code.
+        ///
+        /// @returns false if the request failed.
+        auto put(const Item& item)
+        {
+                std::string payload;
+                encode_item(payload, item);
+                const auto response = submit(MessageType::Put, payload).get();
+                return response && response->header.status == Status::Ok;
+        }
+
+        /// @brief Removes the item with the given model code.
+        ///
+        /// @returns false if there is no such item or the request failed.
+        auto remove(const std::string& name)
+        {
+                const auto response = submit(MessageType::Remove, name).get();
+                return response && response->header.status == Status::Ok;
+        }
+
+        /// @brief Holds `quantity` units of the item with the given model code for a basket, until `ttl_ms` from now unless the basket
+        /// checks out with `commit` first.
+        ///
+        /// @returns std::nullopt if there is no such item, it has fewer units available or the request failed, or the reservation's id.
+        auto reserve(const std::string& name, std::uint32_t quantity, std::uint32_t ttl_ms) -> std::optional<std::uint64_t>
+        {
+                std::string payload;
+                ::put(payload, ReserveRequest {quantity, ttl_ms});
+                payload += name;
+                const auto     response = submit(MessageType::Reserve, payload).get();
+                ReservationRef ref {};
+                if (!response || response->header.status != Status::Ok) { return {}; }
+
+                const auto* data = response->payload.data();
+                if (!::get(data, data + response->payload.size(), ref)) { return {}; }
+                return ref.id;
+        }
+
+        /// @brief Takes the units of a reservation on the item with the given model code out of stock, as the basket checks out.
+        ///
+        /// @returns false if the reservation has expired or been released, or the request failed.
+        auto commit(std::uint64_t id, const std::string& name) { return settle(MessageType::Commit, id, name); }
+
+        /// @brief Gives back the units of a reservation on the item with the given model code.
+        ///
+        /// @returns false if the reservation has expired or been released, or the request failed.
+        auto release(std::uint64_t id, const std::string& name) { return settle(MessageType::Release, id, name); }
+
+        /// @brief Schedules new prices for many items, by model code, to take effect together at `effective_ms`, wall clock time in
+        /// milliseconds since the epoch, pipelining a `SchedulePrice` per item. Each server changes all of its items at once.
+        ///
+        /// @returns the no. of items found and scheduled, or std::nullopt if a request failed.
+        auto schedule_prices(const std::vector<std::pair<std::string, float>>& prices, std::int64_t effective_ms)
+                -> std::optional<std::size_t>
+        {
+                std::vector<std::pair<MessageType, std::string>> requests;
+                requests.reserve(prices.size());
+                for (const auto& [name, price] : prices)
+                {
+                        auto& payload = requests.emplace_back(MessageType::SchedulePrice, std::string {}).second;
+                        ::put(payload, PriceChange {effective_ms, price, 0});
+                        payload += name;
+                }
+
+                std::size_t scheduled {0};
+                auto        ok = true;
+                for (auto& future : submit_batch(requests))
+                {
+                        const auto response = future.get();
+                        const auto status   = response ? response->header.status : Status::Error;
+                        ok                  = ok && (status == Status::Ok || status == Status::NotFound);
+                        scheduled += status == Status::Ok ? 1 : 0;
+                }
+                return ok ? std::optional {scheduled} : std::nullopt;
+        }
+
+        /// @brief Adds or replaces many items, pipelining an `Import` per `IMPORT_FRAME_ITEMS` of them. The server runs imports in
+        /// slices between till requests, so a large import slows lookups down rather than stopping them.
+        ///
+        /// @returns the no. of items imported, or std::nullopt if a request failed, after which some of the items may have been imported.
+        auto import(const std::vector<Item>& items) -> std::optional<std::uint64_t>
+        {
+                std::vector<std::pair<MessageType, std::string>> requests;
+                for (std::size_t i = 0; i < items.size(); ++i)
+                {
+                        if (i % IMPORT_FRAME_ITEMS == 0) { requests.emplace_back(MessageType::Import, std::string {}); }
+                        encode_item(requests.back().second, items[i]);
+                }
+
+                std::uint64_t total {0};
+                auto          ok = true;
+                for (auto& future : submit_batch(requests))
+                {
+                        const auto    response = future.get();
+                        std::uint64_t imported {0};
+                        const auto*   data     = response ? response->payload.data() : nullptr;
+                        const auto    done     = response && response->header.status == Status::Ok;
+                        ok                     = ok && done && ::get(data, data + response->payload.size(), imported);
+                        total += imported;
+                }
+                return ok ? std::optional {total} : std::nullopt;
+        }
+
+private:
+        static auto to_item(const Response& response) -> std::optional<Item>
+        {
+                if (!response || response->header.status != Status::Ok) { return {}; }
+
+                const auto item = ItemView::parse(response->payload);
+                if (!item) { return {}; }
+
+                return item->to_item();
+        }
+
+        auto settle(MessageType type, std::uint64_t id, const std::string& name) -> bool
+        {
+                std::string payload;
+                ::put(payload, ReservationRef {id});
+                payload += name;
+                const auto response = submit(type, payload).get();
+                return response && response->header.status == Status::Ok;
+        }
+
+        /// @brief Completes every outstanding request with a failure. `mutex` must be held.
+        auto fail_pending() -> void
+        {
+                broken = true;
+                for (auto& [id, request] : pending) { request.promise.set_value(std::nullopt); }
+                pending.clear();
+        }
+
+        /// @brief Reader thread: matches responses to requests until the connection fails or is shut down.
+        auto receive() -> void
+        {
+                Frame frame;
+                while (recv_all(sock.fd, reinterpret_cast<char*>(&frame.header), sizeof(frame.header)) && frame.header.length <= MAX_FRAME_BYTES)
+                {
+                        frame.payload.resize(wire_align(frame.header.length));
+                        if (!recv_all(sock.fd, frame.payload.data(), frame.payload.size())) { break; }
+                        frame.payload.resize(frame.header.length);
+
+                        std::lock_guard lock {mutex};
+                        const auto      pos = pending.find(frame.header.request_id);
+                        if (pos == pending.end()) { break; }
+
+                        auto& request = pos->second;
+                        request.payload += frame.payload;
+                        if (frame.header.status == Status::Partial) { continue; }
+
+                        frame.payload = std::move(request.payload);
+                        request.promise.set_value(std::move(frame));
+                        pending.erase(pos);
+                }
+
+                std::lock_guard lock {mutex};
+                fail_pending();
+        }
+};
+
+/// A fixed number of `Client`s to one server, handed out round robin so that many threads can share a few connections.
+///
+/// A client whose connection failed is replaced by a new connection the next time its slot comes round.
+struct ClientPool
+{
+        Address                              address;
+        std::mutex                           mutex;        // guards `clients`
+        std::vector<std::shared_ptr<Client>> clients;
+        std::atomic<std::size_t>             next {0};
+
+        ClientPool(Address address, std::size_t size) : address {std::move(address)}, clients(size) {}
+
+        /// @brief Returns the next client in turn, connecting it first if needed.
+        ///
+        /// @returns nullptr if the server cannot be reached.
+        auto acquire() -> std::shared_ptr<Client>
+        {
+                const auto      slot = next.fetch_add(1, std::memory_order_relaxed) % clients.size();
+                std::lock_guard lock {mutex};
+                auto&           client = clients[slot];
+                if (!client || !client->ok()) { client = Client::connect(address); }
+                return client;
+        }
+};
+
+/// A client side copy of a server's inventory, kept up to date by fetching only the changes made since the last sync.
+struct InventoryCache
+{
+        std::unordered_map<std::string, Item> items;        // by model code
+        Version                               version {0};
+
+        /// @brief Fetches the changes made since the last sync and applies them.
+        ///
+        /// @returns the no. of changes applied, or std::nullopt if the request failed.
+        auto sync(Client& client) -> std::optional<std::size_t>
+        {
+                std::string request;
+                put(request, version);
+                const auto response = client.submit(MessageType::SyncSince, request).get();
+                if (!response || response->header.status != Status::Ok) { return {}; }
+
+                SyncHeader  header {};
+                const auto* data = response->payload.data();
+                const auto* end  = data + response->payload.size();
+                if (!get(data, end, header)) { return {}; }
+
+                // check the whole result before touching the cache, so a bad response leaves it as it was
+                std::vector<std::pair<DeltaHeader, ItemView>> changes;
+                for (std::uint32_t i = 0; i < header.count; ++i)
+                {
+                        DeltaHeader delta {};
+                        const auto  item = get(data, end, delta) ? ItemView::parse({data, static_cast<std::size_t>(end - data)}) : std::nullopt;
+                        if (!item) { return {}; }
+
+                        changes.emplace_back(delta, *item);
+                        data += item->record.size();
+                }
+
+                if (header.full != 0) { items.clear(); }
+                for (const auto& [delta, item] : changes)
+                {
+                        if (delta.removed != 0) { items.erase(std::string {item.name}); }
+                        else { items.insert_or_assign(std::string {item.name}, item.to_item()); }
+                }
+                version = header.version;
+                return changes.size();
+        }
+};
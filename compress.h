@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/// A small LZ77 compressor writing the LZ4 block format: a token byte holding the literal and match lengths, the literals, then a 2 byte
+/// offset back to the match. It trades ratio for speed, which suits journal blocks that are written on the commit path.
+
+constexpr auto LZ_MIN_MATCH  = std::size_t {4};
+constexpr auto LZ_MAX_OFFSET = std::size_t {65535};
+constexpr auto LZ_HASH_BITS  = 12U;
+
+/// @brief Appends an LZ4 style length extension (bytes of 255 followed by the remainder) to `out`.
+inline auto lz_put_length(std::string& out, std::size_t len)
+{
+        for (; len >= 255; len -= 255) { out.push_back(static_cast<char>(255)); }
+        out.push_back(static_cast<char>(len));
+}
+
+/// @brief Appends one sequence of `literals` followed by a match of `match_len` bytes `offset` bytes back. A `match_len` of 0 ends the block.
+inline auto lz_put_sequence(std::string& out, const char* literals, std::size_t literal_len, std::size_t offset, std::size_t match_len)
+{
+        const auto lit_code   = std::min<std::size_t>(literal_len, 15);
+        const auto match_code = match_len == 0 ? 0 : std::min<std::size_t>(match_len - LZ_MIN_MATCH, 15);
+        out.push_back(static_cast<char>((lit_code << 4U) | match_code));
+        if (lit_code == 15) { lz_put_length(out, literal_len - 15); }
+        out.append(literals, literal_len);
+
+        if (match_len == 0) { return; }
+
+        out.push_back(static_cast<char>(offset & 0xFFU));
+        out.push_back(static_cast<char>(offset >> 8U));
+        if (match_code == 15) { lz_put_length(out, match_len - LZ_MIN_MATCH - 15); }
+}
+
+/// @brief Compresses `size` bytes at `src` and appends the result to `out`.
+inline auto lz_compress(const char* src, std::size_t size, std::string& out)
+{
+        const auto read32 = [src](std::size_t pos) {
+                std::uint32_t value {};
+                std::memcpy(&value, src + pos, sizeof(value));
+                return value;
+        };
+
+        // as in LZ4, the last 5 bytes are always literals and no match starts in the last 12
+        std::array<std::uint32_t, 1U << LZ_HASH_BITS> table {};
+        std::size_t                                   anchor {0};
+        std::size_t                                   pos {0};
+        const auto                                    match_limit = size > 12 ? size - 12 : 0;
+        const auto                                    end_limit   = size > 5 ? size - 5 : 0;
+
+        while (pos < match_limit)
+        {
+                const auto seq       = read32(pos);
+                const auto hash      = (seq * 2654435761U) >> (32U - LZ_HASH_BITS);
+                const auto candidate = std::size_t {table[hash]};
+                table[hash]          = static_cast<std::uint32_t>(pos);
+
+                if (candidate >= pos || pos - candidate > LZ_MAX_OFFSET || read32(candidate) != seq)
+                {
+                        ++pos;
+                        continue;
+                }
+
+                auto len = LZ_MIN_MATCH;
+                while (pos + len < end_limit && src[candidate + len] == src[pos + len]) { ++len; }
+
+                lz_put_sequence(out, src + anchor, pos - anchor, pos - candidate, len);
+                pos += len;
+                anchor = pos;
+        }
+
+        lz_put_sequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+/// @brief Decompresses a block written by `lz_compress` into exactly `size` bytes at `dst`.
+///
+/// @returns false if the block is corrupt or does not decompress to `size` bytes.
+inline auto lz_decompress(const char* src, std::size_t src_size, char* dst, std::size_t size)
+{
+        std::size_t in {0};
+        std::size_t out {0};
+
+        const auto get_length = [&](std::size_t len) {
+                std::uint8_t byte {255};
+                while (byte == 255 && in < src_size)
+                {
+                        byte = static_cast<std::uint8_t>(src[in++]);
+                        len += byte;
+                }
+                return len;
+        };
+
+        while (in < src_size)
+        {
+                const auto token       = static_cast<unsigned>(static_cast<std::uint8_t>(src[in++]));
+                auto       literal_len = std::size_t {token >> 4U};
+                if (literal_len == 15) { literal_len = get_length(literal_len); }
+                if (literal_len > src_size - in || literal_len > size - out) { return false; }
+
+                std::memcpy(dst + out, src + in, literal_len);
+                in += literal_len;
+                out += literal_len;
+                if (in == src_size) { break; }        // the last sequence has no match
+
+                if (src_size - in < 2) { return false; }
+                const auto offset = static_cast<std::size_t>(static_cast<std::uint8_t>(src[in])) |
+                                    (static_cast<std::size_t>(static_cast<std::uint8_t>(src[in + 1])) << 8U);
+                in += 2;
+
+                auto match_len = std::size_t {token & 0xFU};
+                if (match_len == 15) { match_len = get_length(match_len); }
+                match_len += LZ_MIN_MATCH;
+                if (offset == 0 || offset > out || match_len > size - out) { return false; }
+
+                // byte by byte since the match may overlap the bytes it produces
+                for (std::size_t i = 0; i < match_len; ++i, ++out) { dst[out] = dst[out - offset]; }
+        }
+
+        return out == size;
+}
@@ -0,0 +1,496 @@
+#pragma once
+
+#include "inventory.h"
+#include "protocol.h"
+#include "query.h"
+#include "server.h"
+#include "spsc.h"
+#include "unique_fd.h"
+#include "wire.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+constexpr auto CORE_QUEUE_DEPTH = std::size_t {64};        // messages in flight from one core to another
+
+/// A request forwarded from one core to another, or the response frames coming back.
+struct CoreMessage
+{
+        bool        reply {false};
+        std::string frames;
+};
+
+/// An inventory split between cores that share nothing, each run by one thread.
+///
+/// Core `i` alone owns the items whose shard hash maps to it, with its own `Inventory` and `InventoryService`, and no other thread ever
+/// touches them, so the data path takes no locks. A request for an item owned elsewhere is forwarded to the owner through the SPSC queue
+/// from the requesting core to it, and the response frames come back through the queue the other way. Listings and queries go to every
+/// core and the partial results are merged, as a router does across servers.
+///
+/// Each core's thread calls `handle` with the requests it receives and `serve_forwarded` whenever it has nothing else to do. While a core
+/// waits for a reply it serves the requests forwarded to it, so cores waiting on each other cannot deadlock. Messages for a core whose
+/// queue is full wait in the sender's `overflow` until the sender next receives, so sending never blocks or recurses. A core's `wake` descriptor
+/// becomes readable when messages are sent to it while it may be sleeping in poll(), so that it notices them.
+struct CoreGroup
+{
+        using Queue = SpscQueue<CoreMessage, CORE_QUEUE_DEPTH>;
+
+        /// The items owned by one core and its end of the queues.
+        struct Core
+        {
+                Inventory                               inventory;
+                InventoryService                        service {inventory};
+                UniqueFd                                wake;                 // eventfd signalled when messages are sent to a sleeping core
+                std::atomic<bool>                       sleeping {false};
+                std::vector<std::optional<std::string>> replies;        // response frames by the core a request was forwarded to
+                std::vector<std::deque<CoreMessage>>    overflow;       // messages by the core they are for, waiting for room in its queue
+        };
+
+        std::vector<std::unique_ptr<Core>>  cores;
+        std::vector<std::unique_ptr<Queue>> queues;        // from core `i` to core `j` at `i * cores.size() + j`
+
+        explicit CoreGroup(std::size_t ncores)
+        {
+                for (std::size_t i = 0; i < ncores; ++i)
+                {
+                        auto core  = std::make_unique<Core>();
+                        core->wake = UniqueFd {eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+                        core->replies.resize(ncores);
+                        core->overflow.resize(ncores);
+                        cores.push_back(std::move(core));
+                }
+                for (std::size_t i = 0; i < ncores * ncores; ++i) { queues.push_back(std::make_unique<Queue>()); }
+        }
+
+        auto size() const { return cores.size(); }
+
+        /// @brief Returns the index of the core owning the item with the given model code.
+        auto owner(std::string_view name) const { return static_cast<std::size_t>(shard_hash(name) % cores.size()); }
+
+        /// @brief Copies the items of `inventory` that core `self` owns into it. Only safe before the core's thread starts serving.
+        ///
+        /// Call it on the thread that will run the core, after placing that thread, so that the core's storage is first touched, and so
+        /// allocated, on its NUMA node.
+        auto load(std::size_t self, const Inventory& inventory)
+        {
+                for (const auto& item : inventory.items)
+                {
+                        if (owner(item.name) == self) { cores[self]->service.put(item); }
+                }
+        }
+
+        /// @brief Hands the items of `inventory` to the cores owning them, all from the calling thread.
+        auto load(const Inventory& inventory)
+        {
+                for (const auto& item : inventory.items) { cores[owner(item.name)]->service.put(item); }
+        }
+
+        /// @brief Looks up an item on behalf of core `self`.
+        ///
+        /// @returns std::nullopt if there is no such item.
+        auto get(std::size_t self, const std::string& name) -> std::optional<Item>
+        {
+                const auto to = owner(name);
+                if (to == self)
+                {
+                        const auto pitem = cores[self]->service.get(name);
+                        return pitem == cores[self]->inventory.items.end() ? std::nullopt : std::optional {*pitem};
+                }
+
+                std::string request;
+                encode_frame(request, MessageType::Get, Status::Ok, 0, name);
+                const auto response = join_frames(forward(self, to, std::move(request)));
+                const auto item     = response && response->header.status == Status::Ok ? ItemView::parse(response->payload) : std::nullopt;
+                return item ? std::optional {item->to_item()} : std::nullopt;
+        }
+
+        /// @brief Adds or replaces an item on behalf of core `self`.
+        auto put(std::size_t self, const Item& item)
+        {
+                const auto to = owner(item.name);
+                if (to == self)
+                {
+                        cores[self]->service.put(item);
+                        return;
+                }
+
+                std::string record;
+                std::string request;
+                encode_item(record, item);
+                encode_frame(request, MessageType::Put, Status::Ok, 0, record);
+                forward(self, to, std::move(request));
+        }
+
+        /// @brief Handles a request received by core `self`, appending the response frames to `out`.
+        ///
+        /// Requests for one item run on its owner, `List`, `Query` and `Aggregate` on every core, `Scan` on one core at a time, starting
+        /// with the first, and an `Import` sends each core its own items. The other requests are not supported.
+        auto handle(std::size_t self, const FrameView& request, std::string& out) -> FrameServer::Job
+        {
+                const auto type = request.header.type;
+                const auto id   = request.header.request_id;
+                switch (type)
+                {
+                        case MessageType::Get:
+                        case MessageType::Put:
+                        case MessageType::Remove:
+                        case MessageType::Reserve:
+                        case MessageType::Commit:
+                        case MessageType::Release:
+                        case MessageType::SchedulePrice:
+                        {
+                                const auto name = model_code_of(request);
+                                if (!name) { break; }
+
+                                const auto to = owner(*name);
+                                if (to == self) { return cores[self]->service.handle(request, out); }
+
+                                out += forward(self, to, copy_frame(request, request.payload));
+                                return {};
+                        }
+                        case MessageType::List:
+                        case MessageType::Query:
+                        {
+                                const auto query = parse_query(request);
+                                if (!query) { break; }
+
+                                std::vector<std::string> requests(cores.size(), copy_frame(request, request.payload));
+                                const auto               responses = scatter(self, std::move(requests));
+
+                                std::vector<std::vector<ItemView>> parts;
+                                for (const auto& response : responses)
+                                {
+                                        const auto items = response ? ItemsView::parse(response->payload) : std::nullopt;
+                                        if (!items || response->header.status != Status::Ok) { break; }
+
+                                        parts.emplace_back(items->begin(), items->end());
+                                }
+                                if (parts.size() < cores.size()) { break; }
+
+                                encode_result(out, type, id, merge_results(parts, *query));
+                                return {};
+                        }
+                        case MessageType::Aggregate:
+                        {
+                                std::vector<std::string> requests(cores.size(), copy_frame(request, request.payload));
+                                AggregateResult          total;
+                                for (const auto& response : scatter(self, std::move(requests)))
+                                {
+                                        AggregateResult part;
+                                        const auto*     data = response ? response->payload.data() : nullptr;
+                                        if (!data || response->header.status != Status::Ok || !::get(data, data + response->payload.size(), part))
+                                        {
+                                                encode_frame(out, type, Status::Error, id, {});
+                                                return {};
+                                        }
+                                        total += part;
+                                }
+
+                                std::string payload;
+                                ::put(payload, total);
+                                encode_frame(out, type, Status::Ok, id, payload);
+                                return {};
+                        }
+                        case MessageType::Scan: return scan(self, request, out);
+                        case MessageType::Import:
+                        {
+                                if (!ItemsView::parse(request.payload)) { break; }
+
+                                return import(self, type, id, std::string {request.payload});
+                        }
+                        default:
+                                encode_frame(out, type, Status::Unsupported, id, {});
+                                return {};
+                }
+
+                encode_frame(out, type, Status::Error, id, {});
+                return {};
+        }
+
+        /// @brief Runs the requests other cores have forwarded to core `self` and takes in the replies to its own.
+        ///
+        /// Set `may_sleep` if the thread blocks on `wake` when there is nothing to do. Other cores only signal `wake` when it might, so
+        /// that cores that are busy exchange messages without a system call.
+        ///
+        /// @returns true if there was anything to do.
+        auto serve_forwarded(std::size_t self, bool may_sleep = false) -> bool
+        {
+                auto& core = *cores[self];
+                if (core.sleeping.load(std::memory_order_relaxed))
+                {
+                        core.sleeping.store(false, std::memory_order_relaxed);
+                        std::uint64_t count {0};
+                        while (read(core.wake.fd, &count, sizeof(count)) > 0) {}
+                }
+
+                // messages still waiting for room keep the thread from sleeping, as nothing would wake it to send them
+                auto worked = receive(self);
+                if (!worked && may_sleep)
+                {
+                        // a core sending after the fence sees the flag and signals; one that sent before it is seen by the second look
+                        core.sleeping.store(true, std::memory_order_relaxed);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        worked = receive(self);
+                }
+                return worked;
+        }
+
+private:
+        /// @brief Sends the messages core `self` has waiting in `overflow`, then takes the messages waiting for it, running requests and
+        /// storing replies.
+        ///
+        /// @returns true if there were any, or some are still waiting to be sent.
+        auto receive(std::size_t self) -> bool
+        {
+                auto& core   = *cores[self];
+                auto  worked = flush(self);
+                for (std::size_t from = 0; from < cores.size(); ++from)
+                {
+                        if (from == self) { continue; }
+
+                        while (auto message = queues[from * cores.size() + self]->pop())
+                        {
+                                worked = true;
+                                if (message->reply) { core.replies[from] = std::move(message->frames); }
+                                else { send(self, from, {true, run(self, message->frames)}); }
+                        }
+                }
+                return worked;
+        }
+
+        /// @brief Moves the messages core `self` has waiting in `overflow` into their queues, as far as there is room.
+        ///
+        /// @returns true if any were moved, or some are still waiting.
+        auto flush(std::size_t self) -> bool
+        {
+                auto worked = false;
+                for (std::size_t to = 0; to < cores.size(); ++to)
+                {
+                        auto& waiting = cores[self]->overflow[to];
+                        auto& queue   = *queues[self * cores.size() + to];
+                        if (waiting.empty()) { continue; }
+
+                        const auto before = waiting.size();
+                        while (!waiting.empty() && queue.push(std::move(waiting.front()))) { waiting.pop_front(); }
+                        if (waiting.size() < before) { wake(to); }
+                        worked = true;
+                }
+                return worked;
+        }
+
+        /// @brief Copies a request into a frame of its own, with `payload` in place of its payload.
+        static auto copy_frame(const FrameView& request, std::string_view payload) -> std::string
+        {
+                std::string frame;
+                encode_frame(frame, request.header.type, Status::Ok, request.header.request_id, payload, request.header.deadline_ms);
+                return frame;
+        }
+
+        /// @brief Joins the payloads of the response frames to a request into one frame, as `Connection::call` does.
+        ///
+        /// @returns std::nullopt if `frames` does not end with a complete final frame.
+        static auto join_frames(std::string_view frames) -> std::optional<Frame>
+        {
+                Frame       joined;
+                std::size_t pos {0};
+                while (const auto frame = decode_frame(frames, pos))
+                {
+                        joined.header = frame->header;
+                        joined.payload += frame->payload;
+                        if (frame->header.status != Status::Partial) { return joined; }
+                }
+                return {};
+        }
+
+        /// @brief Runs a request on core `self`, finishing any job it starts straight away.
+        ///
+        /// @returns the response frames.
+        auto run(std::size_t self, std::string_view frames) -> std::string
+        {
+                std::string out;
+                std::size_t pos {0};
+                if (const auto request = decode_frame(frames, pos))
+                {
+                        if (auto job = cores[self]->service.handle(*request, out))
+                        {
+                                while (!job(out, FrameServer::Clock::time_point::max())) {}
+                        }
+                }
+                return out;
+        }
+
+        /// @brief Queues a message from core `self` to core `to`, or leaves it in `overflow` if the queue is full or other messages are
+        /// already waiting there, so that they arrive in order. `receive` sends it once there is room.
+        auto send(std::size_t self, std::size_t to, CoreMessage&& message) -> void
+        {
+                auto& waiting = cores[self]->overflow[to];
+                if (!waiting.empty() || !queues[self * cores.size() + to]->push(std::move(message)))
+                {
+                        waiting.push_back(std::move(message));
+                        return;
+                }
+                wake(to);
+        }
+
+        /// @brief Signals core `to` if it may be sleeping, after messages have been queued for it.
+        auto wake(std::size_t to) -> void
+        {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (cores[to]->sleeping.load(std::memory_order_relaxed))
+                {
+                        const std::uint64_t one {1};
+                        static_cast<void>(write(cores[to]->wake.fd, &one, sizeof(one)));
+                }
+        }
+
+        /// @brief Sends a request from core `self` to core `to` and waits for the response frames.
+        auto forward(std::size_t self, std::size_t to, std::string&& request) -> std::string
+        {
+                std::vector<std::string> requests(cores.size());
+                requests[to] = std::move(request);
+                return std::move(*scatter_frames(self, std::move(requests))[to]);
+        }
+
+        /// @brief Runs the non-empty `requests[i]` on core `i`, the one for `self` directly, and waits for all the responses.
+        ///
+        /// @returns the responses by core, std::nullopt for the cores that were not sent a request.
+        auto scatter(std::size_t self, std::vector<std::string>&& requests) -> std::vector<std::optional<Frame>>
+        {
+                std::vector<std::optional<Frame>> responses;
+                for (auto& frames : scatter_frames(self, std::move(requests)))
+                {
+                        responses.push_back(frames ? join_frames(*frames) : std::nullopt);
+                }
+                return responses;
+        }
+
+        /// @brief Sends the non-empty `requests[i]` to core `i`, runs the one for `self` while the others are running, and waits for
+        /// their response frames.
+        auto scatter_frames(std::size_t self, std::vector<std::string>&& requests) -> std::vector<std::optional<std::string>>
+        {
+                auto&             core = *cores[self];
+                std::vector<bool> sent(cores.size(), false);
+                for (std::size_t to = 0; to < cores.size(); ++to)
+                {
+                        if (to == self || requests[to].empty()) { continue; }
+
+                        send(self, to, {false, std::move(requests[to])});
+                        sent[to] = true;
+                }
+
+                std::vector<std::optional<std::string>> responses(cores.size());
+                if (!requests[self].empty()) { responses[self] = run(self, requests[self]); }
+                for (std::size_t to = 0; to < cores.size(); ++to)
+                {
+                        if (!sent[to]) { continue; }
+
+                        while (!core.replies[to])
+                        {
+                                if (!serve_forwarded(self)) { std::this_thread::yield(); }
+                        }
+                        responses[to] = std::move(core.replies[to]);
+                        core.replies[to].reset();
+                }
+                return responses;
+        }
+
+        /// @brief Starts a job sending the items in `records`, which have been checked already, to the cores owning them,
+        /// `SLICE_CHECK_ITEMS` at a time, so that core `self` serves tills between slices as a single server does.
+        auto import(std::size_t self, MessageType type, std::uint32_t request_id, std::string records) -> FrameServer::Job
+        {
+                return [this, self, type, request_id, records = std::move(records), pos = std::size_t {0}, count = std::uint64_t {0}](
+                               std::string& out, FrameServer::Clock::time_point until) mutable {
+                        do {
+                                std::vector<std::string> parts(cores.size());
+                                for (std::size_t n = 0; n < SLICE_CHECK_ITEMS && pos < records.size(); ++n)
+                                {
+                                        const auto item = *ItemView::parse(std::string_view {records}.substr(pos));
+                                        encode_item(parts[owner(item.name)], item);
+                                        pos += item.record.size();
+                                }
+
+                                std::vector<std::string> requests(cores.size());
+                                for (std::size_t core = 0; core < cores.size(); ++core)
+                                {
+                                        if (!parts[core].empty()) { encode_frame(requests[core], type, Status::Ok, request_id, parts[core]); }
+                                }
+                                for (const auto& response : scatter(self, std::move(requests)))
+                                {
+                                        if (!response) { continue; }        // no items for that core
+
+                                        std::uint64_t imported {0};
+                                        const auto*   data = response->payload.data();
+                                        if (response->header.status != Status::Ok || !::get(data, data + response->payload.size(), imported))
+                                        {
+                                                encode_frame(out, type, Status::Error, request_id, {});
+                                                return true;
+                                        }
+                                        count += imported;
+                                }
+                        } while (pos < records.size() && FrameServer::Clock::now() < until);
+                        if (pos < records.size()) { return false; }
+
+                        std::string payload;
+                        ::put(payload, count);
+                        encode_frame(out, type, Status::Ok, request_id, payload);
+                        return true;
+                };
+        }
+
+        /// @brief Runs one page of a `Scan` on the core picked by the upper half of the cursor, moving on to the next core when that one
+        /// has no more items. Items do not move between cores, so unlike a router's scan this never misses or repeats one.
+        auto scan(std::size_t self, const FrameView& request, std::string& out) -> FrameServer::Job
+        {
+                const auto  type = request.header.type;
+                const auto  id   = request.header.request_id;
+                ScanRequest scan {};
+                const auto* data = request.payload.data();
+                if (!::get(data, data + request.payload.size(), scan))
+                {
+                        encode_frame(out, type, Status::Error, id, {});
+                        return {};
+                }
+
+                const auto  core = static_cast<std::size_t>(scan.after >> 32U);
+                std::string payload;
+                ScanHeader  header {scan.after, 0, 1};
+                if (core < cores.size())
+                {
+                        scan.after = scan.after & UINT32_MAX;
+                        std::string forwarded;
+                        ::put(forwarded, scan);
+
+                        std::vector<std::string> requests(cores.size());
+                        requests[core]      = copy_frame(request, forwarded);
+                        const auto response = std::move(scatter(self, std::move(requests))[core]);
+                        const auto* result  = response ? response->payload.data() : nullptr;
+                        if (!response || response->header.status != Status::Ok || !::get(result, result + response->payload.size(), header))
+                        {
+                                encode_frame(out, type, Status::Error, id, {});
+                                return {};
+                        }
+
+                        header.next = (static_cast<std::uint64_t>(core) << 32U) | header.next;
+                        if (header.done != 0 && core + 1 < cores.size())
+                        {
+                                header.next = static_cast<std::uint64_t>(core + 1) << 32U;
+                                header.done = 0;
+                        }
+                        ::put(payload, header);
+                        payload.append(response->payload, sizeof(header));
+                }
+                else { ::put(payload, header); }
+
+                encode_frame(out, type, Status::Ok, id, payload);
+                return {};
+        }
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+constexpr auto FLAT_INDEX_MIN_CHANGES = std::size_t {4096};        // changes a small index takes before merging them into its array
+constexpr auto FLAT_INDEX_MERGE_SHARE = std::size_t {16};          // a large one merges once it has 1/16th as many changes as pairs
+
+/// An ordered set of (key, value) pairs kept mostly in one sorted array, so that it is saved and loaded as that array: in one pass, with
+/// no node to allocate and no pointer to fix up.
+///
+/// Pairs added since the array was built wait in a small tree, and pairs removed from the array are marked dead in place. Once there are
+/// enough changes they are merged into a new array, which costs O(n) every n / `FLAT_INDEX_MERGE_SHARE` changes: O(1) a change on average,
+/// and a tree small enough to stay in cache makes adding faster than to a `std::set` of all the pairs. Iterating merges the array and the
+/// tree in order. Like a vector's, iterators are invalidated by any change.
+template<typename K, typename V>
+struct FlatIndex
+{
+        using value_type = std::pair<K, V>;
+
+        /// Walks the live pairs of the array and the added ones in order.
+        struct const_iterator
+        {
+                using iterator_category = std::forward_iterator_tag;
+                using value_type        = FlatIndex::value_type;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = const value_type*;
+                using reference         = const value_type&;
+
+                const FlatIndex*                              index;
+                std::size_t                                   pos;          // next live pair of the array, or its size
+                typename std::set<value_type>::const_iterator added;        // next added pair
+
+                auto operator*() const -> const value_type& { return in_array() ? index->array[pos] : *added; }
+                auto operator->() const { return &**this; }
+                auto operator++() -> const_iterator&
+                {
+                        if (in_array()) { pos = index->live(pos + 1); }
+                        else { ++added; }
+                        return *this;
+                }
+                auto operator==(const const_iterator& other) const { return pos == other.pos && added == other.added; }
+                auto operator!=(const const_iterator& other) const { return !(*this == other); }
+
+        private:
+                auto in_array() const { return pos < index->array.size() && (added == index->added.end() || index->array[pos] < *added); }
+        };
+
+        auto begin() const { return const_iterator {this, live(0), added.begin()}; }
+        auto end() const { return const_iterator {this, array.size(), added.end()}; }
+
+        /// @brief Returns an iterator to the first pair not before `value`.
+        auto lower_bound(const value_type& value) const
+        {
+                const auto pos = static_cast<std::size_t>(std::lower_bound(array.begin(), array.end(), value) - array.begin());
+                return const_iterator {this, live(pos), added.lower_bound(value)};
+        }
+
+        auto size() const { return array.size() - ndead + added.size(); }
+        auto empty() const { return size() == 0; }
+
+        auto emplace(K key, V value)
+        {
+                const value_type entry {key, value};
+                const auto       pos = find_in_array(entry);
+                if (pos < array.size())
+                {
+                        if (dead[pos] == 0) { return; }
+
+                        dead[pos] = 0;
+                        --ndead;
+                        return;
+                }
+                added.insert(entry);
+                merge_if_due();
+        }
+
+        /// @returns the no. of pairs removed, 0 or 1.
+        auto erase(const value_type& entry) -> std::size_t
+        {
+                if (added.erase(entry) != 0) { return 1; }
+
+                const auto pos = find_in_array(entry);
+                if (pos == array.size() || dead[pos] != 0) { return 0; }
+
+                dead[pos] = 1;
+                ++ndead;
+                merge_if_due();
+                return 1;
+        }
+
+        /// @brief Replaces the contents with `sorted`, which must be in order and hold no pair twice.
+        auto assign(std::vector<value_type>&& sorted)
+        {
+                array = std::move(sorted);
+                dead.assign(array.size(), 0);
+                ndead = 0;
+                added.clear();
+        }
+
+        /// @brief Replaces the contents with the `count` pairs at `data`, laid out as the array keeps them, e.g. an array saved to a
+        /// file. Takes one copy, with nothing to insert or sort.
+        ///
+        /// @returns false, leaving the index empty, if the pairs are out of order or hold a pair twice.
+        auto assign(const void* data, std::size_t count)
+        {
+                static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>, "pairs are copied as bytes");
+
+                array.resize(count);
+                std::memcpy(static_cast<void*>(array.data()), data, count * sizeof(value_type));
+                dead.assign(count, 0);
+                ndead = 0;
+                added.clear();
+                if (std::adjacent_find(array.begin(), array.end(), std::greater_equal<> {}) == array.end()) { return true; }
+
+                assign({});
+                return false;
+        }
+
+private:
+        std::vector<value_type>   array;
+        std::vector<std::uint8_t> dead;              // dead[i] is set once array[i] has been removed
+        std::size_t               ndead {0};
+        std::set<value_type>      added;
+
+        /// @brief Returns the first position from `pos` on whose pair has not been removed, or the size of the array.
+        auto live(std::size_t pos) const
+        {
+                while (pos < array.size() && dead[pos] != 0) { ++pos; }
+                return pos;
+        }
+
+        /// @brief Returns the position of `entry` in the array, dead or not, or the size of the array if it is not there.
+        auto find_in_array(const value_type& entry) const
+        {
+                const auto pentry = std::lower_bound(array.begin(), array.end(), entry);
+                return pentry != array.end() && *pentry == entry ? static_cast<std::size_t>(pentry - array.begin()) : array.size();
+        }
+
+        auto merge_if_due() -> void
+        {
+                if (added.size() + ndead <= std::max(array.size() / FLAT_INDEX_MERGE_SHARE, FLAT_INDEX_MIN_CHANGES)) { return; }
+
+                std::vector<value_type> merged;
+                merged.reserve(size());
+                std::copy(begin(), end(), std::back_inserter(merged));
+                assign(std::move(merged));
+        }
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include "inventory.h"
+#include "journal.h"
+#include "server.h"
+#include "snapshot.h"
+#include "unique_fd.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+/// Restarting a server without reloading its inventory: the running server hands the inventory, its listening socket and its idle
+/// connections to the new process over a Unix socket, and the new process serves them from where the old one stopped.
+///
+/// The inventory is passed as a snapshot written to a `memfd`, with its indexes as they are, so the new process reads it from memory in
+/// one pass without touching the disk. The reservations and scheduled price changes of the `InventoryService` follow the snapshot in the
+/// same file. The listening socket stays open throughout, so clients connecting meanwhile wait in its backlog
+/// instead of being refused, and connections between requests carry on in the new process without noticing. The old server stops
+/// serving from the moment it starts the handoff, so nothing changes behind the snapshot; requests it had queued but not run are dropped
+/// along with their connections.
+
+constexpr auto HANDOFF_MAGIC     = std::uint32_t {0x46444E48};        // "HNDF"
+constexpr auto HANDOFF_MAX_FDS   = std::size_t {250};                 // descriptors sent per message, below the kernel's limit of 253
+constexpr auto HANDOFF_DRAIN_MS  = 1000;                              // time the old server takes to send responses it has made
+constexpr auto HANDOFF_PEER_MS   = 5000;                              // longest the old server waits on its successor to take or confirm
+constexpr auto HANDOFF_CONFIRMED = char {'!'};
+
+/// First message of a handoff, sent with the snapshot, the listening socket and the handoff socket attached.
+struct HandoffHeader
+{
+        std::uint32_t magic;
+        std::uint32_t snapshot_version;            // of the snapshot, which the new process must be able to read
+        std::uint64_t snapshot_bytes;
+        std::uint64_t state_bytes;                 // of the service's reservations and price changes, after the snapshot
+        std::uint64_t journal_lsn;                 // last journal record in the inventory
+        std::uint64_t journal_snapshot_lsn;
+        std::uint64_t journal_bytes;               // journalled since that snapshot
+        std::uint32_t journalled;                  // whether the old server kept a journal, which the new one must keep too
+        std::uint32_t nclients;                    // idle connections that follow, `HANDOFF_MAX_FDS` to a message
+};
+
+/// @brief Sends `size` bytes as one message on a Unix socket, with the descriptors `fds` attached.
+inline auto send_fds(int sock, const void* data, std::size_t size, const int* fds, std::size_t nfds)
+{
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)] {};
+        iovec                 iov {const_cast<void*>(data), size};
+        msghdr                msg {};
+        msg.msg_iov    = &iov;
+        msg.msg_iovlen = 1;
+        if (nfds > 0)
+        {
+                msg.msg_control    = control;
+                msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+                auto* cmsg         = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level   = SOL_SOCKET;
+                cmsg->cmsg_type    = SCM_RIGHTS;
+                cmsg->cmsg_len     = CMSG_LEN(sizeof(int) * nfds);
+                std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+        }
+        return sendmsg(sock, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+}
+
+/// @brief Receives a message of exactly `size` bytes from a Unix socket and appends the descriptors attached to it to `fds`.
+inline auto recv_fds(int sock, void* data, std::size_t size, std::vector<UniqueFd>& fds)
+{
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)] {};
+        iovec                 iov {data, size};
+        msghdr                msg {};
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        const auto n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        for (auto* cmsg = CMSG_FIRSTHDR(&msg); n >= 0 && cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) { continue; }
+
+                const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                        int fd {};
+                        std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                        fds.emplace_back(fd);
+                }
+        }
+        return n == static_cast<ssize_t>(size) && (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0;
+}
+
+/// @brief Returns the address of the Unix socket at `path`, or std::nullopt if the path is too long for one.
+inline auto unix_address(const std::string& path) -> std::optional<sockaddr_un>
+{
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) { return {}; }
+
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+}
+
+/// @brief Writes the inventory as a snapshot into a new memory file, followed by `state`.
+///
+/// @returns an empty descriptor if the file could not be created or written. Otherwise stores the size of the snapshot in `size`.
+inline auto write_memory_snapshot(const Inventory& inventory, std::uint64_t lsn, std::string_view state, std::uint64_t& size)
+{
+        UniqueFd   memfd {memfd_create("inventory-handoff", MFD_CLOEXEC)};
+        std::FILE* file = memfd ? fdopen(dup(memfd.fd), "wb") : nullptr;
+        if (file == nullptr) { return UniqueFd {}; }
+
+        auto ok = write_items(file, inventory, lsn) && std::fflush(file) == 0;
+        size    = static_cast<std::uint64_t>(std::ftell(file));
+        ok      = ok && std::fwrite(state.data(), 1, state.size(), file) == state.size();
+        ok      = std::fclose(file) == 0 && ok;
+        return ok ? std::move(memfd) : UniqueFd {};
+}
+
+/// What a new server takes over from the old one.
+struct Takeover
+{
+        Inventory             inventory;
+        HandoffHeader         header {};
+        UniqueFd              listener;        // the TCP socket the old server listened on
+        UniqueFd              handoff;         // the Unix socket the old server waited for its successor on
+        std::vector<UniqueFd> clients;         // connections the old server was between requests on
+        UniqueFd              peer;            // connection to the old server, which waits for `confirm`
+        std::string           state;           // reservations and price changes, for `InventoryService::load_state`
+
+        /// @brief Connects to the server waiting for its successor on `path` and takes over its inventory and sockets.
+        ///
+        /// @returns std::nullopt if there is no server handing off there, or what it sent is incomplete or cannot be read.
+        static auto from(const std::string& path) -> std::optional<Takeover>
+        {
+                const auto addr = unix_address(path);
+                Takeover   takeover;
+                takeover.peer.reset(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+                if (!addr || !takeover.peer || connect(takeover.peer.fd, reinterpret_cast<const sockaddr*>(&*addr), sizeof(*addr)) != 0)
+                {
+                        return {};
+                }
+
+                std::vector<UniqueFd> fds;
+                auto&                 header = takeover.header;
+                if (!recv_fds(takeover.peer.fd, &header, sizeof(header), fds) || fds.size() != 3 || header.magic != HANDOFF_MAGIC ||
+                    header.snapshot_version != SNAPSHOT_VERSION)
+                {
+                        return {};
+                }
+                takeover.listener = std::move(fds[1]);
+                takeover.handoff  = std::move(fds[2]);
+
+                while (takeover.clients.size() < header.nclients)
+                {
+                        std::uint32_t count {};
+                        if (!recv_fds(takeover.peer.fd, &count, sizeof(count), takeover.clients)) { return {}; }
+                }
+
+                // the snapshot is parsed where the old server wrote it, shared through the page cache rather than copied
+                const auto  size = static_cast<std::size_t>(header.snapshot_bytes);
+                const auto  all  = size + static_cast<std::size_t>(header.state_bytes);
+                struct stat st {};
+                const auto  whole = size != 0 && all >= size && fstat(fds[0].fd, &st) == 0 && static_cast<std::uint64_t>(st.st_size) >= all;
+                auto*       data  = whole ? mmap(nullptr, all, PROT_READ, MAP_PRIVATE, fds[0].fd, 0) : MAP_FAILED;
+                if (data == MAP_FAILED) { return {}; }
+
+                auto inventory = parse_snapshot({static_cast<const char*>(data), size});
+                takeover.state.assign(static_cast<const char*>(data) + size, all - size);
+                munmap(data, all);
+                if (!inventory) { return {}; }
+
+                takeover.inventory = std::move(*inventory);
+                return takeover;
+        }
+
+        /// @brief Tells the old server that this one has taken over, after which the old one stops. Until then it waits, and carries on
+        /// serving if this process exits instead or takes longer than `HANDOFF_PEER_MS`.
+        ///
+        /// @returns false if the old server has given up on the handoff, in which case this process must not serve.
+        auto confirm() { return send(peer.fd, &HANDOFF_CONFIRMED, 1, MSG_NOSIGNAL) == 1; }
+};
+
+/// The Unix socket a server waits on for a successor to hand off to.
+struct HandoffPoint
+{
+        UniqueFd listener;
+
+        /// @brief Listens for a successor at `path`, replacing a socket left there by a server that did not hand off.
+        ///
+        /// @returns std::nullopt if the socket could not be bound.
+        static auto listen(const std::string& path) -> std::optional<HandoffPoint>
+        {
+                const auto addr = unix_address(path);
+                UniqueFd   sock {socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)};
+                if (!addr || !sock) { return {}; }
+
+                unlink(path.c_str());
+                if (bind(sock.fd, reinterpret_cast<const sockaddr*>(&*addr), sizeof(*addr)) != 0 || ::listen(sock.fd, 1) != 0 ||
+                    !set_nonblocking(sock.fd))
+                {
+                        return {};
+                }
+                return HandoffPoint {std::move(sock)};
+        }
+
+        /// @brief Hands off to a successor if one has connected, without blocking otherwise. Call it between rounds of `server`.
+        ///
+        /// Sends the inventory of `service` with its reservations and price changes, the sockets of `server` and those of its
+        /// connections that are idle, then waits for the successor to confirm. Once it has, sends what is left of the responses `server`
+        /// has made, and stops it. If the successor fails instead, or has not confirmed within `HANDOFF_PEER_MS`, takes the idle
+        /// connections back and carries on.
+        ///
+        /// @returns true if `server` has been handed off and stopped.
+        auto poll(FrameServer& server, const InventoryService& service, Journal* journal) -> bool
+        {
+                const auto& inventory = service.inventory;
+                UniqueFd peer {accept4(listener.fd, nullptr, nullptr, SOCK_CLOEXEC)};
+                if (!peer) { return false; }
+
+                const timeval timeout {HANDOFF_PEER_MS / 1000, (HANDOFF_PEER_MS % 1000) * 1000};
+                setsockopt(peer.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(peer.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+                const auto    start = std::chrono::steady_clock::now();
+                HandoffHeader header {HANDOFF_MAGIC, SNAPSHOT_VERSION, 0, 0, 0, 0, 0, journal != nullptr, 0};
+                if (journal != nullptr)
+                {
+                        // a compaction still running would go unfinished, and the new process must not miss the last records
+                        journal->maintain(inventory, true);
+                        journal->flush(true);
+                        header.journal_lsn          = journal->last_lsn;
+                        header.journal_snapshot_lsn = journal->snapshot_lsn;
+                        header.journal_bytes        = journal->bytes_since_snapshot;
+                }
+
+                std::string state;
+                service.save_state(state);
+                header.state_bytes = state.size();
+
+                const auto memfd = write_memory_snapshot(inventory, header.journal_lsn, state, header.snapshot_bytes);
+                auto       idle  = server.release_idle_clients();
+                header.nclients  = static_cast<std::uint32_t>(idle.size());
+
+                const int fds[] = {memfd.fd, server.listener.fd, listener.fd};
+                auto      ok    = memfd && send_fds(peer.fd, &header, sizeof(header), fds, 3);
+                for (std::size_t first = 0; ok && first < idle.size(); first += HANDOFF_MAX_FDS)
+                {
+                        std::vector<int> batch;
+                        for (auto i = first; i < std::min(first + HANDOFF_MAX_FDS, idle.size()); ++i) { batch.push_back(idle[i].fd); }
+
+                        const auto count = static_cast<std::uint32_t>(batch.size());
+                        ok               = send_fds(peer.fd, &count, sizeof(count), batch.data(), batch.size());
+                }
+
+                // a successor too slow to confirm is cut off before we take the connections back, so that its confirmation fails
+                // rather than having both of us serve; one that got in before the cut still counts
+                char confirmed {};
+                auto received = ok && recv(peer.fd, &confirmed, 1, 0) == 1;
+                if (ok && !received)
+                {
+                        shutdown(peer.fd, SHUT_RD);
+                        received = recv(peer.fd, &confirmed, 1, MSG_DONTWAIT) == 1;
+                }
+                ok = received && confirmed == HANDOFF_CONFIRMED;
+
+                const auto elapsed = std::chrono::steady_clock::now() - start;
+                const auto ms      = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+                if (!ok)
+                {
+                        for (auto& sock : idle) { server.adopt(std::move(sock)); }
+                        std::printf("Handoff failed after %lld ms, still serving\n", static_cast<long long>(ms));
+                        return false;
+                }
+
+                std::printf("Handed off %zu items and %zu connections in %lld ms\n", inventory.items.size(), idle.size(), static_cast<long long>(ms));
+                server.drain(std::chrono::milliseconds {HANDOFF_DRAIN_MS});
+                server.stopping = true;
+                return true;
+        }
+};
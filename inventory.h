@@ -0,0 +1,524 @@
+#pragma once
+
+#include "flat_index.h"
+#include "sample.h"
+#include "schema.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+constexpr auto MAX_ITEMS      = 30;
+constexpr auto MAX_MODEL_NAME = 64;        // longest model name
+
+/// List of product categories stocked in store.
+enum class Product
+{
+        Invalid = -1,
+        Dresses,
+        CropTops,
+        SweatshirtsHoodies,
+        Blouses,
+        Skirts,
+        Shorts,
+        Jeans,
+        MatchingSets,
+        Swimwear,
+        Accessories,
+        Count
+};
+
+/// @brief Holds the names of the product categories.
+constexpr std::string_view PRODUCT_NAMES[static_cast<int>(Product::Count)] =
+ {
+    [static_cast<int>(Product::Dresses)]                  = "Dresses",
+    [static_cast<int>(Product::CropTops)]                 = "Crop Tops",
+    [static_cast<int>(Product::SweatshirtsHoodies)]       = "Sweatshirts & Hoodies",
+    [static_cast<int>(Product::Blouses)]                  = "Blouses",
+    [static_cast<int>(Product::Skirts)]                   = "Skirts",
+    [static_cast<int>(Product::Shorts)]                   = "Shorts",
+    [static_cast<int>(Product::Jeans)]                    = "Jeans",
+    [static_cast<int>(Product::MatchingSets)]             = "MatchingSets",
+    [static_cast<int>(Product::Swimwear)]                 = "Swimwear",
+    [static_cast<int>(Product::Accessories)]              = "Accessories",
+};
+
+/// @brief Checks if the given product is valid.
+constexpr auto is_valid_product(Product prod) { return prod > Product::Invalid && prod < Product::Count; }
+
+/// @brief Return the name of the given product.
+constexpr auto get_product_name(Product prod)
+{
+        if (!is_valid_product(prod)) { return std::string_view {""}; }
+
+        return PRODUCT_NAMES[static_cast<int>(prod)];
+}
+
+/// @brief Prints a list of all the product categories available.
+inline auto list_products()
+{
+        std::cout << "Product list: \n";
+        std::for_each_n(std::begin(PRODUCT_NAMES), std::size(PRODUCT_NAMES), [i = 0](const auto& name) mutable {
+                std::printf("(%d) %s\n", i, name.data());
+                i++;
+        });
+        std::printf("---------------\n");
+}
+
+/// Represents a stocked item corresponding to one of the listed product categories.
+struct Item
+{
+        Product     id;            // Product category that item falls into
+        std::string name;          // Name of the item
+        float       price;         // Price in GBP
+        int         nstock;        // No. of units in stock
+
+        Item() = default;
+
+        Item(const Product prod, const std::string& name, const float price, const int nstock) :
+                id {prod}, name {name}, price {price}, nstock {nstock}
+        {}
+};
+
+/// @brief Prints the name of a product category in a listing column `width` characters wide.
+inline auto print_field(int width, Product prod) { print_field(width, get_product_name(prod)); }
+
+/// @brief Asks the user for a product category, listing them first.
+///
+/// @returns false if the answer is not a valid category.
+inline auto read_field(std::string_view prompt, Product& prod)
+{
+        list_products();
+        std::printf("%.*s", static_cast<int>(prompt.size()), prompt.data());
+        std::scanf("%d", &prod);
+        return is_valid_product(prod);
+}
+
+/// The fields of `Item`, in listing order. A new member of `Item` only needs a field here to be stored in columns, sent over the wire,
+/// saved in snapshots and journals, listed and asked for.
+inline constexpr auto ITEM_SCHEMA = std::make_tuple(
+        field<Product>("Product", "Select product category to add: ", 32, [](auto& item) -> auto& { return item.id; }),
+        field<std::string>("Model Code", "Enter model code: ", 64, [](auto& item) -> auto& { return item.name; }),
+        field<float>("Price (GBP)", "Enter price: ", 16, [](auto& item) -> auto& { return item.price; }),
+        field<int>("Qty.", "Enter quantity: ", 8, [](auto& item) -> auto& { return item.nstock; }, true));
+
+// positions of the fields in `ITEM_SCHEMA`, to pick their columns
+constexpr auto ITEM_ID     = std::size_t {0};
+constexpr auto ITEM_PRICE  = std::size_t {2};
+constexpr auto ITEM_NSTOCK = std::size_t {3};
+
+using ItemColumns = Columns<ITEM_SCHEMA>;
+
+/// Stable identifier of an item. Unlike an `ItemPtr` it stays valid while other items are added or removed.
+using Handle = std::uint32_t;
+
+/// Counts the changes made to an inventory. Every change gets the next version, so a client that has seen version V needs exactly the
+/// changes with a later version to catch up.
+using Version = std::uint64_t;
+
+constexpr auto MAX_TOMBSTONES = std::size_t {4096};        // removals remembered for delta syncs before the oldest are forgotten
+
+/// How much a change must survive before the call making it returns. Stronger levels cost more latency.
+enum class Durability : std::uint8_t
+{
+        Memory,             // Not journalled. Lost on a crash unless a snapshot was taken after it
+        Buffered,           // Written with the next journal block, at the latest on the next `Journal::maintain`. Not waited for
+        GroupCommit,        // On disk before returning, sharing one sync with other changes made at the same time
+        Sync,               // On disk before returning, synced straight away rather than waiting for others to join
+};
+
+/// @brief Holds the names of the durability levels, as accepted on the command line.
+constexpr std::string_view DURABILITY_NAMES[] = {"memory", "buffered", "group", "sync"};
+
+/// @brief Return the durability level with the given name, or std::nullopt if there is none.
+constexpr auto parse_durability(std::string_view name) -> std::optional<Durability>
+{
+        for (std::size_t i = 0; i < std::size(DURABILITY_NAMES); ++i)
+        {
+                if (DURABILITY_NAMES[i] == name) { return static_cast<Durability>(i); }
+        }
+        return {};
+}
+
+/// Describes a single change made to an inventory of `Record`s.
+template<typename Record>
+struct BasicMutation
+{
+        enum class Op : std::uint8_t
+        {
+                Add,
+                Remove,
+                Update,
+        };
+
+        Op            op;
+        Handle        handle;
+        const Record* item;                                // new value of the item, nullptr for Remove
+        Durability    durability {Durability::Buffered};
+        const Record* previous {nullptr};                  // value of the item before an Update, if known
+};
+
+using Mutation = BasicMutation<Item>;
+
+/// Holds records of one type, such as the stocked items in the store, with the handles, versions and indexes the servers need.
+///
+/// `SCHEMA` describes `Record` and decides which of its fields are kept in `columns`. Each of `Keys` is a type with two static functions,
+/// `of(record)` returning the key of a record and `hash(key)`, and gets an index of the records by the hash of their key, kept up to date
+/// by every change. Keys need not be unique. The key functions are known at compile time, so every instantiation gets its own index code
+/// with them inlined. `Sample` is told of every change too, through `insert(handle, record)`, `erase(handle, record)` and
+/// `update(handle, old_record, new_record)`, so that it can keep a sample of the records to estimate totals from.
+///
+/// Records are called items throughout, after the first type held.
+template<typename Record, const auto& SCHEMA, typename Sample, typename... Keys>
+struct BasicInventory
+{
+        using Mutation     = BasicMutation<Record>;
+        using MutationHook = std::function<bool(const Mutation&)>;        // returns false if it could not record the change
+        using Items        = std::vector<Record>;
+        using ItemPtr      = typename Items::iterator;        // pointer to item type
+
+        /// A record that has been removed, remembered so that a delta sync can tell clients to drop it.
+        struct Tombstone
+        {
+                Handle handle;
+                Record item;
+        };
+
+        /// The records in order of the hash of their `Key`.
+        template<typename Key>
+        using KeyIndex = FlatIndex<std::uint64_t, Handle>;
+
+        Items                        items;
+        Columns<SCHEMA>              columns;                // the fixed-size fields of items[i] at position i, for scans
+        std::vector<Handle>          handles;                // handles[i] identifies items[i], always in ascending order
+        std::vector<Version>         versions;               // versions[i] is the version of the last change to items[i]
+        Handle                       next_handle {1};
+        Version                      version {0};            // version of the last change
+        FlatIndex<Version, Handle>   by_version;             // the last change of every item, in the order they were made
+        std::map<Version, Tombstone> tombstones;             // the last `MAX_TOMBSTONES` removals
+        Sample                       sample;                 // a sample of the items, for approximate totals
+        Version                      forgotten {0};          // removals up to this version are no longer in `tombstones`
+        MutationHook                 on_mutation;            // called on every change, e.g. to journal it
+
+        BasicInventory()
+        {
+                items.reserve(MAX_ITEMS);
+                columns.reserve(MAX_ITEMS);
+                handles.reserve(MAX_ITEMS);
+                versions.reserve(MAX_ITEMS);
+        }
+
+        /// @brief Adds the given item to the inventory, under the handle `next_handle` had.
+        ///
+        /// @returns false if `on_mutation` could not record the change as durably as asked, e.g. because the journal could not be written.
+        /// The item is added all the same.
+        auto add(const Record& item, Durability durability = Durability::Buffered)
+        {
+                const auto handle = next_handle;
+                restore(handle, item);
+                touch(items.size() - 1);
+                return notify({Mutation::Op::Add, handle, &item, durability});
+        }
+
+        /// @brief Deletes the given item from the inventory.
+        ///
+        /// `durability` is passed on to `on_mutation`, as it is for the other changes.
+        ///
+        /// @returns false if `on_mutation` could not record the change. The item is removed all the same.
+        auto remove(ItemPtr pitem, Durability durability = Durability::Buffered)
+        {
+                const auto handle = handle_of(pitem);
+                erase(pitem);
+                return notify({Mutation::Op::Remove, handle, nullptr, durability});
+        }
+
+        /// @brief Replaces the given item in place, keeping its handle and position.
+        ///
+        /// @returns false if `on_mutation` could not record the change. The item is replaced all the same.
+        auto update(ItemPtr pitem, const Record& item, Durability durability = Durability::Buffered)
+        {
+                // notify before assigning so that the hook can see what changed
+                const auto recorded = notify({Mutation::Op::Update, handle_of(pitem), &item, durability, &*pitem});
+                reindex(handle_of(pitem), *pitem, item);
+                *pitem = item;
+                columns.assign(static_cast<std::size_t>(pitem - items.begin()), item);
+                touch(static_cast<std::size_t>(pitem - items.begin()));
+                return recorded;
+        }
+
+        /// @brief Returns the handle of the given item.
+        auto handle_of(ItemPtr pitem) const -> Handle { return handles[pitem - items.begin()]; }
+
+        /// @brief Look for the item with the given handle.
+        ///
+        /// @returns `items.end()` if there is no such item.
+        auto find(Handle handle) -> ItemPtr
+        {
+                const auto phandle = std::lower_bound(handles.begin(), handles.end(), handle);
+                if (phandle == handles.end() || *phandle != handle) { return items.end(); }
+
+                return items.begin() + (phandle - handles.begin());
+        }
+
+        /// @brief Look for an item whose `Key` is `key`.
+        ///
+        /// @returns `items.end()` if there is no such item.
+        template<typename Key, typename K>
+        auto find_by(const K& key) -> ItemPtr
+        {
+                const auto& index = std::get<KeyEntries<Key>>(indexes).entries;
+                const auto  hash  = Key::hash(key);
+                for (auto pos = index.lower_bound({hash, 0}); pos != index.end() && pos->first == hash; ++pos)
+                {
+                        const auto pitem = find(pos->second);
+                        if (Key::of(*pitem) == key) { return pitem; }
+                }
+                return items.end();
+        }
+
+        /// @brief Returns the index of the items by `Key`, to walk them in the order of its hash.
+        template<typename Key>
+        auto index() const -> const KeyIndex<Key>&
+        {
+                return std::get<KeyEntries<Key>>(indexes).entries;
+        }
+
+        /// @brief Adds an item under a handle and version it was given before, e.g. when loading a snapshot. Does not notify `on_mutation`.
+        ///
+        /// Handles must be restored in ascending order.
+        auto restore(Handle handle, const Record& item, Version item_version = 0) -> void
+        {
+                restore_unindexed(handle, item, item_version);
+                (entries<Keys>().emplace(Keys::hash(Keys::of(item)), handle), ...);
+                sample.insert(handle, item);
+                if (item_version != 0) { by_version.emplace(item_version, handle); }
+        }
+
+        /// @brief Same as `restore` but leaves the key indexes, `by_version` and `sample` alone, for loading a snapshot that has them saved.
+        /// They must be loaded before the inventory is used.
+        auto restore_unindexed(Handle handle, const Record& item, Version item_version = 0) -> void
+        {
+                items.emplace_back(item);
+                columns.push_back(item);
+                handles.push_back(handle);
+                versions.push_back(item_version);
+                next_handle = std::max(next_handle, handle + 1);
+                version     = std::max(version, item_version);
+        }
+
+        /// @brief Calls `fn(index)` for the index of every key, in the order of `Keys`, e.g. to save or load them.
+        template<typename Fn>
+        auto for_each_index(Fn&& fn) const
+        {
+                (fn(index<Keys>()), ...);
+        }
+        template<typename Fn>
+        auto for_each_index(Fn&& fn)
+        {
+                (fn(entries<Keys>()), ...);
+        }
+
+        /// @brief Applies a change recorded from another inventory, e.g. when replaying a journal. Does not notify `on_mutation`.
+        ///
+        /// @returns false if the change does not apply to this inventory.
+        auto apply(const Mutation& mutation)
+        {
+                if (mutation.op == Mutation::Op::Add)
+                {
+                        // adds come in the order of their handles, except for items journalled only once they were changed durably
+                        const auto phandle = std::lower_bound(handles.begin(), handles.end(), mutation.handle);
+                        if (phandle != handles.end() && *phandle == mutation.handle) { return false; }
+
+                        const auto pos = static_cast<std::size_t>(phandle - handles.begin());
+                        insert(pos, mutation.handle, *mutation.item);
+                        touch(pos);
+                        return true;
+                }
+
+                const auto pitem = find(mutation.handle);
+                if (pitem == items.end()) { return false; }
+
+                if (mutation.op == Mutation::Op::Remove) { erase(pitem); }
+                else
+                {
+                        reindex(mutation.handle, *pitem, *mutation.item);
+                        *pitem = *mutation.item;
+                        columns.assign(static_cast<std::size_t>(pitem - items.begin()), *mutation.item);
+                        touch(static_cast<std::size_t>(pitem - items.begin()));
+                }
+                return true;
+        }
+
+        /// @brief Walks the changes made after version `since` in the order they were made, calling `changed(item, version)` for each
+        /// item added or updated and `removed(tombstone, version)` for each item removed. Only the last change to an item is seen.
+        ///
+        /// @returns false if removals that old have been forgotten, in which case the caller needs the whole inventory instead.
+        template<typename Changed, typename Removed>
+        auto changes_since(Version since, Changed&& changed, Removed&& removed) const
+        {
+                if (since < forgotten) { return false; }
+
+                auto pchange  = by_version.lower_bound({since + 1, 0});
+                auto premoval = tombstones.upper_bound(since);
+                while (pchange != by_version.end() || premoval != tombstones.end())
+                {
+                        if (premoval == tombstones.end() || (pchange != by_version.end() && pchange->first < premoval->first))
+                        {
+                                const auto pos = std::lower_bound(handles.begin(), handles.end(), pchange->second) - handles.begin();
+                                changed(items[static_cast<std::size_t>(pos)], pchange->first);
+                                ++pchange;
+                        }
+                        else
+                        {
+                                removed(premoval->second, premoval->first);
+                                ++premoval;
+                        }
+                }
+                return true;
+        }
+
+        /// @brief Look for the first item for which the given predicate returns true.
+        ///
+        /// @returns `items.end()` if there is no such item.
+        template<typename Predicate>
+        auto search(Predicate&& pred) -> ItemPtr
+        {
+                return std::find_if(items.begin(), items.end(), pred);
+        }
+
+        /// @brief Prints a table listing currently stocked items in the inventory.
+        auto list()
+        {
+                print_record_header(SCHEMA);
+                std::for_each(items.begin(), items.end(), [](const auto& item) { print_record(SCHEMA, item); });
+                std::printf("---------------\n");
+        }
+
+private:
+        /// Gives every key a distinct type in `indexes`.
+        template<typename Key>
+        struct KeyEntries
+        {
+                KeyIndex<Key> entries;
+        };
+
+        std::tuple<KeyEntries<Keys>...> indexes;
+
+        template<typename Key>
+        auto entries() -> KeyIndex<Key>&
+        {
+                return std::get<KeyEntries<Key>>(indexes).entries;
+        }
+
+        /// @brief Moves the item with `handle` in the indexes whose key differs between its old and new value, and updates it in the sample.
+        auto reindex(Handle handle, const Record& old_item, const Record& new_item) -> void
+        {
+                (reindex<Keys>(handle, old_item, new_item), ...);
+                sample.update(handle, old_item, new_item);
+        }
+
+        template<typename Key>
+        auto reindex(Handle handle, const Record& old_item, const Record& new_item) -> void
+        {
+                const auto old_key = Key::of(old_item);
+                const auto new_key = Key::of(new_item);
+                if (old_key == new_key) { return; }
+
+                entries<Key>().erase({Key::hash(old_key), handle});
+                entries<Key>().emplace(Key::hash(new_key), handle);
+        }
+
+        auto notify(const Mutation& mutation) -> bool { return !on_mutation || on_mutation(mutation); }
+
+        /// @brief Adds an item at position `pos`, which keeps `handles` in ascending order.
+        auto insert(std::size_t pos, Handle handle, const Record& item) -> void
+        {
+                const auto at = static_cast<std::ptrdiff_t>(pos);
+                items.insert(items.begin() + at, item);
+                columns.insert(pos, item);
+                handles.insert(handles.begin() + at, handle);
+                versions.insert(versions.begin() + at, 0);
+                next_handle = std::max(next_handle, handle + 1);
+                (entries<Keys>().emplace(Keys::hash(Keys::of(item)), handle), ...);
+                sample.insert(handle, item);
+        }
+
+        /// @brief Gives the item at `pos` the next version.
+        auto touch(std::size_t pos) -> void
+        {
+                if (versions[pos] != 0) { by_version.erase({versions[pos], handles[pos]}); }
+                versions[pos] = ++version;
+                by_version.emplace(version, handles[pos]);
+        }
+
+        /// @brief Removes the item, leaving a tombstone at the next version.
+        auto erase(ItemPtr pitem) -> void
+        {
+                const auto pos = pitem - items.begin();
+                (entries<Keys>().erase({Keys::hash(Keys::of(*pitem)), handles[static_cast<std::size_t>(pos)]}), ...);
+                sample.erase(handles[static_cast<std::size_t>(pos)], *pitem);
+                if (versions[static_cast<std::size_t>(pos)] != 0)
+                {
+                        by_version.erase({versions[static_cast<std::size_t>(pos)], handles[static_cast<std::size_t>(pos)]});
+                }
+                tombstones.emplace(++version, Tombstone {handles[static_cast<std::size_t>(pos)], std::move(*pitem)});
+                if (tombstones.size() > MAX_TOMBSTONES)
+                {
+                        forgotten = tombstones.begin()->first;
+                        tombstones.erase(tombstones.begin());
+                }
+
+                handles.erase(handles.begin() + pos);
+                versions.erase(versions.begin() + pos);
+                columns.erase(static_cast<std::size_t>(pos));
+                items.erase(pitem);
+        }
+};
+
+/// @brief Hashes a model code onto the ring that `Item`s are sharded by. FNV-1a with a final mix so that similar codes spread out.
+inline auto shard_hash(std::string_view model_code)
+{
+        std::uint64_t hash {14695981039346656037U};
+        for (const auto c : model_code)
+        {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 1099511628211U;
+        }
+        hash ^= hash >> 33U;
+        hash *= 0xFF51AFD7ED558CCDU;
+        hash ^= hash >> 33U;
+        return hash;
+}
+
+/// Key of items by model code, indexed in the order of `shard_hash` so that servers can scan ranges of the ring.
+struct ModelCodeKey
+{
+        static auto of(const Item& item) -> std::string_view { return item.name; }
+        static auto hash(std::string_view name) { return shard_hash(name); }
+};
+
+/// Strata of items sampled for approximate totals: one per product category, so that categories with few items are sampled as well as
+/// the rest and a total over one category reads only its sample.
+struct ProductStrata
+{
+        static constexpr auto COUNT = static_cast<std::size_t>(Product::Count);
+
+        static auto of(const Item& item) { return static_cast<std::size_t>(item.id); }
+};
+
+constexpr auto SAMPLE_PER_PRODUCT = std::size_t {1024};        // items sampled from each product category
+
+using ItemSample = StratifiedSample<Item, ITEM_SCHEMA, ProductStrata, SAMPLE_PER_PRODUCT>;
+
+/// Holds the inventory of all the stocked items in the store.
+using Inventory = BasicInventory<Item, ITEM_SCHEMA, ItemSample, ModelCodeKey>;
+using Tombstone = Inventory::Tombstone;
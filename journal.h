@@ -0,0 +1,699 @@
+#pragma once
+
+#include "bytes.h"
+#include "compress.h"
+#include "inventory.h"
+#include "schema.h"
+#include "snapshot.h"
+#include "unique_fd.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+constexpr auto JOURNAL_SEGMENT_BYTES = std::uint64_t {4U << 20U};         // roll over to a new segment file after this many bytes
+constexpr auto JOURNAL_BLOCK_BYTES   = std::size_t {64U << 10U};          // write buffered records once they fill a block this big
+constexpr auto JOURNAL_COMPACT_BYTES = std::uint64_t {16U << 20U};        // fold the journal into a snapshot after this many bytes
+
+/// How the records in a journal block are stored.
+enum class JournalCodec : std::uint8_t
+{
+        Stored,        // as encoded, used when compressing does not make the block smaller
+        Lz,            // compressed with `lz_compress`
+};
+
+/// Precedes every block of records in a journal segment. A block whose checksum does not match was torn by a crash and ends the segment.
+struct JournalBlockHeader
+{
+        std::uint32_t stored_size;        // No. of bytes that follow
+        std::uint32_t raw_size;           // No. of bytes of encoded records once decompressed
+        std::uint32_t checksum;           // FNV-1a of the stored bytes
+        std::uint32_t count;              // No. of records in the block
+        std::uint64_t first_lsn;          // LSN of the first record, the others follow consecutively
+        JournalCodec  codec;
+        std::uint8_t  reserved[7];
+};
+
+/// Bits of the fields carried by a journal record, stored next to its op, by position in `ITEM_SCHEMA`. Adds carry every field, updates
+/// only the ones that changed.
+///
+/// Fields are numbered in the order they are encoded, fixed-size ones first. Integer fields journalled as deltas get a second bit after
+/// all the others, set instead of the first when the record carries the change to the field rather than its value.
+struct JournalFields
+{
+        std::uint8_t value[std::tuple_size_v<std::decay_t<decltype(ITEM_SCHEMA)>>] {};
+        std::uint8_t delta[std::tuple_size_v<std::decay_t<decltype(ITEM_SCHEMA)>>] {};
+        std::uint8_t all {0};        // every value bit, as carried by an add
+        unsigned     count {0};      // No. of bits used
+};
+
+/// @brief Numbers the fields of `ITEM_SCHEMA` for journal records.
+constexpr auto journal_fields()
+{
+        JournalFields fields;
+        for_each_encoded_field(ITEM_SCHEMA, [&](const auto&, auto index) {
+                fields.value[index] = static_cast<std::uint8_t>(1U << fields.count++);
+                fields.all |= fields.value[index];
+        });
+        for_each_encoded_field(ITEM_SCHEMA, [&](const auto& field, auto index) {
+                if (!std::is_integral_v<field_t<decltype(field)>> || !field.delta) { return; }
+
+                fields.delta[index] = static_cast<std::uint8_t>(1U << fields.count++);
+        });
+        return fields;
+}
+
+constexpr auto JOURNAL_FIELDS = journal_fields();
+static_assert(JOURNAL_FIELDS.count <= 6, "field bits share the record's first byte with the op");
+
+/// A decoded journal record. Fields not in `fields` keep the value the item already has.
+struct JournalRecord
+{
+        Mutation::Op op {};
+        Handle       handle {};
+        std::uint8_t fields {0};
+        Item         item {};
+        std::int64_t delta[std::size(JOURNAL_FIELDS.delta)] {};        // change to each field whose delta bit is set
+};
+
+/// @brief Appends a field of a journal record: integers and enums as zigzag varints, strings prefixed by their length.
+template<typename T>
+auto put_journal_field(std::string& out, const T& value)
+{
+        if constexpr (!is_fixed_field<T>)
+        {
+                put_varint(out, value.size());
+                out.append(value);
+        }
+        else if constexpr (std::is_floating_point_v<T>) { put(out, value); }
+        else { put_varint(out, zigzag(static_cast<std::int64_t>(value))); }
+}
+
+/// @brief Reads a field of a journal record and advances `data`.
+///
+/// @returns false if the field runs past `end`.
+template<typename T>
+auto get_journal_field(const char*& data, const char* end, T& value)
+{
+        if constexpr (std::is_floating_point_v<T>) { return get(data, end, value); }
+        else
+        {
+                std::uint64_t raw {};
+                if (!get_varint(data, end, raw)) { return false; }
+                if constexpr (!is_fixed_field<T>)
+                {
+                        if (static_cast<std::uint64_t>(end - data) < raw) { return false; }
+
+                        value.assign(data, raw);
+                        data += raw;
+                }
+                else { value = static_cast<T>(unzigzag(raw)); }
+                return true;
+        }
+}
+
+/// @brief Appends the journal record for `mutation` to `out`.
+///
+/// The handle is stored as the difference from `prev_handle`, the handle of the previous record in the block, so runs of changes to the
+/// same or neighbouring items take a byte. Updates that know the item's previous value only store the fields that changed, and counters
+/// as a difference, so `mutation.previous` must be the value the journal last saw, or nullptr to store every field.
+inline auto encode_record(std::string& out, Handle& prev_handle, const Mutation& mutation)
+{
+        std::uint8_t fields {0};
+        if (mutation.item != nullptr && mutation.previous != nullptr)
+        {
+                for_each_field(ITEM_SCHEMA, [&](const auto& field, auto index) {
+                        if (field.of(*mutation.item) == field.of(*mutation.previous)) { return; }
+
+                        fields |= JOURNAL_FIELDS.delta[index] != 0 ? JOURNAL_FIELDS.delta[index] : JOURNAL_FIELDS.value[index];
+                });
+        }
+        else if (mutation.item != nullptr) { fields = JOURNAL_FIELDS.all; }
+
+        out.push_back(static_cast<char>(static_cast<std::uint8_t>(mutation.op) | (fields << 2U)));
+        put_varint(out, zigzag(static_cast<std::int64_t>(mutation.handle) - static_cast<std::int64_t>(prev_handle)));
+        prev_handle = mutation.handle;
+
+        if (fields == 0) { return; }
+
+        for_each_encoded_field(ITEM_SCHEMA, [&](const auto& field, auto index) {
+                using T = field_t<decltype(field)>;
+                if (fields & JOURNAL_FIELDS.value[index]) { put_journal_field(out, field.of(*mutation.item)); }
+                if constexpr (std::is_integral_v<T>)
+                {
+                        if (fields & JOURNAL_FIELDS.delta[index])
+                        {
+                                put_varint(out, zigzag(static_cast<std::int64_t>(field.of(*mutation.item)) - field.of(*mutation.previous)));
+                        }
+                }
+        });
+}
+
+/// @brief Decodes the record at `data` and advances past it.
+///
+/// @returns false if the record is truncated or corrupt.
+inline auto decode_record(const char*& data, const char* end, Handle& prev_handle, JournalRecord& record)
+{
+        if (data >= end) { return false; }
+
+        const auto    header = static_cast<std::uint8_t>(*data++);
+        std::uint64_t value {};
+        record.op     = static_cast<Mutation::Op>(header & 3U);
+        record.fields = static_cast<std::uint8_t>(header >> 2U);
+        if (!get_varint(data, end, value)) { return false; }
+
+        record.handle = static_cast<Handle>(static_cast<std::int64_t>(prev_handle) + unzigzag(value));
+        prev_handle   = record.handle;
+
+        auto ok = true;
+        for_each_encoded_field(ITEM_SCHEMA, [&](const auto& field, auto index) {
+                if (ok && (record.fields & JOURNAL_FIELDS.value[index])) { ok = get_journal_field(data, end, field.of(record.item)); }
+                if (ok && (record.fields & JOURNAL_FIELDS.delta[index]))
+                {
+                        ok                  = get_varint(data, end, value);
+                        record.delta[index] = unzigzag(value);
+                }
+        });
+        return ok;
+}
+
+/// @brief Applies a decoded record to the inventory, filling in the fields the record does not carry from the item's current value.
+///
+/// @returns false if the record does not apply to this inventory.
+inline auto apply_record(Inventory& inventory, const JournalRecord& record)
+{
+        if (record.op != Mutation::Op::Update) { return inventory.apply({record.op, record.handle, &record.item}); }
+
+        const auto pitem = inventory.find(record.handle);
+        if (pitem == inventory.items.end()) { return false; }
+
+        auto item = *pitem;
+        for_each_field(ITEM_SCHEMA, [&](const auto& field, auto index) {
+                using T = field_t<decltype(field)>;
+                if (record.fields & JOURNAL_FIELDS.value[index]) { field.of(item) = field.of(record.item); }
+                if constexpr (std::is_integral_v<T>)
+                {
+                        if (record.fields & JOURNAL_FIELDS.delta[index]) { field.of(item) = static_cast<T>(field.of(item) + record.delta[index]); }
+                }
+        });
+        return inventory.apply({Mutation::Op::Update, record.handle, &item});
+}
+
+/// @brief Compresses the encoded records in `raw` into a block and appends it, header first, to `out`.
+inline auto encode_block(std::string& out, const std::string& raw, std::uint64_t first_lsn, std::uint32_t count)
+{
+        JournalBlockHeader hdr {};
+        const auto         start = out.size();
+        put(out, hdr);
+        lz_compress(raw.data(), raw.size(), out);
+
+        hdr.codec = JournalCodec::Lz;
+        if (out.size() - start - sizeof(hdr) >= raw.size())
+        {
+                out.resize(start + sizeof(hdr));
+                out.append(raw);
+                hdr.codec = JournalCodec::Stored;
+        }
+
+        const auto* stored = out.data() + start + sizeof(hdr);
+        hdr.stored_size    = static_cast<std::uint32_t>(out.size() - start - sizeof(hdr));
+        hdr.raw_size       = static_cast<std::uint32_t>(raw.size());
+        hdr.checksum       = fnv1a(stored, hdr.stored_size);
+        hdr.count          = count;
+        hdr.first_lsn      = first_lsn;
+        std::memcpy(out.data() + start, &hdr, sizeof(hdr));
+}
+
+/// @brief Reads the block at `data` into `raw`, decompressing it if needed, and advances past it.
+///
+/// @returns false if the block is truncated or corrupt.
+inline auto decode_block(const char*& data, const char* end, JournalBlockHeader& hdr, std::string& raw)
+{
+        if (!get(data, end, hdr) || static_cast<std::size_t>(end - data) < hdr.stored_size || fnv1a(data, hdr.stored_size) != hdr.checksum) { return false; }
+
+        const auto* stored = data;
+        data += hdr.stored_size;
+        if (hdr.codec == JournalCodec::Stored)
+        {
+                raw.assign(stored, hdr.stored_size);
+                return hdr.stored_size == hdr.raw_size;
+        }
+
+        raw.resize(hdr.raw_size);
+        return hdr.codec == JournalCodec::Lz && lz_decompress(stored, hdr.stored_size, raw.data(), raw.size());
+}
+
+/// What happened while recovering an inventory from its journal directory.
+struct RecoveryStats
+{
+        std::uint64_t snapshot_lsn {0};        // journal position of the snapshot that was loaded
+        std::uint64_t replayed {0};            // No. of journal records applied on top of the snapshot
+        std::uint64_t failed {0};              // No. of journal records that did not apply, e.g. to items the snapshot does not have
+        std::uint64_t truncated {0};           // No. of bytes of blocks torn by a crash cut off the ends of segments
+        std::uint64_t missing {0};             // No. of records missing before the first record of a gap, which ends the replay
+        bool          writable {true};         // false if a torn block could not be cut off, so records must not be appended after it
+        std::uint64_t segments {0};            // No. of segment files read
+        std::uint64_t bytes_read {0};          // No. of bytes read from the segment files
+        std::uint64_t duration_us {0};
+};
+
+/// Append-only log of every change made to an inventory, stored as a sequence of segment files next to a snapshot.
+///
+/// Each record gets a log sequence number (LSN). Recovery loads the snapshot and replays only the records after the snapshot's LSN.
+/// To keep recovery time bounded, `maintain` periodically folds the journal into a new snapshot written by a forked child, then deletes
+/// the segments the snapshot has made redundant.
+///
+/// Records may be appended from several threads. How long `append` blocks depends on the durability asked for, see `Durability`.
+struct Journal
+{
+        std::string                       dir;
+        UniqueFd                          segment;                      // segment currently being appended to
+        std::uint64_t                     segment_bytes {0};
+        std::uint64_t                     last_lsn {0};                 // LSN of the last record appended
+        std::uint64_t                     durable_lsn {0};              // LSN of the last record known to be on disk
+        std::uint64_t                     snapshot_lsn {0};             // LSN covered by the snapshot on disk
+        std::uint64_t                     bytes_since_snapshot {0};
+        std::uint64_t                     compact_bytes {JOURNAL_COMPACT_BYTES};
+        std::chrono::microseconds         group_commit_window {200};    // how long a group commit waits for others to join it
+        std::optional<BackgroundSnapshot> compaction;                   // snapshot being written to compact the journal
+        std::uint64_t                     compaction_lsn {0};
+        std::uint64_t                     raw_bytes {0};                // encoded size of the records written since opening
+        std::uint64_t                     stored_bytes {0};             // size of the same records once compressed into blocks
+
+        Journal() = default;
+        Journal(const Journal&) = delete;
+        ~Journal() { flush(true); }
+
+        auto operator=(const Journal&) -> Journal& = delete;
+
+        /// @brief Loads the inventory stored in `dir` and opens the journal for appending. Creates `dir` if it does not exist.
+        ///
+        /// @returns nullptr if the directory or a new segment could not be created, a torn block could not be cut off, or records are
+        /// missing from the journal, as new records would then follow records that cannot be replayed.
+        static auto open(const std::string& dir, Inventory& inventory, RecoveryStats* stats = nullptr) -> std::unique_ptr<Journal>
+        {
+                std::error_code ec;
+                std::filesystem::create_directories(dir, ec);
+                if (ec) { return {}; }
+
+                auto journal = std::make_unique<Journal>();
+                journal->dir = dir;
+
+                const auto recovery = journal->recover(inventory);
+                if (stats != nullptr) { *stats = recovery; }
+                if (!recovery.writable || recovery.missing != 0 || !journal->roll()) { return {}; }
+
+                journal->durable_lsn = journal->last_lsn;
+                return journal;
+        }
+
+        /// @brief Opens the journal in `dir` for appending after `last_lsn`, for an inventory that is already up to date with it, such as
+        /// one taken over from the process that kept the journal until now. `snapshot_lsn` and `bytes_since_snapshot` are that process's, so
+        /// compaction carries on where it was.
+        ///
+        /// @returns nullptr if a new segment could not be created.
+        static auto resume(const std::string& dir, std::uint64_t last_lsn, std::uint64_t snapshot_lsn, std::uint64_t bytes_since_snapshot)
+                -> std::unique_ptr<Journal>
+        {
+                auto journal                  = std::make_unique<Journal>();
+                journal->dir                  = dir;
+                journal->last_lsn             = last_lsn;
+                journal->durable_lsn          = last_lsn;
+                journal->snapshot_lsn         = snapshot_lsn;
+                journal->bytes_since_snapshot = bytes_since_snapshot;
+                if (!journal->roll()) { return {}; }
+
+                return journal;
+        }
+
+        auto snapshot_path() const { return dir + "/snapshot"; }
+
+        /// @brief Appends a record for `mutation` and waits until it is as durable as `mutation.durability` asks for.
+        ///
+        /// Meant to be installed as `Inventory::on_mutation`.
+        ///
+        /// @returns false if the record could not be written.
+        auto append(const Mutation& mutation)
+        {
+                std::unique_lock lock {mutex};
+                if (mutation.durability == Durability::Memory)
+                {
+                        // the journal never sees this value, so the item's next record cannot be a change from it: it carries the whole
+                        // item, as an add if the journal has not seen the item at all
+                        if (mutation.op == Mutation::Op::Remove) { forget_memory_changes(mutation.handle); }
+                        else { changed_in_memory.emplace(mutation.handle, mutation.op); }
+                        return true;
+                }
+
+                auto record = mutation;
+                if (const auto op = forget_memory_changes(mutation.handle))
+                {
+                        if (*op == Mutation::Op::Add && record.op == Mutation::Op::Remove) { return true; }        // never journalled
+
+                        if (*op == Mutation::Op::Add) { record.op = Mutation::Op::Add; }
+                        record.previous = nullptr;
+                }
+
+                const auto lsn = ++last_lsn;
+                if (pending_count++ == 0) { pending_first_lsn = lsn; }
+                encode_record(pending, pending_prev_handle, record);
+
+                switch (mutation.durability)
+                {
+                        case Durability::Buffered:
+                                // if another thread is writing, our record goes out with its next block
+                                return pending.size() < JOURNAL_BLOCK_BYTES || flushing || write_pending(lock, false);
+                        case Durability::GroupCommit:
+                                // give concurrent appenders a chance to share the next sync with us
+                                cv.wait_for(lock, group_commit_window, [&] { return durable_lsn >= lsn; });
+                                [[fallthrough]];
+                        case Durability::Sync:
+                        default:
+                                while (durable_lsn < lsn)
+                                {
+                                        if (!write_pending(lock, true)) { return false; }
+                                }
+                                return true;
+                }
+        }
+
+        /// @brief Writes all appended records to the segment and, if `sync` is set, waits for them to reach the disk.
+        auto flush(bool sync) -> bool
+        {
+                std::unique_lock lock {mutex};
+                return write_pending(lock, sync);
+        }
+
+        /// @brief Drives compaction; call it regularly from the thread that owns the inventory.
+        ///
+        /// Writes out buffered records, reaps a finished compaction snapshot and starts a new one once enough has been journalled since the
+        /// last.
+        ///
+        /// @returns the stats of a compaction that finished during this call.
+        auto maintain(const Inventory& inventory, bool wait = false) -> std::optional<SnapshotStats>
+        {
+                flush(false);
+
+                std::optional<SnapshotStats> finished;
+                if (compaction)
+                {
+                        finished = wait ? std::optional {compaction->wait()} : compaction->poll();
+                        if (finished) { finish_compaction(finished->ok); }
+                }
+
+                if (!compaction && !wait) { start_compaction(inventory, false); }
+                return finished;
+        }
+
+        /// @brief Starts folding the journal into a new snapshot unless one is already being written. Unless `force` is set, only does so once
+        /// `compact_bytes` have been journalled since the last snapshot.
+        ///
+        /// Must be called from the thread that owns the inventory, so that it cannot change while the child process is forked.
+        ///
+        /// @returns false if compaction was not started.
+        auto start_compaction(const Inventory& inventory, bool force = true) -> bool
+        {
+                std::unique_lock lock {mutex};
+                if (compaction || (!force && bytes_since_snapshot < compact_bytes)) { return false; }
+
+                // records after this point go to a new segment so that every older segment is covered by the snapshot; the old one
+                // must be durable first, or a crash could keep later records and lose earlier ones
+                if (!write_pending(lock, false) || fdatasync(segment.fd) != 0 || !roll()) { return false; }
+                durable_lsn = last_lsn;
+
+                compaction = BackgroundSnapshot::start(inventory, snapshot_path(), last_lsn);
+                if (!compaction) { return false; }
+
+                // the snapshot has the values changed in memory so far, unless it fails
+                compaction_lsn       = last_lsn;
+                bytes_since_snapshot = 0;
+                changed_in_memory.swap(snapshot_changes);
+                changed_in_memory.clear();
+                return true;
+        }
+
+private:
+        /// @brief Returns the segment files in `dir` with the LSN of their first record, in log order.
+        auto segments() const
+        {
+                std::vector<std::pair<std::uint64_t, std::string>> files;
+                std::error_code                                    ec;
+                for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+                {
+                        std::uint64_t first_lsn {};
+                        const auto    name = entry.path().filename().string();
+                        if (std::sscanf(name.c_str(), "journal.%" SCNx64 ".log", &first_lsn) == 1) { files.emplace_back(first_lsn, entry.path().string()); }
+                }
+                std::sort(files.begin(), files.end());
+                return files;
+        }
+
+        /// @brief Rebuilds the inventory from the snapshot and the journal records that follow it.
+        auto recover(Inventory& inventory) -> RecoveryStats
+        {
+                const auto    start = std::chrono::steady_clock::now();
+                RecoveryStats stats;
+
+                if (auto loaded = load_snapshot(snapshot_path(), &snapshot_lsn)) { inventory = std::move(*loaded); }
+                stats.snapshot_lsn = last_lsn = snapshot_lsn;
+
+                for (const auto& [first_lsn, path] : segments())
+                {
+                        if (stats.missing != 0) { break; }
+
+                        std::string contents;
+                        std::size_t valid_bytes {0};        // up to the end of the last block that is whole
+                        if (!read_file(path, contents)) { continue; }
+
+                        ++stats.segments;
+                        stats.bytes_read += contents.size();
+                        bytes_since_snapshot += contents.size();
+
+                        const auto*        data = contents.data();
+                        const auto*        end  = data + contents.size();
+                        JournalBlockHeader hdr {};
+                        std::string        raw;
+                        JournalRecord      record;
+                        while (stats.missing == 0 && data < end && decode_block(data, end, hdr, raw))
+                        {
+                                valid_bytes = static_cast<std::size_t>(data - contents.data());
+                                const auto* rec_data = raw.data();
+                                const auto* rec_end  = rec_data + raw.size();
+                                Handle      prev_handle {0};
+                                for (std::uint32_t i = 0; i < hdr.count && decode_record(rec_data, rec_end, prev_handle, record); ++i)
+                                {
+                                        const auto lsn = hdr.first_lsn + i;
+                                        if (lsn <= last_lsn) { continue; }        // already in the snapshot
+
+                                        // changes are encoded against the ones before them, so none can be replayed past a lost one
+                                        if (lsn != last_lsn + 1)
+                                        {
+                                                stats.missing = lsn - last_lsn - 1;
+                                                break;
+                                        }
+
+                                        if (apply_record(inventory, record)) { ++stats.replayed; }
+                                        else { ++stats.failed; }
+                                        last_lsn = lsn;
+                                }
+                        }
+
+                        // cut off a block torn by a crash, or records appended to the segment after it would be lost with it next time
+                        if (stats.missing == 0 && valid_bytes < contents.size())
+                        {
+                                stats.truncated += contents.size() - valid_bytes;
+                                stats.writable = truncate_segment(path, valid_bytes) && stats.writable;
+                        }
+                }
+
+                const auto elapsed = std::chrono::steady_clock::now() - start;
+                stats.duration_us  = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+                return stats;
+        }
+
+        /// @brief Closes the current segment and starts a new one, named after the first record that has not been written yet.
+        auto roll() -> bool
+        {
+                const auto first_lsn = !unwritten.empty() ? unwritten_first_lsn : pending_count > 0 ? pending_first_lsn : last_lsn + 1;
+
+                char name[32];
+                std::snprintf(name, sizeof(name), "journal.%016" PRIx64 ".log", first_lsn);
+
+                const auto path = dir + "/" + name;
+                const int  fd   = ::open(path.c_str(), O_CREAT | O_WRONLY | O_APPEND, 0644);
+                if (fd < 0) { return false; }
+
+                segment.reset(fd);
+                segment_bytes = 0;
+                return true;
+        }
+
+        /// @brief Writes the appended records to the segment, then syncs them if asked to. Waits for a write by another thread to finish first.
+        ///
+        /// The lock is released during I/O so that other threads can keep appending; whatever they append meanwhile is left for the next
+        /// call, which is how a single sync ends up covering a whole group of commits.
+        ///
+        /// Records that fail to be written or synced are kept, and the segment is cut back to the end of the last block written whole, or
+        /// left for a new one if it cannot be, so that the next call writes them again after that block rather than after torn bytes.
+        auto write_pending(std::unique_lock<std::mutex>& lock, bool sync) -> bool
+        {
+                cv.wait(lock, [&] { return !flushing; });
+                if (pending_count == 0 && unwritten.empty() && (!sync || durable_lsn == last_lsn)) { return true; }
+
+                auto data = std::move(unwritten);
+                unwritten.clear();
+                if (pending_count > 0)
+                {
+                        if (data.empty()) { unwritten_first_lsn = pending_first_lsn; }
+                        const auto raw = data.size();
+                        encode_block(data, pending, pending_first_lsn, pending_count);
+                        raw_bytes += pending.size();
+                        stored_bytes += data.size() - raw;
+                        pending.clear();
+                        pending_count       = 0;
+                        pending_prev_handle = 0;
+                }
+
+                const auto lsn = last_lsn;
+                const auto fd  = segment.fd;
+                flushing       = true;
+
+                lock.unlock();
+                auto ok = write_all(fd, data) && (!sync || fdatasync(fd) == 0);
+                lock.lock();
+
+                if (ok)
+                {
+                        if (sync) { durable_lsn = lsn; }
+                        segment_bytes += data.size();
+                        bytes_since_snapshot += data.size();
+                }
+                else
+                {
+                        unwritten = std::move(data);
+                        if (ftruncate(fd, static_cast<off_t>(segment_bytes)) != 0) { roll(); }
+                }
+
+                if (ok && segment_bytes >= JOURNAL_SEGMENT_BYTES)
+                {
+                        // the old segment must be durable before records start going to the new one
+                        ok = fdatasync(fd) == 0 && roll();
+                        if (ok) { durable_lsn = lsn; }
+                }
+
+                flushing = false;
+                cv.notify_all();
+                return ok;
+        }
+
+        /// @brief Deletes the segments made redundant by a finished compaction snapshot.
+        auto finish_compaction(bool ok) -> void
+        {
+                std::lock_guard lock {mutex};
+                compaction.reset();
+                if (!ok)
+                {
+                        // try again on the next call to maintain
+                        bytes_since_snapshot = compact_bytes;
+                        for (const auto& [handle, op] : snapshot_changes)
+                        {
+                                if (op == Mutation::Op::Add) { changed_in_memory[handle] = op; }
+                                else { changed_in_memory.emplace(handle, op); }
+                        }
+                        snapshot_changes.clear();
+                        return;
+                }
+                snapshot_changes.clear();
+
+                // make sure the snapshot's directory entry is durable before dropping the records it replaces
+                UniqueFd dirfd {::open(dir.c_str(), O_RDONLY | O_DIRECTORY)};
+                if (dirfd) { fsync(dirfd.fd); }
+
+                snapshot_lsn = compaction_lsn;
+                for (const auto& [first_lsn, path] : segments())
+                {
+                        if (first_lsn <= snapshot_lsn) { std::filesystem::remove(path); }
+                }
+        }
+
+        /// @brief Stops tracking an item changed in memory only, as it has been journalled in full or removed. `mutex` must be held.
+        ///
+        /// @returns std::nullopt if the item has not been changed in memory only since it was last journalled, `Add` if it has never
+        /// been journalled, or else `Update`.
+        auto forget_memory_changes(Handle handle) -> std::optional<Mutation::Op>
+        {
+                std::optional<Mutation::Op> op;
+                for (auto* changes : {&snapshot_changes, &changed_in_memory})
+                {
+                        const auto pos = changes->find(handle);
+                        if (pos == changes->end()) { continue; }
+
+                        op = op == Mutation::Op::Add ? op : pos->second;
+                        changes->erase(pos);
+                }
+                return op;
+        }
+
+        static auto truncate_segment(const std::string& path, std::size_t size) -> bool
+        {
+                UniqueFd fd {::open(path.c_str(), O_WRONLY)};
+                return fd && ftruncate(fd.fd, static_cast<off_t>(size)) == 0 && fdatasync(fd.fd) == 0;
+        }
+
+        static auto write_all(int fd, const std::string& data) -> bool
+        {
+                std::size_t done {0};
+                while (done < data.size())
+                {
+                        const auto n = ::write(fd, data.data() + done, data.size() - done);
+                        if (n < 0 && errno == EINTR) { continue; }
+                        if (n < 0) { return false; }
+
+                        done += static_cast<std::size_t>(n);
+                }
+                return true;
+        }
+
+        static auto read_file(const std::string& path, std::string& contents) -> bool
+        {
+                std::FILE* file = std::fopen(path.c_str(), "rb");
+                if (file == nullptr) { return false; }
+
+                char        buf[1U << 16U];
+                std::size_t n {};
+                while ((n = std::fread(buf, 1, sizeof(buf), file)) > 0) { contents.append(buf, n); }
+                std::fclose(file);
+                return true;
+        }
+
+        /// By item, the first change made to it with `Durability::Memory` since it was last journalled, `Add` if it never has been.
+        using MemoryChanges = std::unordered_map<Handle, Mutation::Op>;
+
+        std::mutex              mutex;
+        std::condition_variable cv;
+        bool                    flushing {false};        // a thread is writing a block with the lock released
+        std::string             pending;                 // encoded records appended but not yet written to the segment
+        std::uint64_t           pending_first_lsn {0};
+        std::uint32_t           pending_count {0};
+        Handle                  pending_prev_handle {0};
+        std::string             unwritten;               // blocks whose write failed, written again before any other
+        std::uint64_t           unwritten_first_lsn {0};
+        MemoryChanges           changed_in_memory;       // items whose next record must carry all of them
+        MemoryChanges           snapshot_changes;        // the same, as of the compaction snapshot being written
+};
@@ -1,119 +1,31 @@
+#include "bench.h"
+#include "client.h"
+#include "cores.h"
+#include "handoff.h"
+#include "inventory.h"
+#include "journal.h"
+#include "numa.h"
+#include "price_schedule.h"
+#include "router.h"
+#include "server.h"
+#include "shm_inventory.h"
+#include "snapshot.h"
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <ios>
 #include <iostream>
 #include <optional>
-#include <vector>
-
-constexpr auto MAX_ITEMS      = 30;
-constexpr auto MAX_MODEL_NAME = 64;        // longest model name
-
-/// List of product categories stocked in store.
-enum class Product
-{
-        Invalid = -1,
-        Dresses,
-        CropTops,
-        SweatshirtsHoodies,
-        Blouses,
-        Skirts,
-        Shorts,
-        Jeans,
-        MatchingSets,
-        Swimwear,
-        Accessories,
-        Count
-};
-
-/// @brief Holds the names of the product categories.
-constexpr std::string_view PRODUCT_NAMES[static_cast<int>(Product::Count)] =
- {
-    [static_cast<int>(Product::Dresses)]                  = "Dresses",
-    [static_cast<int>(Product::CropTops)]                 = "Crop Tops",
-    [static_cast<int>(Product::SweatshirtsHoodies)]       = "Sweatshirts & Hoodies",
-    [static_cast<int>(Product::Blouses)]                  = "Blouses",
-    [static_cast<int>(Product::Skirts)]                   = "Skirts",
-    [static_cast<int>(Product::Shorts)]                   = "Shorts",
-    [static_cast<int>(Product::Jeans)]                    = "Jeans",
-    [static_cast<int>(Product::MatchingSets)]             = "MatchingSets",
-    [static_cast<int>(Product::Swimwear)]                 = "Swimwear",
-    [static_cast<int>(Product::Accessories)]              = "Accessories",
-};
-
-/// @brief Checks if the given product is valid.
-constexpr auto is_valid_product(Product prod) { return prod > Product::Invalid && prod < Product::Count; }
-
-/// @brief Return the name of the given product.
-constexpr auto get_product_name(Product prod)
-{
-        if (!is_valid_product(prod)) { return std::string_view {""}; }
-
-        return PRODUCT_NAMES[static_cast<int>(prod)];
-}
-
-/// @brief Prints a list of all the product categories available.
-auto list_products()
-{
-        std::cout << "Product list: \n";
-        std::for_each_n(std::begin(PRODUCT_NAMES), std::size(PRODUCT_NAMES), [i = 0](const auto& name) mutable {
-                std::printf("(%d) %s\n", i, name.data());
-                i++;
-        });
-        std::printf("---------------\n");
-}
-
-/// Represents a stocked item corresponding to one of the listed product categories.
-struct Item
-{
-        Product     id;            // Product category that item falls into
-        std::string name;          // Name of the item
-        float       price;         // Price in GBP
-        int         nstock;        // No. of units in stock
-
-        Item() = default;
-
-        Item(const Product prod, const std::string& name, const float price, const int nstock) :
-                id {prod}, name {name}, price {price}, nstock {nstock}
-        {}
-};
-
-/// Holds the inventory of all the stocked items in the store.
-struct Inventory
-{
-        using SearchPredicate = std::function<bool(const Item&)>;
-        using Items           = std::vector<Item>;
-        using ItemPtr         = Items::iterator;        // pointer to item type
-
-        Items items;
-
-        Inventory() { items.reserve(MAX_ITEMS); }
+#include <thread>
 
-        /// @brief Adds the given item to the inventory.
-        auto add(const Item& item) { items.emplace_back(item); }
-
-        /// @brief Deletes the given item from the inventory.
-        auto remove(ItemPtr pitem) { items.erase(pitem); }
-
-        /// @brief Look for the item for which the given predicate returns true.
-        ///
-        /// @returns nullptr if item is not found else pointer to item.
-        auto search(const SearchPredicate& pred) -> ItemPtr
-        {
-                auto pitem = std::find_if(items.begin(), items.end(), pred);
-                if (pitem != items.end()) { return pitem; }
-
-                return {};
-        }
-
-        /// @brief Prints a table listing currently stocked items in the inventory.
-        auto list()
-        {
-                std::printf("%32s%64s%16s%8s\n", "Product", "Model Code", "Price (GBP)", "Qty.");
-                std::for_each(items.begin(), items.end(), [](const auto& item) {
-                        std::printf("%32s%64s%16.2f%8d\n", get_product_name(item.id).data(), item.name.c_str(), item.price, item.nstock);
-                });
-                std::printf("---------------\n");
-        }
-};
+volatile std::sig_atomic_t terminated {0};        // set by SIGINT or SIGTERM, so that a server stops and cleans up on its way out
 
 struct InventoryUI
 {
@@ -126,10 +38,37 @@ struct InventoryUI
                 SearchItem   = 's',
                 ListProducts = 'p',
                 ListItems    = 'l',
+                Snapshot     = 'w',
                 Quit         = 'q',
         };
 
-        Inventory inventory;
+        Inventory                         inventory;
+        std::optional<ShmInventoryWriter> shm;        // set when other processes read the inventory from shared memory
+        std::string                       snapshot_path {"inventory.snapshot"};
+        std::optional<BackgroundSnapshot> snapshot_job;        // snapshot currently being written by a child process
+        std::unique_ptr<Journal>          journal;             // set when every change is logged to disk
+        Durability                        durability {Durability::Buffered};
+
+        /// @brief Sends every change of the inventory to the journal and to the shared memory copy, whichever there are.
+        auto watch_inventory() -> void
+        {
+                if (!journal && !shm) { return; }
+
+                inventory.on_mutation = [this](const Mutation& mutation) {
+                        const auto recorded = !journal || journal->append(mutation);
+                        if (shm && !shm->mirror(inventory, mutation))
+                        {
+                                std::printf("Could not grow the shared inventory, readers will see no items until some are removed.\n");
+                        }
+                        return recorded;
+                };
+        }
+
+        /// @brief Tells the user when a change was made but could not be journalled as durably as `durability` asks.
+        auto report(bool recorded) -> void
+        {
+                if (!recorded) { std::printf("The change could not be journalled and may be lost on a crash.\n"); }
+        }
 
         auto      user_input_handler() {}
 
@@ -139,9 +78,50 @@ struct InventoryUI
                 std::printf("(%c) Search Item\n", static_cast<char>(Option::SearchItem));
                 std::printf("(%c) List Product Categories\n", static_cast<char>(Option::ListProducts));
                 std::printf("(%c) List Items in Stock\n", static_cast<char>(Option::ListItems));
+                std::printf("(%c) Write Snapshot\n", static_cast<char>(Option::Snapshot));
                 std::printf("(%c) Quit\n", static_cast<char>(Option::Quit));
         }
 
+        /// @brief Starts writing a snapshot in the background unless one is already being written.
+        auto handle_snapshot_option()
+        {
+                if (snapshot_job)
+                {
+                        std::printf("A snapshot is already being written.\n");
+                        return;
+                }
+
+                snapshot_job = BackgroundSnapshot::start(inventory, snapshot_path);
+                if (snapshot_job) { std::printf("Writing snapshot to %s (fork took %" PRIu64 " us)\n", snapshot_path.c_str(), snapshot_job->fork_us); }
+                else { std::printf("Could not start snapshot.\n"); }
+        }
+
+        /// @brief Reports on the background snapshot once it has finished. Blocks until then if `wait` is set.
+        ///
+        /// Also lets the journal compact itself into a new snapshot when it has grown large enough.
+        auto check_snapshot(bool wait)
+        {
+                if (journal)
+                {
+                        const auto stats = journal->maintain(inventory, wait);
+                        if (stats && stats->ok) { std::printf("Journal compacted into snapshot at LSN %" PRIu64 "\n", journal->snapshot_lsn); }
+                        else if (stats) { std::printf("Journal compaction failed, will retry.\n"); }
+                }
+
+                if (!snapshot_job) { return; }
+
+                const auto stats = wait ? std::optional {snapshot_job->wait()} : snapshot_job->poll();
+                if (!stats) { return; }
+
+                snapshot_job.reset();
+                if (stats->ok)
+                {
+                        std::printf("Snapshot written: %" PRIu64 " bytes in %" PRIu64 " us, copy-on-write overhead %" PRIu64 " KiB\n", stats->bytes,
+                                    stats->duration_us, stats->cow_bytes / 1024);
+                }
+                else { std::printf("Snapshot failed.\n"); }
+        }
+
         auto get_user_action()
         {
                 char opt {};
@@ -150,34 +130,12 @@ struct InventoryUI
                 return opt;
         }
 
-        /// @brief Adds item to the inventory.
+        /// @brief Asks the user for the fields of an item.
         auto handle_add_option()
         {
                 Item item;
-                do {
-                        list_products();
-
-                        std::printf("Select product category to add: ");
-                        int pid {};
-                        std::scanf("%d", &item.id);
-
-                        if (!is_valid_product(item.id)) { std::printf("Invalid option selected. Please try again.\n"); }
-                        else
-                        {
-                                // NOTE(CA, 28.03.2022) - Important to note that we need to consume the whitespaces from user input when using getline
-                                std::printf("Enter model code: ");
-                                std::getline(std::cin >> std::ws, item.name);
-
-                                std::printf("Enter price: ");
-                                std::cin >> item.price;
-
-                                std::printf("Enter quantity: ");
-                                std::cin >> item.nstock;
-
-                                return item;
-                        }
-
-                } while (true);
+                read_record(ITEM_SCHEMA, item);
+                return item;
         }
 
         /// @brief Search item by name or product category to perform remove or edit operations on the found item.
@@ -195,7 +153,7 @@ struct InventoryUI
                         std::string name {};
                         std::printf("Enter model name: ");
                         std::getline(std::cin >> std::ws, name);
-                        pitem = inventory.search([&](const Item& item) { return item.name == name; });
+                        pitem = inventory.find_by<ModelCodeKey>(name);
                 }
                 else if (opt == 'p')
                 {
@@ -214,7 +172,7 @@ struct InventoryUI
                 }
 
                 // if item was found
-                if (pitem != Inventory::ItemPtr {})
+                if (pitem != inventory.items.end())
                 {
                         // we ask the user what they'd like to do with this found item
                         do {
@@ -225,16 +183,13 @@ struct InventoryUI
 
                                 if (opt == static_cast<char>(Option::RemoveItem))
                                 {
-                                        inventory.remove(pitem);
+                                        report(inventory.remove(pitem, durability));
                                         break;
                                 }
                                 else if (opt == static_cast<char>(Option::EditItem))
                                 {
-                                        // NOTE(CA, 28.03.2022) - This is cumbersome to use and also inefficient. You should swap in-place or
-                                        // just edit a property of interest but that'd be more complicated.
                                         const auto new_item = handle_add_option();
-                                        inventory.remove(pitem);
-                                        inventory.add(new_item);
+                                        report(inventory.update(pitem, new_item, durability));
                                         break;
                                 }
                                 else if (opt == static_cast<char>(Option::Quit)) { break; }
@@ -249,26 +204,593 @@ struct InventoryUI
                 std::printf("Shop Inventory v0.1\n");
 
                 do {
+                        check_snapshot(false);
                         list_options();
                         const auto opt = get_user_action();
                         if (opt == static_cast<char>(Option::AddItem))
                         {
                                 const auto item = handle_add_option();
-                                inventory.add(item);
+                                report(inventory.add(item, durability));
                                 std::printf("Added item\n\n");
                         }
                         else if (opt == static_cast<char>(Option::SearchItem)) { handle_search_option(); }
                         else if (opt == static_cast<char>(Option::ListProducts)) { list_products(); }
                         else if (opt == static_cast<char>(Option::ListItems)) { inventory.list(); }
+                        else if (opt == static_cast<char>(Option::Snapshot)) { handle_snapshot_option(); }
                         else if (opt == static_cast<char>(Option::Quit)) { break; }
                         else { std::printf("Invalid option selected. Please try again.\n"); }
                 } while (true);
+
+                check_snapshot(true);
         }
 };
 
-auto main() -> int
+/// @brief Serves `inventory` on `port` with one thread per core, each owning its share of the items and listening on the port itself.
+auto serve_cores(std::uint16_t port, std::size_t ncores, const Inventory& inventory, std::chrono::microseconds bulk_slice) -> int
+{
+        CoreGroup                group {ncores};
+        std::vector<FrameServer> servers(ncores);
+        for (std::size_t core = 0; core < ncores; ++core)
+        {
+                auto& server = servers[core];
+                if (!server.listen(port, true))
+                {
+                        std::printf("Could not listen on port %u.\n", port);
+                        return 1;
+                }
+                server.handler    = [&group, core](const FrameView& request, std::string& out) { return group.handle(core, request, out); };
+                server.background = [&group, core] {
+                        group.cores[core]->service.expire_reservations();
+                        group.cores[core]->service.apply_price_changes();
+                        return group.serve_forwarded(core, true);
+                };
+                server.wake_fd    = group.cores[core]->wake.fd;
+                server.bulk_slice = bulk_slice;
+        }
+
+        // each core is pinned to a CPU, spread over the NUMA nodes, and loads its own items so that they are allocated on its node; none
+        // starts serving until all are loaded, as requests forwarded to a core that is still loading would wait for it
+        const auto               topology = NumaTopology::discover();
+        const auto               slots    = topology.spread(ncores);
+        std::atomic<std::size_t> loaded {0};
+        const auto               run_core = [&](std::size_t core) {
+                place_thread(slots[core]);
+                group.load(core, inventory);
+                ++loaded;
+                while (loaded < ncores) { std::this_thread::yield(); }
+                servers[core].run();
+        };
+
+        std::printf("Serving inventory on port %u with %zu cores on ", port, ncores);
+        topology.print();
+        std::vector<std::thread> threads;
+        for (std::size_t core = 1; core < ncores; ++core) { threads.emplace_back(run_core, core); }
+        run_core(0);
+        for (auto& thread : threads) { thread.join(); }
+        return 0;
+}
+
+/// @brief Parses a wall clock time given as local `YYYY-MM-DDTHH:MM[:SS]`, or as `+<seconds>` from now.
+///
+/// @returns std::nullopt if `text` is neither, or the time in milliseconds since the epoch.
+auto parse_time(const std::string& text) -> std::optional<std::int64_t>
+{
+        if (!text.empty() && text[0] == '+')
+        {
+                char*      end {nullptr};
+                const auto seconds = std::strtod(text.c_str() + 1, &end);
+                if (end == text.c_str() + 1 || *end != '\0') { return {}; }
+
+                return PriceSchedule::ms_of(PriceSchedule::Clock::now()) + static_cast<std::int64_t>(seconds * 1000);
+        }
+
+        std::tm     tm {};
+        const auto* end = strptime(text.c_str(), "%Y-%m-%dT%H:%M", &tm);
+        if (end != nullptr && *end == ':') { end = strptime(end + 1, "%S", &tm); }
+        if (end == nullptr || *end != '\0') { return {}; }
+
+        tm.tm_isdst = -1;
+        return static_cast<std::int64_t>(std::mktime(&tm)) * 1000;
+}
+
+/// @brief Sends one request built from the command line to a server or router and prints the response.
+auto run_call(const std::vector<std::string_view>& args) -> int
+{
+        const auto address = Address::parse(args[1]);
+        auto       conn    = address ? Connection::open(*address) : std::nullopt;
+        if (!conn)
+        {
+                std::printf("Could not connect to '%s'.\n", std::string {args[1]}.c_str());
+                return 1;
+        }
+
+        const auto  command = args[2];
+        const auto  arg     = [&](std::size_t i) { return std::string {args[i]}; };
+        if (command == "scan" && args.size() <= 5)
+        {
+                const auto client = Client::connect(*address);
+                Query      filter {};
+                filter.category = args.size() >= 4 ? std::atoi(arg(3).c_str()) : -1;
+                const auto page = args.size() == 5 ? static_cast<std::uint32_t>(std::atoi(arg(4).c_str())) : SCAN_PAGE_ITEMS;
+
+                std::size_t count {0};
+                print_record_header(ITEM_SCHEMA);
+                const auto ok = client && client->scan(filter, page, [&](const ItemView& item) {
+                        print_record(ITEM_SCHEMA, item);
+                        ++count;
+                });
+                std::printf("---------------\n%zu items%s\n", count, ok ? "" : ", scan failed");
+                return ok ? 0 : 1;
+        }
+        if (command == "stats" && args.size() == 3)
+        {
+                ServerStats stats {};
+                const auto  response = conn->call(MessageType::Stats, {});
+                if (!response || response->payload.size() != sizeof(stats))
+                {
+                        std::printf("No stats from '%s'.\n", arg(1).c_str());
+                        return 1;
+                }
+
+                std::memcpy(&stats, response->payload.data(), sizeof(stats));
+                print_server_stats(stats);
+                return 0;
+        }
+        if (command == "aggregate" && args.size() >= 4 && args.size() <= 7)
+        {
+                Query query {};
+                query.category    = std::atoi(arg(3).c_str());
+                query.min_price   = args.size() >= 5 ? std::strtof(arg(4).c_str(), nullptr) : -FLT_MAX;
+                query.max_price   = args.size() >= 6 ? std::strtof(arg(5).c_str(), nullptr) : FLT_MAX;
+                query.below_stock = args.size() == 7 ? std::atoi(arg(6).c_str()) : 0;
+                std::string request;
+                put(request, query);
+                AggregateResult result {};
+                const auto      response = conn->call(MessageType::Aggregate, request);
+                if (!response || response->header.status != Status::Ok || response->payload.size() != sizeof(result))
+                {
+                        std::printf("No aggregate from '%s'.\n", arg(1).c_str());
+                        return 1;
+                }
+
+                std::memcpy(&result, response->payload.data(), sizeof(result));
+                print_aggregate(result);
+                return 0;
+        }
+        if (command == "sync" && args.size() == 4)
+        {
+                const auto     client = Client::connect(*address);
+                InventoryCache cache;
+                cache.version      = std::strtoull(arg(3).c_str(), nullptr, 10);
+                const auto changes = client ? cache.sync(*client) : std::nullopt;
+                if (!changes)
+                {
+                        std::printf("Sync with '%s' failed.\n", arg(1).c_str());
+                        return 1;
+                }
+
+                std::printf("%zu changes, now at version %" PRIu64 "\n", *changes, cache.version);
+                Inventory inventory;
+                for (const auto& [name, item] : cache.items) { inventory.add(item); }
+                inventory.list();
+                return 0;
+        }
+
+        if (command == "reserve" && args.size() == 6)
+        {
+                const auto client = Client::connect(*address);
+                const auto id     = client ? client->reserve(arg(3), static_cast<std::uint32_t>(std::atoi(arg(4).c_str())),
+                                                             static_cast<std::uint32_t>(std::atoi(arg(5).c_str())))
+                                           : std::nullopt;
+                if (!id)
+                {
+                        std::printf("Could not reserve '%s'.\n", arg(3).c_str());
+                        return 1;
+                }
+
+                std::printf("Reservation %" PRIu64 "\n", *id);
+                return 0;
+        }
+        if (command == "schedule-price" && args.size() == 6)
+        {
+                const auto effective = parse_time(arg(5));
+                if (!effective)
+                {
+                        std::printf("Could not read the time '%s'.\n", arg(5).c_str());
+                        return 1;
+                }
+
+                const auto client    = Client::connect(*address);
+                const auto price     = std::strtof(arg(4).c_str(), nullptr);
+                const auto scheduled = client ? client->schedule_prices({{arg(3), price}}, *effective) : std::nullopt;
+                if (!scheduled || *scheduled == 0)
+                {
+                        std::printf("Could not schedule a price for '%s'.\n", arg(3).c_str());
+                        return 1;
+                }
+
+                std::printf("OK\n");
+                return 0;
+        }
+        if ((command == "commit" || command == "release") && args.size() == 5)
+        {
+                const auto client = Client::connect(*address);
+                const auto id     = std::strtoull(arg(3).c_str(), nullptr, 10);
+                const auto ok     = client && (command == "commit" ? client->commit(id, arg(4)) : client->release(id, arg(4)));
+                std::printf("%s\n", ok ? "OK" : "No such reservation.");
+                return ok ? 0 : 1;
+        }
+
+        MessageType type {};
+        std::string payload;
+        if (command == "get" && args.size() == 4)
+        {
+                type    = MessageType::Get;
+                payload = arg(3);
+        }
+        else if (command == "remove" && args.size() == 4)
+        {
+                type    = MessageType::Remove;
+                payload = arg(3);
+        }
+        else if (command == "put" && args.size() == 7)
+        {
+                type = MessageType::Put;
+                encode_item(payload, {static_cast<Product>(std::atoi(arg(3).c_str())), arg(4), std::strtof(arg(5).c_str(), nullptr), std::atoi(arg(6).c_str())});
+        }
+        else if (command == "list" && args.size() <= 4)
+        {
+                type = MessageType::List;
+                put(payload, static_cast<std::int32_t>(args.size() == 4 ? std::atoi(arg(3).c_str()) : -1));
+        }
+        else if (command == "query" && args.size() >= 6 && args.size() <= 9)
+        {
+                Query query {};
+                query.category    = std::atoi(arg(3).c_str());
+                query.min_price   = std::strtof(arg(4).c_str(), nullptr);
+                query.max_price   = std::strtof(arg(5).c_str(), nullptr);
+                query.limit       = args.size() >= 8 ? static_cast<std::uint32_t>(std::atoi(arg(7).c_str())) : 0;
+                query.below_stock = args.size() == 9 ? std::atoi(arg(8).c_str()) : 0;
+                if (const auto order = args.size() >= 7 ? parse_query_order(args[6]) : QueryOrder::None) { query.order = *order; }
+                else
+                {
+                        std::printf("Unknown order '%s'.\n", arg(6).c_str());
+                        return 1;
+                }
+                type = MessageType::Query;
+                put(payload, query);
+        }
+        else if (command == "add-shard" && args.size() == 4)
+        {
+                type    = MessageType::AddShard;
+                payload = arg(3);
+        }
+        else
+        {
+                std::printf("Usage: --call <address> get <code> | remove <code> | put <product id> <code> <price> <qty> | list [product id] | "
+                            "query <product id|-1> <min price> <max price> [none|price|-price|stock|-stock] [limit] [below stock] | "
+                            "aggregate <product id|-1> [min price] [max price] [below stock] | sync <version> | scan [product id|-1] [page size] | "
+                            "reserve <code> <qty> <ttl ms> | commit <reservation> <code> | release <reservation> <code> | "
+                            "schedule-price <code> <price> <YYYY-MM-DDTHH:MM[:SS]|+seconds> | stats | add-shard <address>\n");
+                return 1;
+        }
+
+        const auto response = conn->call(type, payload);
+        if (!response)
+        {
+                std::printf("No response from '%s'.\n", std::string {args[1]}.c_str());
+                return 1;
+        }
+        if (response->header.status != Status::Ok)
+        {
+                std::printf("Request failed with status %d.\n", static_cast<int>(response->header.status));
+                return 1;
+        }
+
+        if (const auto items = ItemsView::parse(response->payload); items && !items->empty())
+        {
+                Inventory inventory;
+                for (const auto item : *items) { inventory.add(item.to_item()); }
+                inventory.list();
+        }
+        else { std::printf("OK\n"); }
+        return 0;
+}
+
+auto main(int argc, char* argv[]) -> int
 {
-        InventoryUI ui {};
+        const std::vector<std::string_view> args(argv + 1, argv + argc);
+
+        // repo --shm-reader <name> : print the inventory published by another process and exit
+        if (args.size() == 2 && args[0] == "--shm-reader")
+        {
+                auto reader = ShmInventoryReader::open(std::string {args[1]});
+                if (!reader)
+                {
+                        std::printf("Could not open shared inventory '%s'.\n", args[1].data());
+                        return 1;
+                }
+                reader->list();
+                return 0;
+        }
+
+        // repo --bench durability [dir] : measure the latency of each durability level, journalling to `dir`
+        // repo --bench journal [dir]    : measure journal size and replay time for a stock decrement heavy workload
+        // repo --bench client [address] : generate load against a server, or against one started in-process
+        // repo --bench cores [threads]  : compare an inventory shared under a lock with one split between threads that share nothing
+        // repo --bench numa [cores]     : compare shared-nothing cores whose items live on their own NUMA node with ones all on one node
+        // repo --bench query            : compare branching and masked scans, with kernels compiled per query shape or interpreted
+        // repo --bench aggregate        : compare totals estimated from the sample of the items with exact ones, for speed and error
+        // repo --bench startup [dir]    : compare loading a snapshot of 10M items with its saved indexes against rebuilding them
+        // repo --bench handoff [dir]    : restart a server of 1M items under load by handing it off, against loading its snapshot
+        // repo --bench simulation       : compare copying an inventory of 10M items for "what if" simulations with cloning a persistent one
+        // repo --bench reservations     : compare expiring 4M reservations on a timer wheel with keeping them in a sorted map
+        // repo --bench prices           : compare putting 100k items on sale with an edit each against scheduled price changes
+        if (!args.empty() && args[0] == "--bench")
+        {
+                const auto name = args.size() > 1 ? args[1] : std::string_view {};
+                const auto dir  = std::string {args.size() > 2 ? args[2] : "bench.journal"};
+                if (name == "durability") { bench_durability(dir); }
+                else if (name == "journal") { bench_journal(dir); }
+                else if (name == "client") { bench_client(args.size() > 2 ? Address::parse(args[2]) : std::nullopt); }
+                else if (name == "cores") { bench_cores(args.size() > 2 ? static_cast<std::size_t>(std::atoi(dir.c_str())) : 0); }
+                else if (name == "query") { bench_query(); }
+                else if (name == "aggregate") { bench_aggregate(); }
+                else if (name == "startup") { bench_startup(dir); }
+                else if (name == "handoff") { bench_handoff(dir); }
+                else if (name == "simulation") { bench_simulation(); }
+                else if (name == "reservations") { bench_reservations(); }
+                else if (name == "prices") { bench_prices(); }
+                else if (name == "numa") { bench_numa(args.size() > 2 ? static_cast<std::size_t>(std::atoi(dir.c_str())) : 0); }
+                else
+                {
+                        std::printf("Unknown benchmark '%s'.\n", std::string {name}.c_str());
+                        return 1;
+                }
+                return 0;
+        }
+
+        // repo --call <address> <command> [args...] : send one request to a server or router
+        if (args.size() >= 3 && args[0] == "--call") { return run_call(args); }
+
+        InventoryUI                  ui {};
+        std::optional<std::uint16_t> serve_port;
+        std::optional<std::uint16_t> router_port;
+        std::vector<Address>         shard_addresses;
+        std::chrono::microseconds    bulk_slice {BULK_SLICE_US};
+        std::size_t                  ncores {1};
+        std::optional<std::string>   handoff_path;
+        std::optional<std::string>   shm_name;
+
+        // the journal recovers the inventory from a snapshot of its own, which loading another would replace along with the journal's hook
+        const auto has_option = [&](std::string_view name) {
+                for (std::size_t i = 0; i + 1 < args.size(); i += 2)
+                {
+                        if (args[i] == name) { return true; }
+                }
+                return false;
+        };
+        if (has_option("--journal") && has_option("--snapshot"))
+        {
+                std::printf("--snapshot cannot be used with --journal, which keeps its snapshots in the journal directory.\n");
+                return 1;
+        }
+
+        // repo --takeover <path> : serve the inventory, port and connections of the server handing off at the given path (see --handoff)
+        // instead of loading an inventory, so it is taken over before the other options are looked at
+        std::optional<Takeover> takeover;
+        for (std::size_t i = 0; i + 1 < args.size(); i += 2)
+        {
+                if (args[i] != "--takeover") { continue; }
+
+                takeover = Takeover::from(std::string {args[i + 1]});
+                if (!takeover)
+                {
+                        std::printf("Could not take over from '%s'.\n", std::string {args[i + 1]}.c_str());
+                        return 1;
+                }
+                ui.inventory = std::move(takeover->inventory);
+        }
+
+        for (std::size_t i = 0; i + 1 < args.size(); i += 2)
+        {
+                const auto value = std::string {args[i + 1]};
+
+                // repo --shm <name> : publish the inventory to shared memory for readers on this machine
+                if (args[i] == "--shm") { shm_name = value; }
+                // repo --snapshot <path> : load the inventory from (and write snapshots to) the given file
+                else if (args[i] == "--snapshot")
+                {
+                        ui.snapshot_path = value;
+                        if (auto loaded = takeover ? std::nullopt : load_snapshot(value)) { ui.inventory = std::move(*loaded); }
+                }
+                // with --takeover, the journal is carried on from the position the old server left it at instead of being recovered
+                else if (args[i] == "--journal" && takeover)
+                {
+                        const auto& header = takeover->header;
+                        if (header.journalled != 0)
+                        {
+                                ui.journal = Journal::resume(value, header.journal_lsn, header.journal_snapshot_lsn, header.journal_bytes);
+                        }
+                        if (!ui.journal)
+                        {
+                                std::printf("Could not carry on the journal in '%s' from the old server.\n", value.c_str());
+                                return 1;
+                        }
+                }
+                // repo --journal <dir> : recover the inventory from, and log every change to, the given directory
+                else if (args[i] == "--journal")
+                {
+                        RecoveryStats stats;
+                        ui.journal = Journal::open(value, ui.inventory, &stats);
+                        if (!ui.journal && stats.missing != 0)
+                        {
+                                std::printf("Journal in '%s' is missing %" PRIu64 " records; the records after them were not replayed.\n", value.c_str(),
+                                            stats.missing);
+                                return 1;
+                        }
+                        if (!ui.journal)
+                        {
+                                std::printf("Could not open journal in '%s'.\n", value.c_str());
+                                return 1;
+                        }
+                        std::printf("Recovered %zu items from snapshot at LSN %" PRIu64 " and %" PRIu64 " journal records in %" PRIu64 " us\n",
+                                    ui.inventory.items.size(), stats.snapshot_lsn, stats.replayed, stats.duration_us);
+                        if (stats.failed != 0) { std::printf("%" PRIu64 " journal records did not apply and were skipped.\n", stats.failed); }
+                }
+                // repo --durability <memory|buffered|group|sync> : how durable each change made in the UI must be before it returns
+                else if (args[i] == "--durability")
+                {
+                        const auto durability = parse_durability(value);
+                        if (!durability)
+                        {
+                                std::printf("Unknown durability level '%s'.\n", value.c_str());
+                                return 1;
+                        }
+                        ui.durability = *durability;
+                }
+                // repo --serve <port> : serve the inventory over TCP instead of running the UI
+                // repo --router <port> --shards <address,address,...> : route requests to shard servers by model code
+                else if (args[i] == "--serve" || args[i] == "--router")
+                {
+                        const auto address = Address::parse(value);
+                        if (!address)
+                        {
+                                std::printf("Invalid port '%s'.\n", value.c_str());
+                                return 1;
+                        }
+                        (args[i] == "--serve" ? serve_port : router_port) = address->port;
+                }
+                // repo --handoff <path> : with --serve, wait on a Unix socket at the given path for a new process to hand the server to
+                else if (args[i] == "--handoff") { handoff_path = value; }
+                // repo --cores <n> : with --serve, split the items between n threads that share nothing and each serve connections
+                else if (args[i] == "--cores")
+                {
+                        ncores = static_cast<std::size_t>(std::max(std::atoi(value.c_str()), 1));
+                }
+                // repo --bulk-slice <microseconds> : how long a server runs imports and listings before serving tills again
+                else if (args[i] == "--bulk-slice")
+                {
+                        bulk_slice = std::chrono::microseconds {std::max(std::atoi(value.c_str()), 1)};
+                }
+                else if (args[i] == "--shards")
+                {
+                        for (std::size_t start = 0, end = 0; start < value.size(); start = end + 1)
+                        {
+                                end                = std::min(value.find(',', start), value.size());
+                                const auto address = Address::parse(std::string_view {value}.substr(start, end - start));
+                                if (!address)
+                                {
+                                        std::printf("Invalid shard address in '%s'.\n", value.c_str());
+                                        return 1;
+                                }
+                                shard_addresses.push_back(*address);
+                        }
+                }
+        }
+
+        if ((handoff_path || takeover) && (ncores > 1 || router_port))
+        {
+                std::printf("Only a server without --cores can hand off or take over.\n");
+                return 1;
+        }
+        if (takeover && takeover->header.journalled != 0 && !ui.journal)
+        {
+                std::printf("The old server kept a journal, so --journal must be given to carry it on.\n");
+                return 1;
+        }
+        if (takeover) { serve_port = local_port(takeover->listener.fd); }
+        if (shm_name && (router_port || (serve_port && ncores > 1)))
+        {
+                std::printf("Only the UI or a server without --cores can publish to shared memory.\n");
+                return 1;
+        }
+        // created once the inventory is loaded, so that it is sized for it
+        if (shm_name && !(ui.shm = ShmInventoryWriter::create(*shm_name, ShmInventoryWriter::capacity_for(ui.inventory.items.size()))))
+        {
+                std::printf("Could not create shared inventory '%s'.\n", shm_name->c_str());
+                return 1;
+        }
+        if (ui.shm && !ui.shm->publish(ui.inventory))
+        {
+                std::printf("Could not grow the shared inventory, readers will see no items until some are removed.\n");
+        }
+        ui.watch_inventory();
+
+        if (serve_port && ncores > 1)
+        {
+                if (ui.journal)
+                {
+                        std::printf("A journal cannot be kept with --cores, as every core changes its items independently.\n");
+                        return 1;
+                }
+                std::setvbuf(stdout, nullptr, _IOLBF, 0);
+                return serve_cores(*serve_port, ncores, ui.inventory, bulk_slice);
+        }
+        if (serve_port || router_port)
+        {
+                InventoryService service {ui.inventory};
+                RouterService    router;
+                FrameServer      server;
+                server.bulk_slice = bulk_slice;
+                for (const auto& address : shard_addresses) { router.add_shard(address, false); }
+
+                std::optional<HandoffPoint> handoff;
+                if (takeover && !service.load_state(takeover->state))
+                {
+                        std::printf("Could not read the reservations and price changes of the old server, which is still serving.\n");
+                        return 1;
+                }
+                if (takeover)
+                {
+                        server.listener = std::move(takeover->listener);
+                        handoff         = HandoffPoint {std::move(takeover->handoff)};
+                        for (auto& sock : takeover->clients) { server.adopt(std::move(sock)); }
+                        std::printf("Took over %zu items, %zu reservations, %zu price changes and %zu connections\n", ui.inventory.items.size(),
+                                    service.reservations.size(), service.prices.size(), takeover->clients.size());
+                }
+                else if (!server.listen(serve_port ? *serve_port : *router_port))
+                {
+                        std::printf("Could not listen on port %u.\n", serve_port ? *serve_port : *router_port);
+                        return 1;
+                }
+                else if (handoff_path && !(handoff = HandoffPoint::listen(*handoff_path)))
+                {
+                        std::printf("Could not wait for a handoff at '%s'.\n", handoff_path->c_str());
+                        return 1;
+                }
+                if (serve_port)
+                {
+                        server.handler    = [&](const FrameView& request, std::string& out) { return service.handle(request, out); };
+                        std::signal(SIGINT, [](int) { terminated = 1; });
+                        std::signal(SIGTERM, [](int) { terminated = 1; });
+                        server.background = [&] {
+                                if (terminated != 0) { server.stopping = true; }
+                                if (ui.journal) { ui.journal->maintain(ui.inventory); }
+                                service.expire_reservations();
+                                service.apply_price_changes();
+                                if (handoff) { handoff->poll(server, service, ui.journal.get()); }
+                                return false;
+                        };
+                }
+                else
+                {
+                        server.handler    = [&](const FrameView& request, std::string& out) { return router.handle(request, out); };
+                        server.background = [&] { return router.migrate_step(); };
+                }
+
+                std::setvbuf(stdout, nullptr, _IOLBF, 0);        // servers usually log to a file
+                std::printf("%s on port %u\n", serve_port ? "Serving inventory" : "Routing", serve_port ? *serve_port : *router_port);
+
+                // the old server stops once told, and until then it has been waiting for us, so there is no moment both serve
+                if (takeover && !takeover->confirm())
+                {
+                        std::printf("The old server gave up waiting for this one and is still serving.\n");
+                        return 1;
+                }
+                server.run();
+                return 0;
+        }
 
         ui.run();
 }
\ No newline at end of file
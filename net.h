@@ -0,0 +1,169 @@
+#pragma once
+
+#include "unique_fd.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/// A "host:port" pair naming a TCP endpoint.
+struct Address
+{
+        std::string   host;
+        std::uint16_t port {0};
+
+        /// @brief Parses "host:port", or just "port" for localhost.
+        ///
+        /// @returns std::nullopt if the port is missing or not a number.
+        static auto parse(std::string_view text) -> std::optional<Address>
+        {
+                const auto colon = text.rfind(':');
+                const auto host  = colon == std::string_view::npos ? std::string_view {"127.0.0.1"} : text.substr(0, colon);
+                const auto port  = colon == std::string_view::npos ? text : text.substr(colon + 1);
+
+                unsigned long value {0};
+                for (const auto c : port)
+                {
+                        if (c < '0' || c > '9') { return {}; }
+                        value = value * 10 + static_cast<unsigned long>(c - '0');
+                }
+                if (port.empty() || value > UINT16_MAX) { return {}; }
+
+                return Address {std::string {host}, static_cast<std::uint16_t>(value)};
+        }
+
+        auto to_string() const { return host + ":" + std::to_string(port); }
+};
+
+/// @brief Sets `O_NONBLOCK` on the descriptor.
+inline auto set_nonblocking(int fd) { return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == 0; }
+
+/// @brief Creates a socket listening on all interfaces on `port`. With `reuse_port` set, several sockets can listen on the same port and
+/// the kernel spreads incoming connections across them.
+///
+/// @returns an empty descriptor if the port could not be bound.
+inline auto listen_tcp(std::uint16_t port, int backlog = 128, bool reuse_port = false)
+{
+        UniqueFd sock {socket(AF_INET, SOCK_STREAM, 0)};
+        if (!sock) { return sock; }
+
+        const int one {1};
+        setsockopt(sock.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (reuse_port) { setsockopt(sock.fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)); }
+
+        sockaddr_in addr {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port        = htons(port);
+        if (bind(sock.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(sock.fd, backlog) != 0) { sock.reset(); }
+        return sock;
+}
+
+/// @brief Returns the port a socket is bound to, which is how to find out which port `listen_tcp(0)` picked.
+inline auto local_port(int fd)
+{
+        sockaddr_in addr {};
+        socklen_t   len {sizeof(addr)};
+        if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) { return std::uint16_t {0}; }
+
+        return ntohs(addr.sin_port);
+}
+
+/// @brief Connects a blocking socket, waiting at most `timeout_ms` for the peer to accept. The socket is blocking again afterwards.
+inline auto connect_within(int fd, const sockaddr* addr, socklen_t len, int timeout_ms)
+{
+        const auto flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) { return false; }
+
+        auto ok = connect(fd, addr, len) == 0;
+        if (!ok && errno == EINPROGRESS)
+        {
+                pollfd     pfd {fd, POLLOUT, 0};
+                const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds {timeout_ms};
+                auto       n        = 0;
+                do {
+                        const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                        n               = poll(&pfd, 1, static_cast<int>(std::max<std::int64_t>(wait.count(), 0)));
+                } while (n < 0 && errno == EINTR);
+
+                int       error {0};
+                socklen_t error_len {sizeof(error)};
+                ok = n > 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0;
+        }
+        return fcntl(fd, F_SETFL, flags) == 0 && ok;
+}
+
+/// @brief Opens a blocking TCP connection to `address` with Nagle's algorithm disabled, since requests are small and latency bound.
+///
+/// With a `timeout_ms`, gives up on a connection not made within that time, and makes every send and receive on the socket fail with
+/// `EAGAIN` once it has waited that long, so that a peer that stops answering cannot hold the caller up for good.
+///
+/// @returns an empty descriptor if the connection failed or timed out.
+inline auto connect_tcp(const Address& address, int timeout_ms = 0)
+{
+        UniqueFd  sock;
+        addrinfo  hints {};
+        addrinfo* result {nullptr};
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(address.host.c_str(), std::to_string(address.port).c_str(), &hints, &result) != 0) { return sock; }
+
+        sock.reset(socket(AF_INET, SOCK_STREAM, 0));
+        if (sock && timeout_ms > 0 && !connect_within(sock.fd, result->ai_addr, result->ai_addrlen, timeout_ms)) { sock.reset(); }
+        if (sock && timeout_ms <= 0 && connect(sock.fd, result->ai_addr, result->ai_addrlen) != 0) { sock.reset(); }
+        freeaddrinfo(result);
+
+        const int one {1};
+        if (sock) { setsockopt(sock.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); }
+        if (sock && timeout_ms > 0)
+        {
+                const timeval timeout {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+                setsockopt(sock.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(sock.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+        return sock;
+}
+
+/// @brief Writes all of `data` to a blocking socket.
+inline auto send_all(int fd, const char* data, std::size_t size)
+{
+        while (size > 0)
+        {
+                const auto n = send(fd, data, size, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) { continue; }
+                if (n <= 0) { return false; }
+
+                data += n;
+                size -= static_cast<std::size_t>(n);
+        }
+        return true;
+}
+
+/// @brief Reads exactly `size` bytes from a blocking socket.
+inline auto recv_all(int fd, char* data, std::size_t size)
+{
+        while (size > 0)
+        {
+                const auto n = recv(fd, data, size, 0);
+                if (n < 0 && errno == EINTR) { continue; }
+                if (n <= 0) { return false; }
+
+                data += n;
+                size -= static_cast<std::size_t>(n);
+        }
+        return true;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <sched.h>
+#include <string>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// memory policy constants from <numaif.h>, which needs libnuma's headers
+constexpr auto NUMA_MPOL_PREFERRED = 1;
+constexpr auto NUMA_MPOL_F_NODE    = 1U;
+constexpr auto NUMA_MPOL_F_ADDR    = 2U;
+
+/// A CPU a thread is placed on and the NUMA node it belongs to.
+struct CpuSlot
+{
+        unsigned cpu {0};
+        unsigned node {0};
+};
+
+/// The NUMA nodes of the machine and the CPUs of each that this process may run on, read from sysfs.
+///
+/// Machines without `/sys/devices/system/node`, and processes whose CPUs all belong to one node, look like a single node holding every
+/// allowed CPU, so placement degrades to plain pinning.
+struct NumaTopology
+{
+        std::vector<std::vector<unsigned>> node_cpus;        // allowed CPUs by node id; empty for nodes without any
+
+        /// @brief Reads the topology from sysfs.
+        static auto discover()
+        {
+                cpu_set_t allowed;
+                CPU_ZERO(&allowed);
+                if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+                {
+                        for (unsigned cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1U); ++cpu) { CPU_SET(cpu, &allowed); }
+                }
+
+                NumaTopology    topology;
+                std::error_code ec;
+                for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+                {
+                        const auto name = entry.path().filename().string();
+                        if (name.rfind("node", 0) != 0 || name.size() == 4 || !std::isdigit(static_cast<unsigned char>(name[4]))) { continue; }
+
+                        const auto node = static_cast<std::size_t>(std::stoul(name.substr(4)));
+                        if (topology.node_cpus.size() <= node) { topology.node_cpus.resize(node + 1); }
+                        for (const auto cpu : parse_cpu_list(read_line((entry.path() / "cpulist").string())))
+                        {
+                                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) { topology.node_cpus[node].push_back(cpu); }
+                        }
+                }
+
+                if (topology.nodes() == 0)
+                {
+                        topology.node_cpus.assign(1, {});
+                        for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                        {
+                                if (CPU_ISSET(cpu, &allowed)) { topology.node_cpus[0].push_back(cpu); }
+                        }
+                }
+                return topology;
+        }
+
+        /// @brief Returns the no. of nodes with CPUs this process may use.
+        auto nodes() const -> std::size_t
+        {
+                return static_cast<std::size_t>(std::count_if(node_cpus.begin(), node_cpus.end(), [](const auto& cpus) { return !cpus.empty(); }));
+        }
+
+        /// @brief Returns the no. of CPUs this process may use.
+        auto cpus() const
+        {
+                std::size_t n {0};
+                for (const auto& node : node_cpus) { n += node.size(); }
+                return n;
+        }
+
+        /// @brief Picks a CPU for each of `n` threads, taking the nodes in turn so that the threads, and the memory they allocate, spread
+        /// over all of them. With more threads than CPUs, CPUs are shared.
+        auto spread(std::size_t n) const
+        {
+                std::vector<CpuSlot> slots;
+                for (std::size_t round = 0; slots.size() < n; ++round)
+                {
+                        for (std::size_t node = 0; node < node_cpus.size() && slots.size() < n; ++node)
+                        {
+                                const auto& cpus = node_cpus[node];
+                                if (!cpus.empty()) { slots.push_back({cpus[round % cpus.size()], static_cast<unsigned>(node)}); }
+                        }
+                }
+                return slots;
+        }
+
+        /// @brief Prints the nodes and their CPUs.
+        auto print() const
+        {
+                std::printf("%zu NUMA node(s):", nodes());
+                for (std::size_t node = 0; node < node_cpus.size(); ++node)
+                {
+                        if (!node_cpus[node].empty()) { std::printf(" node %zu has %zu CPU(s);", node, node_cpus[node].size()); }
+                }
+                std::printf("\n");
+        }
+
+        /// @brief Parses a sysfs CPU list such as "0-3,8-11".
+        static auto parse_cpu_list(const std::string& list) -> std::vector<unsigned>
+        {
+                std::vector<unsigned> cpus;
+                for (std::size_t start = 0, end = 0; start < list.size(); start = end + 1)
+                {
+                        end              = std::min(list.find(',', start), list.size());
+                        const auto range = list.substr(start, end - start);
+                        const auto dash  = range.find('-');
+                        if (range.empty() || !std::isdigit(static_cast<unsigned char>(range[0]))) { continue; }
+
+                        const auto first = static_cast<unsigned>(std::stoul(range));
+                        const auto last  = dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+                        for (auto cpu = first; cpu <= last; ++cpu) { cpus.push_back(cpu); }
+                }
+                return cpus;
+        }
+
+private:
+        static auto read_line(const std::string& path) -> std::string
+        {
+                char       line[4096] {};
+                std::FILE* file = std::fopen(path.c_str(), "r");
+                if (!file) { return {}; }
+
+                if (!std::fgets(line, sizeof(line), file)) { line[0] = '\0'; }
+                std::fclose(file);
+                return line;
+        }
+};
+
+/// @brief Pins the calling thread to `slot.cpu` and makes it prefer memory from `slot.node`, so that what it allocates and first touches
+/// from now on lives next to it. Falls back to other nodes when that one is full.
+///
+/// @returns false if the thread could not be pinned; the memory policy is best effort, as kernels without NUMA support refuse it.
+inline auto place_thread(const CpuSlot& slot)
+{
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(slot.cpu, &cpus);
+        const auto pinned = sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+
+        unsigned long nodes[4] {};
+        if (slot.node < sizeof(nodes) * 8)
+        {
+                nodes[slot.node / (sizeof(nodes[0]) * 8)] |= 1UL << (slot.node % (sizeof(nodes[0]) * 8));
+                syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, nodes, sizeof(nodes) * 8 + 1);
+        }
+        return pinned;
+}
+
+/// @brief Returns the node holding the page at `address`, faulting it in first if needed.
+///
+/// @returns -1 if the kernel cannot tell.
+inline auto node_of(const void* address)
+{
+        int node {-1};
+        if (syscall(SYS_get_mempolicy, &node, nullptr, 0, address, NUMA_MPOL_F_NODE | NUMA_MPOL_F_ADDR) != 0) { return -1; }
+        return node;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "inventory.h"
+#include "persistent_map.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <tuple>
+
+/// A counterpart of `BasicInventory` whose copies share their structure, for "what if" simulations on the live stock: copying one is
+/// O(1) however many records it holds, and each change copies only the few trie nodes on its path, so many simulations, each a copy of
+/// the same inventory, can run side by side, even on different threads, for little more memory than their changes take.
+///
+/// The records live in a `PersistentMap` by handle, and each of `Keys` gets a `PersistentMap` from the hash of the key to the handles, as
+/// in `BasicInventory`. It keeps nothing for serving clients: no columns, versions, tombstones or sample, and no `on_mutation` hook, as a
+/// simulation is thrown away rather than journalled. Sharing is by node, so a change to records spread evenly over the handles, such as
+/// a whole category, copies most leaves; one to records added together, such as a supplier's, copies few.
+template<typename Record, typename... Keys>
+struct BasicPersistentInventory
+{
+        template<typename Key>
+        using KeyIndex = PersistentMap<std::uint64_t, Handle>;
+
+        PersistentMap<Handle, Record> items;
+        Handle                        next_handle {1};
+
+        /// @brief Copies the records of an inventory, keeping their handles.
+        template<const auto& SCHEMA, typename Sample>
+        static auto from(const BasicInventory<Record, SCHEMA, Sample, Keys...>& inventory)
+        {
+                BasicPersistentInventory persistent;
+                for (std::size_t i = 0; i < inventory.items.size(); ++i) { persistent.insert(inventory.handles[i], inventory.items[i]); }
+                persistent.next_handle = inventory.next_handle;
+                return persistent;
+        }
+
+        /// @brief Returns a copy to change independently of this one, in O(1).
+        auto clone() const { return *this; }
+
+        auto size() const { return items.size(); }
+
+        /// @brief Look for the item with the given handle.
+        ///
+        /// @returns nullptr if there is no such item.
+        auto find(Handle handle) const { return items.find(handle); }
+
+        /// @brief Look for an item whose `Key` is `key`.
+        ///
+        /// @returns std::nullopt if there is no such item, or the handle of the item.
+        template<typename Key, typename K>
+        auto find_by(const K& key) const -> std::optional<Handle>
+        {
+                std::optional<Handle> found;
+                index<Key>().for_each_equal(Key::hash(key), [&](Handle handle) {
+                        if (Key::of(*find(handle)) == key) { found = handle; }
+                        return !found;
+                });
+                return found;
+        }
+
+        /// @brief Calls `fn(handle, item)` for every item, in no particular order.
+        template<typename Fn>
+        auto for_each(Fn&& fn) const
+        {
+                items.for_each(fn);
+        }
+
+        /// @brief Adds the given item.
+        ///
+        /// @returns the handle of the new item.
+        auto add(const Record& item)
+        {
+                const auto handle = next_handle++;
+                insert(handle, item);
+                return handle;
+        }
+
+        /// @brief Replaces the item with the given handle.
+        ///
+        /// @returns false if there is no such item.
+        auto update(Handle handle, const Record& item)
+        {
+                const auto* old_item = find(handle);
+                if (old_item == nullptr) { return false; }
+
+                (reindex<Keys>(handle, *old_item, item), ...);
+                items.assign(handle, item);
+                return true;
+        }
+
+        /// @brief Removes the item with the given handle.
+        ///
+        /// @returns false if there is no such item.
+        auto remove(Handle handle)
+        {
+                const auto* item = find(handle);
+                if (item == nullptr) { return false; }
+
+                (index<Keys>().erase_if(Keys::hash(Keys::of(*item)), [&](Handle other) { return other == handle; }), ...);
+                items.erase(handle);
+                return true;
+        }
+
+        /// @brief Calls `fn(item)` with a copy of every item and stores the copies it returns true for.
+        ///
+        /// @returns the no. of items changed.
+        template<typename Fn>
+        auto update_if(Fn&& fn)
+        {
+                std::size_t changed {0};
+                clone().for_each([&](Handle handle, const Record& item) {
+                        auto copy = item;
+                        if (fn(copy)) { changed += update(handle, copy) ? 1 : 0; }
+                });
+                return changed;
+        }
+
+        /// @brief Removes the items that `pred(item)` returns true for.
+        ///
+        /// @returns the no. of items removed.
+        template<typename Pred>
+        auto remove_if(Pred&& pred)
+        {
+                std::size_t removed {0};
+                clone().for_each([&](Handle handle, const Record& item) {
+                        if (pred(item)) { removed += remove(handle) ? 1 : 0; }
+                });
+                return removed;
+        }
+
+private:
+        /// Gives every key a distinct type in `indexes`.
+        template<typename Key>
+        struct KeyEntries
+        {
+                KeyIndex<Key> entries;
+        };
+
+        std::tuple<KeyEntries<Keys>...> indexes;
+
+        template<typename Key>
+        auto index() const -> const KeyIndex<Key>&
+        {
+                return std::get<KeyEntries<Key>>(indexes).entries;
+        }
+
+        template<typename Key>
+        auto index() -> KeyIndex<Key>&
+        {
+                return std::get<KeyEntries<Key>>(indexes).entries;
+        }
+
+        auto insert(Handle handle, const Record& item) -> void
+        {
+                items.assign(handle, item);
+                (index<Keys>().emplace(Keys::hash(Keys::of(item)), handle), ...);
+        }
+
+        template<typename Key>
+        auto reindex(Handle handle, const Record& old_item, const Record& new_item) -> void
+        {
+                const auto old_key = Key::of(old_item);
+                const auto new_key = Key::of(new_item);
+                if (old_key == new_key) { return; }
+
+                index<Key>().erase_if(Key::hash(old_key), [&](Handle other) { return other == handle; });
+                index<Key>().emplace(Key::hash(new_key), handle);
+        }
+};
+
+/// The stocked items in the store, for simulations.
+using PersistentInventory = BasicPersistentInventory<Item, ModelCodeKey>;
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+constexpr auto PERSISTENT_MAP_BITS = 5U;        // key bits consumed per level, for 32 slots a node
+
+/// A map from unsigned integer keys to values whose copies share their structure: copying one is O(1), and changing a copy copies only
+/// the nodes on the path to the change, leaving the other copies as they were. Keys may repeat, as in a multimap.
+///
+/// It is a hash array mapped trie (Bagwell, 2001) that takes the key as its own hash, so keys must be spread over their low bits, like
+/// handles counting up or the output of a hash function. Each level takes `PERSISTENT_MAP_BITS` more bits of the key, starting from the
+/// lowest; a node keeps only the slots in use, found by the popcount of a bitmap. A pair sits as high up as no other key shares its bits
+/// so far. Pairs whose keys are equal in every bit end up in a bucket below the last level, searched in order.
+///
+/// Nodes are shared between copies by `std::shared_ptr` and a change copies a node only if another copy can reach it, so a map changed
+/// many times after being copied copies every node once and then changes it in place. Copies may be read and changed by different threads
+/// at the same time, but like any value a single copy must not be changed by one thread while another reads or copies it.
+template<typename K, typename V>
+struct PersistentMap
+{
+        static_assert(std::is_unsigned_v<K>, "keys are split into their bits");
+
+        /// @brief Looks for a value with `key`.
+        ///
+        /// @returns nullptr if there is none.
+        auto find(K key) const -> const V*
+        {
+                const V* found {nullptr};
+                for_each_equal(key, [&](const V& value) {
+                        found = &value;
+                        return false;
+                });
+                return found;
+        }
+
+        /// @brief Calls `fn(value)` for every value with `key` until it returns false.
+        template<typename Fn>
+        auto for_each_equal(K key, Fn&& fn) const
+        {
+                const Node* node = root.get();
+                for (unsigned shift = 0; node != nullptr; shift += PERSISTENT_MAP_BITS)
+                {
+                        if (shift >= DIGITS)
+                        {
+                                for (const auto& entry : node->entries)
+                                {
+                                        const auto& leaf = std::get<Leaf>(entry);
+                                        if (leaf.key == key && !fn(leaf.value)) { return; }
+                                }
+                                return;
+                        }
+
+                        const auto bit = bit_of(key, shift);
+                        if ((node->bitmap & bit) == 0) { return; }
+
+                        const auto& entry = node->entries[position(*node, bit)];
+                        if (const auto* leaf = std::get_if<Leaf>(&entry))
+                        {
+                                if (leaf->key == key) { fn(leaf->value); }
+                                return;
+                        }
+                        node = std::get<NodePtr>(entry).get();
+                }
+        }
+
+        /// @brief Calls `fn(key, value)` for every pair, in the order of the trie, which is not the order of the keys.
+        template<typename Fn>
+        auto for_each(Fn&& fn) const
+        {
+                if (root) { walk(*root, fn); }
+        }
+
+        auto size() const { return count; }
+        auto empty() const { return count == 0; }
+
+        /// @brief Sets the value of the first pair with `key`, or adds a pair if there is none.
+        auto assign(K key, V value) { put(root, 0, {key, std::move(value)}, true); }
+
+        /// @brief Adds a pair, even if others have the same key.
+        auto emplace(K key, V value) { put(root, 0, {key, std::move(value)}, false); }
+
+        /// @brief Removes the first pair with `key` whose value `pred(value)` accepts. Copies no node if there is no such pair.
+        ///
+        /// @returns the no. of pairs removed, 0 or 1.
+        template<typename Pred>
+        auto erase_if(K key, Pred&& pred) -> std::size_t
+        {
+                auto found = false;
+                for_each_equal(key, [&](const V& value) { return !(found = pred(value)); });
+                if (!found) { return 0; }
+
+                remove(root, 0, key, pred);
+                --count;
+                return 1;
+        }
+
+        /// @brief Removes the first pair with `key`.
+        auto erase(K key) { return erase_if(key, [](const V&) { return true; }); }
+
+private:
+        struct Node;
+        using NodePtr = std::shared_ptr<Node>;
+
+        struct Leaf
+        {
+                K key;
+                V value;
+        };
+
+        using Entry = std::variant<NodePtr, Leaf>;
+
+        /// The slots in use of one level, in slot order. Below the last level, a bucket of leaves with equal keys and no bitmap.
+        struct Node
+        {
+                std::uint32_t      bitmap {0};
+                std::vector<Entry> entries;
+        };
+
+        static constexpr auto DIGITS = static_cast<unsigned>(std::numeric_limits<K>::digits);
+
+        NodePtr     root;
+        std::size_t count {0};
+
+        static auto bit_of(K key, unsigned shift) { return std::uint32_t {1} << ((key >> shift) & ((1U << PERSISTENT_MAP_BITS) - 1)); }
+
+        static auto position(const Node& node, std::uint32_t bit) { return std::bitset<32>(node.bitmap & (bit - 1)).count(); }
+
+        /// @brief Returns the node `ptr` points to, copying it first unless this map is the only one that can reach it.
+        static auto own(NodePtr& ptr) -> Node&
+        {
+                if (!ptr) { ptr = std::make_shared<Node>(); }
+                else if (ptr.use_count() != 1) { ptr = std::make_shared<Node>(*ptr); }
+                else
+                {
+                        // a copy dropped by another thread may have read the node just before; see its reads before our writes
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                }
+                return *ptr;
+        }
+
+        template<typename Fn>
+        static auto walk(const Node& node, Fn& fn) -> void
+        {
+                for (const auto& entry : node.entries)
+                {
+                        if (const auto* leaf = std::get_if<Leaf>(&entry)) { fn(leaf->key, leaf->value); }
+                        else { walk(*std::get<NodePtr>(entry), fn); }
+                }
+        }
+
+        auto put(NodePtr& ptr, unsigned shift, Leaf&& leaf, bool replace) -> void
+        {
+                auto& node = own(ptr);
+                if (shift >= DIGITS)
+                {
+                        for (auto& entry : node.entries)
+                        {
+                                if (replace && std::get<Leaf>(entry).key == leaf.key)
+                                {
+                                        std::get<Leaf>(entry).value = std::move(leaf.value);
+                                        return;
+                                }
+                        }
+                        node.entries.emplace_back(std::move(leaf));
+                        ++count;
+                        return;
+                }
+
+                const auto bit = bit_of(leaf.key, shift);
+                const auto pos = position(node, bit);
+                if ((node.bitmap & bit) == 0)
+                {
+                        node.entries.emplace(node.entries.begin() + static_cast<std::ptrdiff_t>(pos), std::move(leaf));
+                        node.bitmap |= bit;
+                        ++count;
+                        return;
+                }
+
+                auto& entry = node.entries[pos];
+                if (auto* existing = std::get_if<Leaf>(&entry))
+                {
+                        if (replace && existing->key == leaf.key)
+                        {
+                                existing->value = std::move(leaf.value);
+                                return;
+                        }
+
+                        // two pairs share the bits so far, so both move down a level
+                        NodePtr child;
+                        auto&   first = own(child);
+                        first.bitmap  = shift + PERSISTENT_MAP_BITS >= DIGITS ? 0 : bit_of(existing->key, shift + PERSISTENT_MAP_BITS);
+                        first.entries.emplace_back(std::move(*existing));
+                        entry = std::move(child);
+                        put(std::get<NodePtr>(entry), shift + PERSISTENT_MAP_BITS, std::move(leaf), replace);
+                        return;
+                }
+                put(std::get<NodePtr>(entry), shift + PERSISTENT_MAP_BITS, std::move(leaf), replace);
+        }
+
+        /// @brief Removes the first pair with `key` that `pred` accepts, which must be there, and pulls a leaf left alone in a node up
+        /// into the node above.
+        template<typename Pred>
+        auto remove(NodePtr& ptr, unsigned shift, K key, Pred& pred) -> void
+        {
+                auto& node = own(ptr);
+                if (shift >= DIGITS)
+                {
+                        for (auto pentry = node.entries.begin(); pentry != node.entries.end(); ++pentry)
+                        {
+                                const auto& leaf = std::get<Leaf>(*pentry);
+                                if (leaf.key == key && pred(leaf.value))
+                                {
+                                        node.entries.erase(pentry);
+                                        return;
+                                }
+                        }
+                        return;
+                }
+
+                const auto bit   = bit_of(key, shift);
+                const auto pos   = static_cast<std::ptrdiff_t>(position(node, bit));
+                auto&      entry = node.entries[static_cast<std::size_t>(pos)];
+                if (std::holds_alternative<Leaf>(entry))
+                {
+                        node.entries.erase(node.entries.begin() + pos);
+                        node.bitmap &= ~bit;
+                        return;
+                }
+
+                auto& child = std::get<NodePtr>(entry);
+                remove(child, shift + PERSISTENT_MAP_BITS, key, pred);
+                if (child->entries.empty())
+                {
+                        node.entries.erase(node.entries.begin() + pos);
+                        node.bitmap &= ~bit;
+                }
+                else if (child->entries.size() == 1 && std::holds_alternative<Leaf>(child->entries.front()))
+                {
+                        entry = Entry {std::move(std::get<Leaf>(child->entries.front()))};
+                }
+        }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "bytes.h"
+#include "inventory.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// A price an item takes from a given time on.
+struct PriceVersion
+{
+        Handle handle {0};
+        float  price {0};
+};
+
+/// Price changes that take effect at given times, such as a sale starting at midnight across thousands of items.
+///
+/// Versions are kept by the time they take effect, in milliseconds of the wall clock since the epoch, and `apply` makes every version
+/// that has come due take effect in one pass, in the order of their times, as ordinary updates of the items' prices. Called between
+/// rounds of a server, no request sees some of the prices of a sale changed and others not. A version for an item removed since it was
+/// scheduled is dropped, and one for an item replaced since sets the price of the replacement.
+///
+/// The schedule is kept in memory only, though a handoff passes it on to the new server (see `save`): after a restart, the versions that
+/// have not taken effect yet must be scheduled again.
+struct PriceSchedule
+{
+        using Clock = std::chrono::system_clock;
+
+        Inventory&                                        inventory;
+        std::map<std::int64_t, std::vector<PriceVersion>> versions;        // by the time they take effect
+        std::size_t                                       count {0};
+
+        explicit PriceSchedule(Inventory& inventory) : inventory {inventory} {}
+
+        /// @brief Returns the time a version taking effect at `time` is kept by.
+        static auto ms_of(Clock::time_point time) -> std::int64_t
+        {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+        }
+
+        /// @brief Changes the price of the item to `price` once `effective_ms` has passed, after any version scheduled for an earlier
+        /// time or earlier for the same time.
+        auto schedule(Inventory::ItemPtr pitem, float price, std::int64_t effective_ms)
+        {
+                versions[effective_ms].push_back({inventory.handle_of(pitem), price});
+                ++count;
+        }
+
+        /// @brief Makes every version due by `now` take effect.
+        ///
+        /// @returns the no. of versions that took effect.
+        auto apply(Clock::time_point now = Clock::now())
+        {
+                const auto  end = versions.upper_bound(ms_of(now));
+                std::size_t applied {0};
+                for (auto pos = versions.begin(); pos != end; ++pos)
+                {
+                        for (const auto& version : pos->second)
+                        {
+                                const auto pitem = inventory.find(version.handle);
+                                if (pitem == inventory.items.end()) { continue; }
+
+                                ++applied;
+                                if (pitem->price == version.price) { continue; }
+
+                                auto item  = *pitem;
+                                item.price = version.price;
+                                inventory.update(pitem, item);
+                        }
+                        count -= pos->second.size();
+                }
+                versions.erase(versions.begin(), end);
+                return applied;
+        }
+
+        /// @brief Returns when the next version takes effect, or std::nullopt if none is scheduled.
+        auto next() const -> std::optional<std::int64_t>
+        {
+                if (versions.empty()) { return {}; }
+
+                return versions.begin()->first;
+        }
+
+        /// @brief Returns the no. of versions that have not taken effect yet.
+        auto size() const { return count; }
+
+        /// @brief Appends the versions that have not taken effect yet to `out`, in order, for a server taking over.
+        auto save(std::string& out) const
+        {
+                put(out, std::uint64_t {count});
+                for (const auto& [effective_ms, due] : versions)
+                {
+                        for (const auto& version : due)
+                        {
+                                put(out, effective_ms);
+                                put(out, version.handle);
+                                put(out, version.price);
+                        }
+                }
+        }
+
+        /// @brief Schedules the versions written by `save` from `data` and advances it, after those scheduled for the same times.
+        ///
+        /// @returns false if `data` is truncated.
+        auto load(const char*& data, const char* end)
+        {
+                std::uint64_t saved {};
+                if (!get(data, end, saved)) { return false; }
+
+                for (std::uint64_t i = 0; i < saved; ++i)
+                {
+                        std::int64_t effective_ms {};
+                        PriceVersion version;
+                        if (!get(data, end, effective_ms) || !get(data, end, version.handle) || !get(data, end, version.price)) { return false; }
+
+                        versions[effective_ms].push_back(version);
+                        ++count;
+                }
+                return true;
+        }
+};
@@ -0,0 +1,385 @@
+#pragma once
+
+#include "bytes.h"
+#include "inventory.h"
+#include "net.h"
+#include "wire.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr auto MAX_FRAME_BYTES    = std::uint32_t {64U << 20U};
+constexpr auto RESULT_CHUNK_ITEMS = std::size_t {512};          // items per frame of a streamed result
+constexpr auto SCAN_PAGE_ITEMS    = std::uint32_t {4096};       // most items a server returns for one `Scan` request
+constexpr auto SCAN_PAGE_EXAMINED = std::size_t {65536};        // most items a server looks at for one `Scan` request
+
+/// Requests understood by inventory servers. Items are identified by their model code, which is unique within a server.
+enum class MessageType : std::uint8_t
+{
+        Get,                  // model code -> item
+        Put,                  // item -> adds it, or replaces the item with the same model code
+        Remove,               // model code ->
+        List,                 // product category, or -1 for all -> items
+        ScanHashRange,        // lowest hash, highest hash, max items -> items whose model code hashes into the range
+        AddShard,             // address -> (routers only) adds a shard and starts moving its items to it
+        Query,                // query -> matching items, in the requested order
+        SyncSince,            // version -> (servers only) the changes made after it
+        Scan,                 // cursor, filter, page size -> the next page of matching items and the cursor to resume from
+        Stats,                // -> admission control counters of the server or router answering
+        Import,               // item records -> no. of items added or replaced, run in slices between other requests
+        Aggregate,            // query -> totals over the matching items, estimated from a sample of them
+        Reserve,              // units, time to live, model code -> reservation id, holding the units for a basket until it expires
+        Commit,               // reservation id, model code -> takes the units out of stock, as the basket checked out
+        Release,              // reservation id, model code -> gives the units back before the reservation expires
+        SchedulePrice,        // time it takes effect, price, model code -> changes the item's price at that time
+};
+
+/// Outcome of a request, carried in the response header.
+enum class Status : std::uint8_t
+{
+        Ok,
+        NotFound,
+        Error,
+        Unsupported,
+        Partial,           // part of a streamed result, more frames for the same request follow
+        Overloaded,        // rejected without being run because the server's queue for it is full, try again later
+        Expired,           // dropped without being run because its deadline passed while it was queued
+        OutOfStock,        // a reservation asked for more units than the item has in stock and not held by other reservations
+};
+
+/// Classes of requests that admission control queues separately. Till requests are short and have a customer waiting on them, so they
+/// are run first and get the larger queue; back-office listings, scans and imports are shed first when a server is overloaded.
+enum class Priority : std::uint8_t
+{
+        Till,
+        BackOffice,
+};
+
+constexpr auto NPRIORITIES = std::size_t {2};
+
+/// @brief Returns the class a request is queued in.
+constexpr auto request_priority(MessageType type)
+{
+        const auto till = type == MessageType::Get || type == MessageType::Put || type == MessageType::Remove || type == MessageType::Reserve ||
+                          type == MessageType::Commit || type == MessageType::Release;
+        return till ? Priority::Till : Priority::BackOffice;
+}
+
+/// Admission control counters, the payload of a `Stats` response. Arrays are indexed by `Priority`.
+struct ServerStats
+{
+        std::uint64_t accepted[NPRIORITIES];
+        std::uint64_t rejected[NPRIORITIES];          // shed with `Overloaded` because the queue was full
+        std::uint64_t expired[NPRIORITIES];           // dropped with `Expired` because they were queued past their deadline
+        std::uint64_t handled[NPRIORITIES];
+        std::uint32_t queued[NPRIORITIES];            // requests waiting now
+        std::uint32_t max_queued[NPRIORITIES];        // most requests that have been waiting at once
+        std::uint32_t clients;
+        std::uint32_t paused;                         // clients not read from until they have less in flight or read their responses
+};
+static_assert(sizeof(ServerStats) % WIRE_ALIGN == 0);
+
+/// Precedes every request and response on the wire. A response carries the type and `request_id` of the request it answers.
+///
+/// The payload is padded to a multiple of `WIRE_ALIGN` bytes, so in a buffer of whole frames every payload starts aligned and the item
+/// records in it can be read in place.
+struct FrameHeader
+{
+        std::uint32_t length;            // No. of payload bytes that follow, not counting padding
+        std::uint32_t request_id;
+        MessageType   type;
+        Status        status;
+        std::uint16_t deadline_ms;        // how long the sender of a request waits for the response, 0 if it does not say
+        std::uint8_t  reserved[4];
+};
+static_assert(sizeof(FrameHeader) % WIRE_ALIGN == 0);
+
+/// A request or response read off the wire.
+struct Frame
+{
+        FrameHeader header {};
+        std::string payload;
+};
+
+/// A request or response in a receive buffer, with the payload left where it is.
+struct FrameView
+{
+        FrameHeader      header {};
+        std::string_view payload;
+};
+
+/// @brief Appends a frame to `out`, which must hold whole frames already.
+inline auto encode_frame(std::string& out, MessageType type, Status status, std::uint32_t request_id, std::string_view payload,
+                         std::uint16_t deadline_ms = 0)
+{
+        put(out, FrameHeader {static_cast<std::uint32_t>(payload.size()), request_id, type, status, deadline_ms, {}});
+        out.append(payload);
+        wire_pad(out);
+}
+
+/// @brief Finds the frame starting at `pos` in `buffer` and advances `pos` past it. The view is valid until `buffer` changes.
+///
+/// @returns std::nullopt if `buffer` does not hold a complete frame yet.
+inline auto decode_frame(std::string_view buffer, std::size_t& pos) -> std::optional<FrameView>
+{
+        FrameView   frame;
+        const auto* data = buffer.data() + pos;
+        if (!get(data, buffer.data() + buffer.size(), frame.header) ||
+            buffer.size() - pos - sizeof(FrameHeader) < wire_align(frame.header.length))
+        {
+                return {};
+        }
+
+        frame.payload = buffer.substr(pos + sizeof(FrameHeader), frame.header.length);
+        pos += sizeof(FrameHeader) + wire_align(frame.header.length);
+        return frame;
+}
+
+/// Payload of a `Reserve` request, followed by the model code of the item.
+struct ReserveRequest
+{
+        std::uint32_t quantity;
+        std::uint32_t ttl_ms;        // how long the units are held unless the basket checks out
+};
+static_assert(sizeof(ReserveRequest) % WIRE_ALIGN == 0);
+
+/// Payload of `Commit` and `Release` requests, followed by the model code of the item reserved.
+struct ReservationRef
+{
+        std::uint64_t id;
+};
+static_assert(sizeof(ReservationRef) % WIRE_ALIGN == 0);
+
+/// Payload of a `SchedulePrice` request, followed by the model code of the item.
+struct PriceChange
+{
+        std::int64_t  effective_ms;        // wall clock time the price takes effect, in milliseconds since the epoch
+        float         price;
+        std::uint32_t reserved;
+};
+static_assert(sizeof(PriceChange) % WIRE_ALIGN == 0);
+
+/// @brief Returns the model code of the item a request for one item is about, which is what servers and routers find its owner by.
+///
+/// @returns std::nullopt if the request is not about one item or its payload is malformed.
+inline auto model_code_of(const FrameView& request) -> std::optional<std::string_view>
+{
+        const auto skip = [&](std::size_t size) -> std::optional<std::string_view> {
+                if (request.payload.size() < size) { return {}; }
+                return request.payload.substr(size);
+        };
+        switch (request.header.type)
+        {
+                case MessageType::Get:
+                case MessageType::Remove: return request.payload;
+                case MessageType::Put:
+                {
+                        const auto item = ItemView::parse(request.payload);
+                        if (!item) { return {}; }
+                        return item->name;
+                }
+                case MessageType::Reserve: return skip(sizeof(ReserveRequest));
+                case MessageType::Commit:
+                case MessageType::Release: return skip(sizeof(ReservationRef));
+                case MessageType::SchedulePrice: return skip(sizeof(PriceChange));
+                default: return {};
+        }
+}
+
+/// Payload of a `ScanHashRange` request.
+struct HashRange
+{
+        std::uint64_t lo;           // lowest hash, inclusive
+        std::uint64_t hi;           // highest hash, inclusive
+        std::uint32_t limit;        // max no. of items to return
+        std::uint32_t reserved;
+};
+static_assert(sizeof(HashRange) % WIRE_ALIGN == 0);
+
+/// @brief Appends `items` as a streamed result: `Partial` frames of up to `RESULT_CHUNK_ITEMS` items, then a final `Ok` frame.
+template<typename T>
+auto encode_result(std::string& out, MessageType type, std::uint32_t request_id, const std::vector<T>& items)
+{
+        std::string payload;
+        for (std::size_t i = 0; i < items.size(); ++i)
+        {
+                encode_item(payload, items[i]);
+                if ((i + 1) % RESULT_CHUNK_ITEMS == 0 && i + 1 < items.size())
+                {
+                        encode_frame(out, type, Status::Partial, request_id, payload);
+                        payload.clear();
+                }
+        }
+        encode_frame(out, type, Status::Ok, request_id, payload);
+}
+
+/// Start of the result of a `SyncSince` request, which is followed by `count` changes, each a `DeltaHeader` and an item record.
+///
+/// If the server no longer remembers every removal since the requested version, `full` is set and the changes are every item in the
+/// inventory: the client has to drop whatever else it has.
+struct SyncHeader
+{
+        Version       version;        // version of the inventory the changes bring the client up to
+        std::uint32_t full;
+        std::uint32_t count;
+};
+static_assert(sizeof(SyncHeader) % WIRE_ALIGN == 0);
+
+/// Precedes the item record of each change in a `SyncSince` result. The record of a removed item only carries its model code.
+struct DeltaHeader
+{
+        Version       version;        // version of the change
+        std::uint32_t removed;
+        std::uint32_t reserved;
+};
+static_assert(sizeof(DeltaHeader) % WIRE_ALIGN == 0);
+
+/// Order of the items returned by a `Query`.
+enum class QueryOrder : std::uint8_t
+{
+        None,
+        PriceAsc,
+        PriceDesc,
+        StockAsc,
+        StockDesc,
+};
+
+constexpr std::string_view QUERY_ORDER_NAMES[] = {"none", "price", "-price", "stock", "-stock"};
+
+/// Payload of a `Query` request: the items of a category within a price range, optionally only those running low on stock, optionally
+/// sorted and cut to the first `limit`.
+struct Query
+{
+        std::int32_t  category {-1};        // product id, or -1 for all
+        float         min_price {-FLT_MAX};
+        float         max_price {FLT_MAX};
+        std::uint32_t limit {0};               // max no. of items to return, 0 for all
+        QueryOrder    order {QueryOrder::None};
+        std::uint8_t  reserved[3] {};
+        std::int32_t  below_stock {0};        // only items with fewer than this many in stock, 0 for all
+};
+static_assert(sizeof(Query) % WIRE_ALIGN == 0);
+
+/// Payload of a `Scan` request, which pages through the items matching a filter in the order of their handles.
+///
+/// The cursor is the position of the last item looked at, so it stays valid while items are added and removed: items removed before the
+/// scan reaches them are not returned, and items added since the scan started are returned when it gets to them. A router keeps the
+/// index of the shard in the upper 32 bits and the shard's cursor in the lower.
+struct ScanRequest
+{
+        std::uint64_t after {0};        // cursor to resume after, 0 to start
+        Query         filter;           // category, price range and stock threshold, order and limit are ignored
+        std::uint32_t max_items {SCAN_PAGE_ITEMS};
+        std::uint32_t reserved {0};
+};
+static_assert(sizeof(ScanRequest) % WIRE_ALIGN == 0);
+
+/// Start of the result of a `Scan` request, which is followed by `count` item records.
+struct ScanHeader
+{
+        std::uint64_t next;        // cursor to pass in the request for the next page
+        std::uint32_t count;
+        std::uint32_t done;        // set once there are no more items to look at
+};
+static_assert(sizeof(ScanHeader) % WIRE_ALIGN == 0);
+
+/// Totals over the items matching the filter of a query, estimated from a sample of the items: the payload of an `Aggregate` response.
+/// Servers sample their items independently, so the results of several add up, variances and covariances included.
+struct AggregateResult
+{
+        Estimate      count;                  // items
+        Estimate      units;                  // units in stock
+        Estimate      value;                  // price times units in stock
+        Estimate      price;                  // sum of prices, for the average price
+        double        price_count {0};        // covariance of the estimates of `price` and `count`
+        std::uint64_t items {0};              // items the totals were estimated over, matching or not
+        std::uint64_t sampled {0};            // of which were in the sample
+
+        auto operator+=(const AggregateResult& other) -> AggregateResult&
+        {
+                count += other.count;
+                units += other.units;
+                value += other.value;
+                price += other.price;
+                price_count += other.price_count;
+                items += other.items;
+                sampled += other.sampled;
+                return *this;
+        }
+
+        /// @brief Estimates the average price of the matching items as the ratio of `price` to `count`, with the variance of the ratio to
+        /// first order.
+        auto average_price() const
+        {
+                if (count.total <= 0) { return Estimate {}; }
+
+                const auto ratio    = price.total / count.total;
+                const auto variance = price.variance - 2 * ratio * price_count + ratio * ratio * count.variance;
+                return Estimate {ratio, std::max(variance, 0.0) / (count.total * count.total)};
+        }
+};
+static_assert(sizeof(AggregateResult) % WIRE_ALIGN == 0);
+
+/// @brief Converts the name of a query order as printed in `QUERY_ORDER_NAMES`.
+///
+/// @returns std::nullopt if there is no such order.
+inline auto parse_query_order(std::string_view name) -> std::optional<QueryOrder>
+{
+        const auto pos = std::find(std::begin(QUERY_ORDER_NAMES), std::end(QUERY_ORDER_NAMES), name);
+        if (pos == std::end(QUERY_ORDER_NAMES)) { return {}; }
+
+        return static_cast<QueryOrder>(pos - std::begin(QUERY_ORDER_NAMES));
+}
+
+/// A blocking connection to an inventory server or router, sending one request at a time.
+struct Connection
+{
+        UniqueFd      sock;
+        std::uint32_t next_id {1};
+
+        /// @brief Connects to `address`. With a `timeout_ms`, connecting and every call fail once they have waited that long for the
+        /// server, as `connect_tcp` does.
+        ///
+        /// @returns std::nullopt if the connection failed.
+        static auto open(const Address& address, int timeout_ms = 0) -> std::optional<Connection>
+        {
+                Connection conn;
+                conn.sock = connect_tcp(address, timeout_ms);
+                if (!conn.sock) { return {}; }
+
+                return conn;
+        }
+
+        /// @brief Sends a request and waits for its response. The payloads of a streamed result are joined into one frame.
+        ///
+        /// @returns std::nullopt if the connection failed, after which it should be discarded.
+        auto call(MessageType type, std::string_view payload) -> std::optional<Frame>
+        {
+                std::string request;
+                const auto  id = next_id++;
+                encode_frame(request, type, Status::Ok, id, payload);
+                if (!send_all(sock.fd, request.data(), request.size())) { return {}; }
+
+                Frame frame;
+                do {
+                        const auto received = frame.payload.size();
+                        if (!recv_all(sock.fd, reinterpret_cast<char*>(&frame.header), sizeof(frame.header)) || frame.header.request_id != id ||
+                            frame.header.length > MAX_FRAME_BYTES - received)
+                        {
+                                return {};
+                        }
+
+                        frame.payload.resize(received + wire_align(frame.header.length));
+                        if (!recv_all(sock.fd, frame.payload.data() + received, wire_align(frame.header.length))) { return {}; }
+                        frame.payload.resize(received + frame.header.length);
+                } while (frame.header.status == Status::Partial);
+
+                return frame;
+        }
+};
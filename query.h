@@ -0,0 +1,376 @@
+#pragma once
+
+#include "inventory.h"
+#include "protocol.h"
+#include "wire.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+/// Terms of a query filter. The terms a query uses make up its shape.
+constexpr auto FILTER_CATEGORY = 1U << 0U;
+constexpr auto FILTER_PRICE    = 1U << 1U;
+constexpr auto FILTER_STOCK    = 1U << 2U;
+constexpr auto FILTER_SHAPES   = 1U << 3U;
+
+/// @brief Returns the terms of the filter of `query` that can exclude an item.
+inline auto filter_shape(const Query& query)
+{
+        auto shape = query.category >= 0 ? FILTER_CATEGORY : 0U;
+        shape |= query.min_price > -FLT_MAX || query.max_price < FLT_MAX ? FILTER_PRICE : 0U;
+        shape |= query.below_stock > 0 ? FILTER_STOCK : 0U;
+        return shape;
+}
+
+/// Most positions a filter selects from in one call, so that a block of selection masks fits on the stack.
+constexpr auto FILTER_BLOCK = std::size_t {256};
+
+/// How a filter tests items.
+enum class ScanMode : std::uint8_t
+{
+        Branching,        // skip an item at the first term it fails; fast when nearly every item fails the same way, slow on mixed data
+        Masked,           // test every term of every item without branching and keep the matches; the same speed whatever the selectivity
+};
+
+/// @brief Returns the position of the first item from `pos` up to `end` of `columns` selected by a filter of shape `SHAPE`, or `end` if
+/// there is none. The terms are fixed at compile time, so the loop only reads and tests the columns the shape uses.
+template<unsigned SHAPE>
+auto find_match(const Query& query, const ItemColumns& columns, std::size_t pos, std::size_t end) -> std::size_t
+{
+        const auto* ids      = columns.column<ITEM_ID>().data();
+        const auto* prices   = columns.column<ITEM_PRICE>().data();
+        const auto* stock    = columns.column<ITEM_NSTOCK>().data();
+        const auto  category = static_cast<Product>(query.category);
+        for (; pos < end; ++pos)
+        {
+                if constexpr ((SHAPE & FILTER_CATEGORY) != 0)
+                {
+                        if (ids[pos] != category) { continue; }
+                }
+                if constexpr ((SHAPE & FILTER_PRICE) != 0)
+                {
+                        if (prices[pos] < query.min_price || prices[pos] > query.max_price) { continue; }
+                }
+                if constexpr ((SHAPE & FILTER_STOCK) != 0)
+                {
+                        if (stock[pos] >= query.below_stock) { continue; }
+                }
+                return pos;
+        }
+        return end;
+}
+
+/// @brief Same as `find_match` for a filter of any shape, which is worked out and its terms tested one by one for every item.
+inline auto find_match_interpreted(const Query& query, const ItemColumns& columns, std::size_t pos, std::size_t end) -> std::size_t
+{
+        const auto shape = filter_shape(query);
+        for (; pos < end; ++pos)
+        {
+                const auto id    = columns.column<ITEM_ID>()[pos];
+                const auto price = columns.column<ITEM_PRICE>()[pos];
+                const auto stock = columns.column<ITEM_NSTOCK>()[pos];
+                if ((shape & FILTER_CATEGORY) != 0 && id != static_cast<Product>(query.category)) { continue; }
+                if ((shape & FILTER_PRICE) != 0 && (price < query.min_price || price > query.max_price)) { continue; }
+                if ((shape & FILTER_STOCK) != 0 && stock >= query.below_stock) { continue; }
+                return pos;
+        }
+        return end;
+}
+
+/// @brief Writes the positions of the items from `pos` up to `end` selected by `find` to `out`, in order.
+///
+/// @returns how many there are.
+template<std::size_t (*FIND)(const Query&, const ItemColumns&, std::size_t, std::size_t)>
+auto select_branching(const Query& query, const ItemColumns& columns, std::size_t pos, std::size_t end, std::uint32_t* out) -> std::size_t
+{
+        std::size_t count {0};
+        for (pos = FIND(query, columns, pos, end); pos < end; pos = FIND(query, columns, pos + 1, end))
+        {
+                out[count++] = static_cast<std::uint32_t>(pos);
+        }
+        return count;
+}
+
+/// @brief Writes the positions from `pos` on whose entry in `mask` is 1 to `out`. Every position is written, and only the count tells
+/// whether it is kept, so there is nothing to mispredict however the matches fall.
+///
+/// @returns how many are kept.
+inline auto compact_selection(const std::uint8_t* mask, std::size_t n, std::size_t pos, std::uint32_t* out)
+{
+        std::size_t count {0};
+        for (std::size_t i = 0; i < n; ++i)
+        {
+                out[count] = static_cast<std::uint32_t>(pos + i);
+                count += mask[i];
+        }
+        return count;
+}
+
+/// @brief Same as `select_branching` for a filter of shape `SHAPE`, without branches: every term is tested for every item and the
+/// results and-ed into a mask, in a loop the compiler turns into vector compares, before the mask is compacted. `end - pos` must not be
+/// over `FILTER_BLOCK`.
+template<unsigned SHAPE>
+auto select_masked(const Query& query, const ItemColumns& columns, std::size_t pos, std::size_t end, std::uint32_t* out) -> std::size_t
+{
+        const auto* ids      = columns.column<ITEM_ID>().data() + pos;
+        const auto* prices   = columns.column<ITEM_PRICE>().data() + pos;
+        const auto* stock    = columns.column<ITEM_NSTOCK>().data() + pos;
+        const auto  category = static_cast<Product>(query.category);
+        const auto  n        = end - pos;
+
+        std::uint8_t mask[FILTER_BLOCK];
+        for (std::size_t i = 0; i < n; ++i)
+        {
+                auto keep = 1U;
+                if constexpr ((SHAPE & FILTER_CATEGORY) != 0) { keep &= static_cast<unsigned>(ids[i] == category); }
+                if constexpr ((SHAPE & FILTER_PRICE) != 0)
+                {
+                        keep &= static_cast<unsigned>(prices[i] >= query.min_price) & static_cast<unsigned>(prices[i] <= query.max_price);
+                }
+                if constexpr ((SHAPE & FILTER_STOCK) != 0) { keep &= static_cast<unsigned>(stock[i] < query.below_stock); }
+                mask[i] = static_cast<std::uint8_t>(keep);
+        }
+        return compact_selection(mask, n, pos, out);
+}
+
+/// @brief Same as `select_masked` for a filter of any shape. The shape is worked out once per block and each of its terms applied to the
+/// whole mask in turn, so interpreting costs a few branches per block rather than per item.
+inline auto select_masked_interpreted(const Query& query, const ItemColumns& columns, std::size_t pos, std::size_t end, std::uint32_t* out)
+        -> std::size_t
+{
+        const auto* ids    = columns.column<ITEM_ID>().data() + pos;
+        const auto* prices = columns.column<ITEM_PRICE>().data() + pos;
+        const auto* stock  = columns.column<ITEM_NSTOCK>().data() + pos;
+        const auto  shape  = filter_shape(query);
+        const auto  n      = end - pos;
+
+        std::uint8_t mask[FILTER_BLOCK];
+        std::fill(mask, mask + n, std::uint8_t {1});
+        if ((shape & FILTER_CATEGORY) != 0)
+        {
+                const auto category = static_cast<Product>(query.category);
+                for (std::size_t i = 0; i < n; ++i) { mask[i] &= static_cast<std::uint8_t>(ids[i] == category); }
+        }
+        if ((shape & FILTER_PRICE) != 0)
+        {
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                        mask[i] &= static_cast<std::uint8_t>(prices[i] >= query.min_price) & static_cast<std::uint8_t>(prices[i] <= query.max_price);
+                }
+        }
+        if ((shape & FILTER_STOCK) != 0)
+        {
+                for (std::size_t i = 0; i < n; ++i) { mask[i] &= static_cast<std::uint8_t>(stock[i] < query.below_stock); }
+        }
+        return compact_selection(mask, n, pos, out);
+}
+
+using FilterKernel = std::size_t (*)(const Query&, const ItemColumns&, std::size_t, std::size_t, std::uint32_t*);
+
+/// @brief Holds the kernels compiled for the common filter shapes, by scan mode and shape: everything, one category, a price range, a
+/// category within a price range, and items running low. The other shapes are rare enough to be interpreted.
+constexpr FilterKernel FILTER_KERNELS[][FILTER_SHAPES] = {
+        {
+                select_branching<find_match<0>>,
+                select_branching<find_match<FILTER_CATEGORY>>,
+                select_branching<find_match<FILTER_PRICE>>,
+                select_branching<find_match<FILTER_CATEGORY | FILTER_PRICE>>,
+                select_branching<find_match<FILTER_STOCK>>,
+                nullptr,
+                nullptr,
+                nullptr,
+        },
+        {
+                select_masked<0>,
+                select_masked<FILTER_CATEGORY>,
+                select_masked<FILTER_PRICE>,
+                select_masked<FILTER_CATEGORY | FILTER_PRICE>,
+                select_masked<FILTER_STOCK>,
+                nullptr,
+                nullptr,
+                nullptr,
+        },
+};
+
+/// @brief Holds the interpreter of each scan mode, for shapes without a kernel.
+constexpr FilterKernel FILTER_INTERPRETERS[] = {select_branching<find_match_interpreted>, select_masked_interpreted};
+
+/// The filter of a query bound to the scan loop for its shape.
+struct QueryFilter
+{
+        Query        query;
+        FilterKernel kernel {select_masked_interpreted};
+
+        /// @brief Picks the kernel for the shape of `query` in scan `mode`, or the interpreter if there is none or `interpret` is set.
+        static auto compile(const Query& query, ScanMode mode = ScanMode::Masked, bool interpret = false)
+        {
+                const auto kernel = FILTER_KERNELS[static_cast<std::size_t>(mode)][filter_shape(query)];
+                return QueryFilter {query, kernel != nullptr && !interpret ? kernel : FILTER_INTERPRETERS[static_cast<std::size_t>(mode)]};
+        }
+
+        /// @brief Checks whether the filter tests items with a kernel compiled for its shape.
+        auto compiled() const
+        {
+                return std::find(std::begin(FILTER_INTERPRETERS), std::end(FILTER_INTERPRETERS), kernel) == std::end(FILTER_INTERPRETERS);
+        }
+
+        /// @brief Calls `fn(pos)` for the position of every item from `pos` up to `end` of `columns` that the filter selects, in order,
+        /// until it returns false. Items are tested `FILTER_BLOCK` at a time.
+        ///
+        /// @returns the position after the last item looked at: `end`, or the one after the item `fn` stopped at.
+        template<typename Fn>
+        auto for_each_match(const ItemColumns& columns, std::size_t pos, std::size_t end, Fn&& fn) const
+        {
+                std::uint32_t selected[FILTER_BLOCK];
+                for (; pos < end; pos = std::min(end, pos + FILTER_BLOCK))
+                {
+                        const auto count = kernel(query, columns, pos, std::min(end, pos + FILTER_BLOCK), selected);
+                        for (std::size_t i = 0; i < count; ++i)
+                        {
+                                if (!fn(std::size_t {selected[i]})) { return std::size_t {selected[i]} + 1; }
+                        }
+                }
+                return end;
+        }
+};
+
+/// @brief Checks whether `a` comes before `b` in the order of `query`. Ties are broken by model code so that every shard and the merge
+/// agree on one order.
+template<typename T>
+auto query_before(const Query& query, const T& a, const T& b)
+{
+        switch (query.order)
+        {
+                case QueryOrder::PriceAsc:
+                        if (a.price != b.price) { return a.price < b.price; }
+                        break;
+                case QueryOrder::PriceDesc:
+                        if (a.price != b.price) { return a.price > b.price; }
+                        break;
+                case QueryOrder::StockAsc:
+                        if (a.nstock != b.nstock) { return a.nstock < b.nstock; }
+                        break;
+                case QueryOrder::StockDesc:
+                        if (a.nstock != b.nstock) { return a.nstock > b.nstock; }
+                        break;
+                case QueryOrder::None: return false;
+        }
+        return a.name < b.name;
+}
+
+/// @brief Reads the query of a `List` request, which only has a category, or of a `Query` request.
+///
+/// @returns std::nullopt if the request is malformed.
+inline auto parse_query(const FrameView& request) -> std::optional<Query>
+{
+        Query       query {};
+        const auto* data = request.payload.data();
+        const auto* end  = data + request.payload.size();
+        if (request.header.type == MessageType::List) { get(data, end, query.category); }
+        else if (!get(data, end, query)) { return {}; }
+
+        return query;
+}
+
+/// @brief Runs `query` against the items of `inventory`, sorting only as far as the limit when there is one.
+///
+/// @returns pointers to the selected items, which are encoded straight from `inventory` rather than copied.
+inline auto run_query(const Inventory& inventory, const Query& query)
+{
+        std::vector<const Item*> result;
+        const auto               filter = QueryFilter::compile(query);
+        filter.for_each_match(inventory.columns, 0, inventory.items.size(), [&](std::size_t pos) {
+                result.push_back(&inventory.items[pos]);
+                return true;
+        });
+
+        const auto limit  = query.limit == 0 ? result.size() : std::min<std::size_t>(query.limit, result.size());
+        const auto before = [&](const Item* a, const Item* b) { return query_before(query, *a, *b); };
+        if (query.order != QueryOrder::None)
+        {
+                std::partial_sort(result.begin(), result.begin() + static_cast<std::ptrdiff_t>(limit), result.end(), before);
+        }
+        result.resize(limit);
+        return result;
+}
+
+/// @brief Estimates totals over the items of `inventory` selected by the filter of `query` from its sample, with error bounds. The order
+/// and limit of the query are ignored. Takes time in proportion to the size of the sample rather than of the inventory.
+inline auto estimate_aggregate(const Inventory& inventory, const Query& query)
+{
+        const auto filter   = QueryFilter::compile(query);
+        const auto estimate = inventory.sample.estimate<4>([&](const ItemColumns& values, auto& rows) {
+                const auto* prices = values.column<ITEM_PRICE>().data();
+                const auto* stock  = values.column<ITEM_NSTOCK>().data();
+                filter.for_each_match(values, 0, rows.size(), [&](std::size_t pos) {
+                        const auto price = static_cast<double>(prices[pos]);
+                        rows[pos]        = {1.0, static_cast<double>(stock[pos]), price * stock[pos], price};
+                        return true;
+                });
+        });
+
+        AggregateResult result;
+        result.count       = estimate.totals[0];
+        result.units       = estimate.totals[1];
+        result.value       = estimate.totals[2];
+        result.price       = estimate.totals[3];
+        result.price_count = estimate.covariance[3][0];
+        result.items       = estimate.records;
+        result.sampled     = estimate.sampled;
+        return result;
+}
+
+/// @brief Prints the estimates of an aggregate with their 95% error bounds.
+inline auto print_aggregate(const AggregateResult& result)
+{
+        const auto print = [](const char* name, const Estimate& estimate) {
+                std::printf("%-24s%16.2f +/- %.2f\n", name, estimate.total, estimate.error());
+        };
+        print("Items", result.count);
+        print("Units in stock", result.units);
+        print("Stock value (GBP)", result.value);
+        print("Average price (GBP)", result.average_price());
+        std::printf("estimated from %" PRIu64 " of %" PRIu64 " items\n", result.sampled, result.items);
+}
+
+/// @brief Merges the results of running `query` on several shards into the result it would have had on one.
+///
+/// Each part is already in query order and holds at most `limit` items, so an ordered merge only looks at the heads of the parts and stops
+/// once it has `limit` items.
+template<typename T>
+auto merge_results(const std::vector<std::vector<T>>& parts, const Query& query)
+{
+        std::vector<T> result;
+        const auto        limit = query.limit == 0 ? SIZE_MAX : std::size_t {query.limit};
+        if (query.order == QueryOrder::None)
+        {
+                for (const auto& part : parts)
+                {
+                        for (auto pitem = part.begin(); pitem != part.end() && result.size() < limit; ++pitem) { result.push_back(*pitem); }
+                }
+                return result;
+        }
+
+        // there are only a handful of shards, so picking the smallest head by a linear scan beats maintaining a heap
+        std::vector<std::size_t> heads(parts.size(), 0);
+        while (result.size() < limit)
+        {
+                auto next = parts.size();
+                for (std::size_t i = 0; i < parts.size(); ++i)
+                {
+                        if (heads[i] == parts[i].size()) { continue; }
+                        if (next == parts.size() || query_before(query, parts[i][heads[i]], parts[next][heads[next]])) { next = i; }
+                }
+                if (next == parts.size()) { break; }
+
+                result.push_back(parts[next][heads[next]++]);
+        }
+        return result;
+}
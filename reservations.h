@@ -0,0 +1,174 @@
+#pragma once
+
+#include "bytes.h"
+#include "inventory.h"
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+constexpr auto RESERVATION_TICK_MS = 10;        // resolution of reservation deadlines
+
+/// Units of an item held for a basket until it checks out.
+struct Reservation
+{
+        Handle handle {0};
+        int    quantity {0};
+};
+
+using ReservationId = TimerId;
+
+/// Stock held for online baskets until they check out or are abandoned.
+///
+/// Reserving holds units of an item for a basket without taking them out of its `nstock`: a reservation only succeeds if the item has
+/// that many units in stock that no other reservation holds, and only checking out takes the units out of stock, as an ordinary update.
+/// Every reservation is a timer on a `TimerWheel` that ticks every `RESERVATION_TICK_MS`, so reserving, checking out and releasing are
+/// O(1) with millions outstanding, and `expire` lets go of all the reservations that have run out in one pass. The id of a reservation
+/// is the id of its timer.
+///
+/// Reservations are kept in memory only, though a handoff passes them on to the new server with the ids their baskets hold (see `save`).
+/// As they never change the stock, losing them, to a restart or the item moving to another shard, gives their units back as if the
+/// baskets had been abandoned; a basket that then checks out has to reserve again.
+struct Reservations
+{
+        using Clock = std::chrono::steady_clock;
+
+        Inventory&                      inventory;
+        TimerWheel<Reservation>         wheel {tick_of(Clock::now())};
+        std::unordered_map<Handle, int> held;        // units held by reservations, by item
+
+        explicit Reservations(Inventory& inventory) : inventory {inventory} {}
+
+        /// @brief Returns the tick of the wheel that `time` falls in.
+        static auto tick_of(Clock::time_point time) -> std::uint64_t
+        {
+                const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+                return static_cast<std::uint64_t>(ms) / RESERVATION_TICK_MS;
+        }
+
+        /// @brief Returns the no. of units of the item in stock that no reservation holds.
+        auto available(Inventory::ItemPtr pitem) const
+        {
+                const auto pos = held.find(inventory.handle_of(pitem));
+                return pitem->nstock - (pos == held.end() ? 0 : pos->second);
+        }
+
+        /// @brief Holds `quantity` units of the item for a basket until `ttl` from now.
+        ///
+        /// @returns std::nullopt if fewer units are available.
+        auto reserve(Inventory::ItemPtr pitem, int quantity, std::chrono::milliseconds ttl) -> std::optional<ReservationId>
+        {
+                if (quantity <= 0 || available(pitem) < quantity) { return {}; }
+
+                const auto handle = inventory.handle_of(pitem);
+                held[handle] += quantity;
+                return wheel.arm(tick_of(Clock::now() + ttl), {handle, quantity});
+        }
+
+        /// @brief Returns the reservation with `id` if it is still held on the given item.
+        auto find(ReservationId id, Inventory::ItemPtr pitem) -> const Reservation*
+        {
+                const auto* reservation = wheel.find(id);
+                return reservation != nullptr && reservation->handle == inventory.handle_of(pitem) ? reservation : nullptr;
+        }
+
+        /// @brief Takes the units of a reservation out of stock, as its basket has checked out. Units sold by other means since the
+        /// reservation was made may leave fewer in stock, in which case the stock runs out.
+        ///
+        /// The stock taken has been sold, so by default the change is synced to the journal before returning.
+        ///
+        /// @returns std::nullopt if the reservation has expired or been released, or is not on the given item. Otherwise whether the
+        /// change could be journalled as `durability` asks; the stock is taken either way.
+        auto commit(ReservationId id, Inventory::ItemPtr pitem, Durability durability = Durability::Sync) -> std::optional<bool>
+        {
+                if (find(id, pitem) == nullptr) { return {}; }
+
+                const auto reservation = *wheel.cancel(id);
+                let_go(reservation);
+
+                auto item = *pitem;
+                item.nstock -= std::min(reservation.quantity, std::max(item.nstock, 0));
+                return inventory.update(pitem, item, durability);
+        }
+
+        /// @brief Gives back the units of a reservation before it expires.
+        ///
+        /// @returns false if the reservation has expired or been released, or is not on the given item.
+        auto release(ReservationId id, Inventory::ItemPtr pitem)
+        {
+                if (find(id, pitem) == nullptr) { return false; }
+
+                let_go(*wheel.cancel(id));
+                return true;
+        }
+
+        /// @brief Gives back the units of every reservation that has run out by `now`. Call it regularly.
+        ///
+        /// @returns the no. of reservations that expired.
+        auto expire(Clock::time_point now = Clock::now()) { return wheel.advance(tick_of(now), [&](const Reservation& r) { let_go(r); }); }
+
+        /// @brief Returns the no. of reservations held.
+        auto size() const { return wheel.size(); }
+
+        /// @brief Appends the reservations held to `out`, each with its id and the time it has left, for a server taking over.
+        auto save(std::string& out) const
+        {
+                const auto now = tick_of(Clock::now());
+                put(out, wheel.next_generation());
+                put(out, std::uint64_t {wheel.size()});
+                wheel.for_each([&](ReservationId id, std::uint64_t expires, const Reservation& reservation) {
+                        put(out, id);
+                        put(out, reservation.handle);
+                        put(out, std::int32_t {reservation.quantity});
+                        put(out, static_cast<std::int64_t>((expires > now ? expires - now : 0) * RESERVATION_TICK_MS));
+                });
+        }
+
+        /// @brief Restores the reservations written by `save` from `data` and advances it, keeping their ids so that their baskets can
+        /// still check out. Call it before anything is reserved.
+        ///
+        /// @returns false if `data` is truncated or corrupt, or something has been reserved already.
+        auto load(const char*& data, const char* end)
+        {
+                std::uint32_t generation {};
+                std::uint64_t count {};
+                if (wheel.size() != 0 || !get(data, end, generation) || !get(data, end, count)) { return false; }
+
+                wheel.carry_on(generation);
+                const auto now = tick_of(Clock::now());
+                for (std::uint64_t i = 0; i < count; ++i)
+                {
+                        ReservationId id {};
+                        Reservation   reservation;
+                        std::int32_t  quantity {};
+                        std::int64_t  remaining_ms {};
+                        if (!get(data, end, id) || !get(data, end, reservation.handle) || !get(data, end, quantity) ||
+                            !get(data, end, remaining_ms) || quantity <= 0 || remaining_ms < 0)
+                        {
+                                return false;
+                        }
+
+                        reservation.quantity = quantity;
+                        const auto expires   = now + static_cast<std::uint64_t>(remaining_ms) / RESERVATION_TICK_MS;
+                        if (!wheel.restore(id, expires, reservation)) { return false; }
+
+                        held[reservation.handle] += quantity;
+                }
+                return true;
+        }
+
+private:
+        auto let_go(const Reservation& reservation) -> void
+        {
+                const auto pos = held.find(reservation.handle);
+                if (pos == held.end()) { return; }
+
+                pos->second -= reservation.quantity;
+                if (pos->second <= 0) { held.erase(pos); }
+        }
+};
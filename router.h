@@ -0,0 +1,479 @@
+#pragma once
+
+#include "net.h"
+#include "protocol.h"
+#include "query.h"
+#include "server.h"
+#include "wire.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <optional>
+#include <poll.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+constexpr auto ROUTER_VNODES      = std::size_t {64};           // points each shard gets on the hash ring
+constexpr auto MIGRATION_BATCH    = std::uint32_t {256};        // items moved per step while rebalancing
+constexpr auto SCATTER_TIMEOUT_MS = 5000;                       // longest wait for the slowest shard of a query
+constexpr auto SHARD_TIMEOUT_MS   = SCATTER_TIMEOUT_MS;         // longest wait for a shard to accept a connection, take a request or answer
+
+/// Consistent hash ring mapping shard hashes of model codes to shards.
+///
+/// Each shard is placed at `ROUTER_VNODES` pseudo-random points and owns the hashes from the point before up to each of its points. With
+/// many points per shard the load evens out, and adding a shard only takes over small arcs from every other shard.
+struct HashRing
+{
+        std::vector<std::pair<std::uint64_t, std::size_t>> points;        // (hash, shard index), sorted by hash
+
+        /// @brief Places the shard with the given index on the ring, deriving its points from `name`.
+        auto add(std::size_t shard, const std::string& name)
+        {
+                for (std::size_t i = 0; i < ROUTER_VNODES; ++i) { points.emplace_back(shard_hash(name + "#" + std::to_string(i)), shard); }
+                std::sort(points.begin(), points.end());
+        }
+
+        /// @brief Returns the index of the shard owning `hash`: the shard of the first point at or after it, wrapping around.
+        auto owner(std::uint64_t hash) const
+        {
+                auto point = std::lower_bound(points.begin(), points.end(), std::pair {hash, std::size_t {0}});
+                if (point == points.end()) { point = points.begin(); }
+                return point->second;
+        }
+
+        auto empty() const { return points.empty(); }
+};
+
+/// Routes inventory requests to the shard server owning each model code, and rebalances when a shard is added.
+///
+/// While rebalancing, an item may still be on the shard that owned it before the new shard joined. Reads fall back to that shard,
+/// removes go to both, and `migrate_step` moves the remaining items over in small batches between requests.
+struct RouterService
+{
+        /// A shard server and the connection the router forwards to it on.
+        struct Shard
+        {
+                Address                   address;
+                std::optional<Connection> conn;
+        };
+
+        /// An arc of the ring whose items have to move from shard `from` to their new owner.
+        struct Migration
+        {
+                std::size_t   from;
+                std::uint64_t lo;
+                std::uint64_t hi;
+        };
+
+        std::vector<Shard>    shards;
+        HashRing              ring;
+        HashRing              previous;        // ring before the last shard was added, used while `migrations` is not empty
+        std::deque<Migration> migrations;
+        std::uint64_t         migrated {0};
+
+        /// @brief Adds a shard server and, if `rebalance` is set, queues the moves that rebalance items onto it.
+        auto add_shard(const Address& address, bool rebalance = true)
+        {
+                previous         = ring;
+                const auto shard = shards.size();
+                shards.push_back({address, {}});
+                ring.add(shard, address.to_string());
+                if (!rebalance || previous.empty()) { return; }
+
+                // every arc ending at one of the new shard's points used to belong to the old owner of that point
+                for (std::size_t k = 0; k < ring.points.size(); ++k)
+                {
+                        const auto [hash, owner] = ring.points[k];
+                        if (owner != shard) { continue; }
+
+                        const auto from = previous.owner(hash);
+                        const auto pred = ring.points[k == 0 ? ring.points.size() - 1 : k - 1].first;
+                        if (k == 0 && pred != UINT64_MAX) { migrations.push_back({from, pred + 1, UINT64_MAX}); }
+                        if (k == 0) { migrations.push_back({from, 0, hash}); }
+                        else if (pred != hash) { migrations.push_back({from, pred + 1, hash}); }
+                }
+                std::printf("Added shard %s, rebalancing %zu ranges\n", address.to_string().c_str(), migrations.size());
+        }
+
+        auto migrating() const { return !migrations.empty(); }
+
+        /// @brief Moves up to `MIGRATION_BATCH` items to their new shard.
+        ///
+        /// @returns true while there is more to move.
+        auto migrate_step() -> bool
+        {
+                if (migrations.empty()) { return false; }
+
+                auto&      task  = migrations.front();
+                const auto scan  = call(task.from, MessageType::ScanHashRange, as_bytes(HashRange {task.lo, task.hi, MIGRATION_BATCH, 0}));
+                const auto items = scan && scan->header.status == Status::Ok ? ItemsView::parse(scan->payload) : std::nullopt;
+                if (!items)
+                {
+                        std::printf("Rebalancing stalled, shard %s is not answering\n", shards[task.from].address.to_string().c_str());
+                        return false;
+                }
+
+                for (const auto item : *items)
+                {
+                        // the new owner may already have a newer copy written through the router since the shard was added
+                        const auto to     = ring.owner(shard_hash(item.name));
+                        const auto exists = call(to, MessageType::Get, item.name);
+                        if (!exists) { return true; }
+                        if (exists->header.status == Status::NotFound)
+                        {
+                                const auto put = call(to, MessageType::Put, item.record);
+                                if (!put || put->header.status != Status::Ok) { return true; }
+                        }
+
+                        call(task.from, MessageType::Remove, item.name);
+                        ++migrated;
+                }
+
+                if (items->size() < MIGRATION_BATCH) { migrations.pop_front(); }
+                if (migrations.empty()) { std::printf("Rebalancing finished, moved %" PRIu64 " items\n", migrated); }
+                return !migrations.empty();
+        }
+
+        /// @brief Handles one request, appending the response frames to `out`.
+        ///
+        /// @returns the job that forwards an import a slice at a time, or an empty one if the response is complete.
+        auto handle(const FrameView& request, std::string& out) -> FrameServer::Job
+        {
+                const auto type = request.header.type;
+                const auto id   = request.header.request_id;
+                if (type == MessageType::List || type == MessageType::Query)
+                {
+                        if (!select(request, out)) { encode_frame(out, type, Status::Error, id, {}); }
+                        return {};
+                }
+                if (type == MessageType::Import)
+                {
+                        if (!shards.empty() && ItemsView::parse(request.payload)) { return import(type, id, std::string {request.payload}); }
+
+                        encode_frame(out, type, Status::Error, id, {});
+                        return {};
+                }
+
+                std::string payload;
+                const auto  status = dispatch(request, payload);
+                encode_frame(out, type, status, id, payload);
+                return {};
+        }
+
+private:
+        template<typename T>
+        static auto as_bytes(const T& value) -> std::string
+        {
+                std::string bytes;
+                put(bytes, value);
+                return bytes;
+        }
+
+        /// @brief Forwards a request to a shard, connecting first if needed.
+        ///
+        /// @returns std::nullopt if the shard could not be reached or did not answer within `SHARD_TIMEOUT_MS`, after which it is
+        /// connected to again on the next call.
+        auto call(std::size_t shard, MessageType type, std::string_view payload) -> std::optional<Frame>
+        {
+                auto& conn = shards[shard].conn;
+                if (!conn) { conn = Connection::open(shards[shard].address, SHARD_TIMEOUT_MS); }
+                if (!conn) { return {}; }
+
+                auto response = conn->call(type, payload);
+                if (!response) { conn.reset(); }
+                return response;
+        }
+
+        /// @brief Starts a job sending the items in `records`, which have been checked already, to the shards owning them:
+        /// `MIGRATION_BATCH` items at a time, as an `Import` to each shard with items in the batch. Fails at the first shard that does not
+        /// take its items, leaving the ones sent before in place.
+        auto import(MessageType type, std::uint32_t request_id, std::string records) -> FrameServer::Job
+        {
+                return [this, type, request_id, records = std::move(records), pos = std::size_t {0}, count = std::uint64_t {0}](
+                               std::string& out, FrameServer::Clock::time_point until) mutable {
+                        do {
+                                std::vector<std::string> batches(shards.size());
+                                for (std::uint32_t n = 0; n < MIGRATION_BATCH && pos < records.size(); ++n)
+                                {
+                                        const auto item = *ItemView::parse(std::string_view {records}.substr(pos));
+                                        encode_item(batches[ring.owner(shard_hash(item.name))], item);
+                                        pos += item.record.size();
+                                }
+
+                                for (std::size_t shard = 0; shard < shards.size(); ++shard)
+                                {
+                                        if (batches[shard].empty()) { continue; }
+
+                                        std::uint64_t imported {0};
+                                        const auto    response = call(shard, MessageType::Import, batches[shard]);
+                                        const auto*   data     = response ? response->payload.data() : nullptr;
+                                        const auto    ok       = response && response->header.status == Status::Ok;
+                                        if (!ok || !::get(data, data + response->payload.size(), imported))
+                                        {
+                                                encode_frame(out, type, Status::Error, request_id, {});
+                                                return true;
+                                        }
+                                        count += imported;
+                                }
+                        } while (pos < records.size() && FrameServer::Clock::now() < until);
+                        if (pos < records.size()) { return false; }
+
+                        std::string payload;
+                        ::put(payload, count);
+                        encode_frame(out, type, Status::Ok, request_id, payload);
+                        return true;
+                };
+        }
+
+        /// @brief Runs a `List` or `Query` request on every shard and appends the merged result to `out`. The shards' records are
+        /// compared and copied to `out` where they lie in the receive buffers.
+        ///
+        /// @returns false if the request is malformed or a shard failed.
+        auto select(const FrameView& request, std::string& out) -> bool
+        {
+                const auto query = parse_query(request);
+                if (!query) { return false; }
+
+                // an unordered query can stop as soon as the shards have returned enough items between them
+                const auto payloads = scatter(request.header.type, request.payload, query->order == QueryOrder::None ? query->limit : 0);
+                if (!payloads) { return false; }
+
+                std::vector<std::vector<ItemView>> parts;
+                for (const auto& payload : *payloads)
+                {
+                        const auto items = ItemsView::parse(payload);
+                        if (!items) { return false; }
+
+                        parts.emplace_back(items->begin(), items->end());
+                }
+
+                if (migrating()) { drop_stale(parts); }
+                encode_result(out, request.header.type, request.header.request_id, merge_results(parts, *query));
+                return true;
+        }
+
+        /// @brief Sends a request to every shard at once and collects the streamed results as they arrive, so that a query takes as
+        /// long as its slowest shard rather than the sum of all of them.
+        ///
+        /// Stops early, dropping the connections with results still in flight, once `enough` items have arrived (0 for no limit).
+        ///
+        /// @returns the joined result payload of each shard, or std::nullopt if a shard failed or did not answer within
+        /// `SCATTER_TIMEOUT_MS`.
+        auto scatter(MessageType type, std::string_view payload, std::size_t enough) -> std::optional<std::vector<std::string>>
+        {
+                std::vector<std::string>   parts(shards.size());
+                std::vector<std::string>   buffers(shards.size());
+                std::vector<std::uint32_t> ids(shards.size());
+                std::vector<bool>          done(shards.size(), false);
+
+                const auto fail = [&] {
+                        for (std::size_t shard = 0; shard < shards.size(); ++shard)
+                        {
+                                if (!done[shard]) { shards[shard].conn.reset(); }
+                        }
+                        return std::nullopt;
+                };
+
+                for (std::size_t shard = 0; shard < shards.size(); ++shard)
+                {
+                        auto& conn = shards[shard].conn;
+                        if (!conn) { conn = Connection::open(shards[shard].address, SHARD_TIMEOUT_MS); }
+                        if (!conn) { return fail(); }
+
+                        std::string request;
+                        ids[shard] = conn->next_id++;
+                        encode_frame(request, type, Status::Ok, ids[shard], payload);
+                        if (!send_all(conn->sock.fd, request.data(), request.size())) { return fail(); }
+                }
+
+                std::size_t              received {0};
+                std::size_t              remaining {shards.size()};
+                std::vector<pollfd>      fds;
+                std::vector<std::size_t> polled;
+                const auto               deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds {SCATTER_TIMEOUT_MS};
+                while (remaining > 0)
+                {
+                        fds.clear();
+                        polled.clear();
+                        for (std::size_t shard = 0; shard < shards.size(); ++shard)
+                        {
+                                if (done[shard]) { continue; }
+
+                                fds.push_back({shards[shard].conn->sock.fd, POLLIN, 0});
+                                polled.push_back(shard);
+                        }
+
+                        const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                        const auto n    = poll(fds.data(), fds.size(), static_cast<int>(std::max<std::int64_t>(wait.count(), 0)));
+                        if (n < 0 && errno == EINTR) { continue; }
+                        if (n <= 0) { return fail(); }
+
+                        for (std::size_t i = 0; i < fds.size(); ++i)
+                        {
+                                if (fds[i].revents == 0) { continue; }
+
+                                const auto shard = polled[i];
+                                auto&      in    = buffers[shard];
+                                char       buf[1U << 16U];
+                                const auto len   = recv(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+                                if (len < 0 && (errno == EAGAIN || errno == EINTR)) { continue; }
+                                if (len <= 0) { return fail(); }
+                                in.append(buf, static_cast<std::size_t>(len));
+
+                                std::size_t pos {0};
+                                while (!done[shard])
+                                {
+                                        const auto frame = decode_frame(in, pos);
+                                        if (!frame) { break; }
+
+                                        const auto items = ItemsView::parse(frame->payload);
+                                        const auto last  = frame->header.status != Status::Partial;
+                                        if (frame->header.request_id != ids[shard] || !items || (last && frame->header.status != Status::Ok))
+                                        {
+                                                return fail();
+                                        }
+
+                                        parts[shard] += frame->payload;
+                                        received += items->size();
+                                        done[shard] = last;
+                                        remaining -= last ? 1 : 0;
+                                }
+                                in.erase(0, pos);
+                        }
+
+                        if (enough > 0 && received >= enough)
+                        {
+                                fail();
+                                break;
+                        }
+                }
+                return parts;
+        }
+
+        /// @brief While rebalancing an item can be on two shards. Drops the copies on the old shard when the new one has the item too.
+        auto drop_stale(std::vector<std::vector<ItemView>>& parts) const -> void
+        {
+                std::unordered_set<std::string_view> current;
+                for (std::size_t shard = 0; shard < parts.size(); ++shard)
+                {
+                        for (const auto& item : parts[shard])
+                        {
+                                if (ring.owner(shard_hash(item.name)) == shard) { current.insert(item.name); }
+                        }
+                }
+
+                for (std::size_t shard = 0; shard < parts.size(); ++shard)
+                {
+                        auto& part = parts[shard];
+                        part.erase(std::remove_if(part.begin(), part.end(),
+                                                  [&](const ItemView& item) { return ring.owner(shard_hash(item.name)) != shard && current.count(item.name) > 0; }),
+                                   part.end());
+                }
+        }
+
+        auto dispatch(const FrameView& request, std::string& payload) -> Status
+        {
+                if (shards.empty() && request.header.type != MessageType::AddShard) { return Status::Error; }
+
+                switch (request.header.type)
+                {
+                        case MessageType::Get:
+                        case MessageType::Put:
+                        case MessageType::Remove:
+                        case MessageType::Reserve:
+                        case MessageType::Commit:
+                        case MessageType::Release:
+                        case MessageType::SchedulePrice:
+                        {
+                                const auto name = model_code_of(request);
+                                if (!name) { return Status::Error; }
+
+                                const auto hash     = shard_hash(*name);
+                                const auto owner    = ring.owner(hash);
+                                auto       response = call(owner, request.header.type, request.payload);
+                                if (!response) { return Status::Error; }
+
+                                // the item may not have been moved to its new shard yet; a removal goes to both, and anything else
+                                // to the old shard only if the new one does not have it, so that stock is not reserved twice
+                                const auto old_owner = migrating() ? previous.owner(hash) : owner;
+                                const auto type      = request.header.type;
+                                const auto fallback  = type == MessageType::Remove || response->header.status == Status::NotFound;
+                                if (old_owner != owner && type != MessageType::Put && fallback)
+                                {
+                                        auto old_response = call(old_owner, request.header.type, request.payload);
+                                        if (old_response && response->header.status == Status::NotFound) { response = std::move(old_response); }
+                                }
+
+                                payload = std::move(response->payload);
+                                return response->header.status;
+                        }
+                        case MessageType::Scan:
+                        {
+                                ScanRequest scan {};
+                                const auto* data = request.payload.data();
+                                if (!::get(data, data + request.payload.size(), scan)) { return Status::Error; }
+
+                                // the upper half of the cursor picks the shard, the lower half is that shard's own cursor; items that move
+                                // between shards while a scan is running may be returned twice or not at all
+                                const auto shard = static_cast<std::size_t>(scan.after >> 32U);
+                                ScanHeader header {scan.after, 0, 1};
+                                if (shard >= shards.size())
+                                {
+                                        ::put(payload, header);
+                                        return Status::Ok;
+                                }
+
+                                scan.after          = scan.after & UINT32_MAX;
+                                const auto response = call(shard, MessageType::Scan, as_bytes(scan));
+                                const auto* result  = response ? response->payload.data() : nullptr;
+                                if (!response || response->header.status != Status::Ok || !::get(result, result + response->payload.size(), header))
+                                {
+                                        return Status::Error;
+                                }
+
+                                header.next = (static_cast<std::uint64_t>(shard) << 32U) | header.next;
+                                if (header.done != 0 && shard + 1 < shards.size())
+                                {
+                                        header.next = static_cast<std::uint64_t>(shard + 1) << 32U;
+                                        header.done = 0;
+                                }
+                                ::put(payload, header);
+                                payload.append(response->payload, sizeof(header));
+                                return Status::Ok;
+                        }
+                        case MessageType::Aggregate:
+                        {
+                                // items moving between shards during a rebalance may be counted on both or on neither
+                                AggregateResult total;
+                                for (std::size_t shard = 0; shard < shards.size(); ++shard)
+                                {
+                                        AggregateResult part;
+                                        const auto      response = call(shard, MessageType::Aggregate, request.payload);
+                                        const auto*     data     = response ? response->payload.data() : nullptr;
+                                        if (!data || response->header.status != Status::Ok || !::get(data, data + response->payload.size(), part))
+                                        {
+                                                return Status::Error;
+                                        }
+                                        total += part;
+                                }
+                                ::put(payload, total);
+                                return Status::Ok;
+                        }
+                        case MessageType::AddShard:
+                        {
+                                const auto address = Address::parse(request.payload);
+                                if (!address || migrating()) { return Status::Error; }
+
+                                add_shard(*address);
+                                return Status::Ok;
+                        }
+                        default: return Status::Unsupported;
+                }
+        }
+};
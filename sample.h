@@ -0,0 +1,249 @@
+#pragma once
+
+#include "bytes.h"
+#include "schema.h"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// A total over a set of records, estimated from a sample of them, with the variance of the estimate. Estimates over disjoint sets of
+/// records sampled independently, such as strata or shards, add up, and so do their variances.
+struct Estimate
+{
+        double total {0};
+        double variance {0};
+
+        /// @brief Returns the half-width of the 95% confidence interval around `total`.
+        auto error() const { return 1.96 * std::sqrt(variance); }
+
+        auto operator+=(const Estimate& other) -> Estimate&
+        {
+                total += other.total;
+                variance += other.variance;
+                return *this;
+        }
+};
+
+/// Estimates of the totals of `N` variables over a set of records, with the covariances of the estimates.
+template<std::size_t N>
+struct SampleEstimate
+{
+        std::array<Estimate, N>              totals {};
+        std::array<std::array<double, N>, N> covariance {};        // covariance[i][i] is totals[i].variance
+        std::size_t                          records {0};          // records the totals are over
+        std::size_t                          sampled {0};          // of which were in the sample
+};
+
+/// A uniform random sample of at most `CAPACITY` records from every stratum of a set of records, kept up to date as records are added,
+/// changed and removed, so that totals over millions of records can be estimated from a few thousand.
+///
+/// `Strata` is a type with a static `COUNT` and a static function `of(record)` returning the stratum of a record, below `COUNT`. Sampling
+/// each stratum separately keeps small strata from being missed and removes the variance between strata from the estimates. The sample
+/// holds the fixed-size fields of the sampled records in `Columns`, updated along with the records, so estimating reads nothing else.
+///
+/// Each stratum is a reservoir sample kept uniform under removals by random pairing (Gemulla, Lehner and Haas, 2006): a removal leaves a
+/// hole in the sample if the record was in it, and the next additions fill the holes with the odds of the removals they pair with.
+template<typename Record, const auto& SCHEMA, typename Strata, std::size_t CAPACITY>
+struct StratifiedSample
+{
+        using Id = std::uint32_t;
+
+        /// The records of one stratum and the sample of them.
+        struct Stratum
+        {
+                std::size_t     population {0};              // records in the stratum
+                std::vector<Id> ids;                         // ids[i] is the record sampled at position i of `values`
+                Columns<SCHEMA> values;
+                std::size_t     sampled_removals {0};        // removals of sampled records not yet paired with an addition
+                std::size_t     other_removals {0};          // removals of other records not yet paired with an addition
+        };
+
+        std::array<Stratum, Strata::COUNT> strata {};
+
+        /// @brief Counts a record added under `id` and samples it with the odds that keep its stratum's sample uniform.
+        auto insert(Id id, const Record& record)
+        {
+                const auto s = Strata::of(record);
+                if (s >= strata.size()) { return; }
+
+                auto& stratum = strata[s];
+                ++stratum.population;
+                const auto unpaired = stratum.sampled_removals + stratum.other_removals;
+                if (unpaired == 0)
+                {
+                        if (stratum.ids.size() < CAPACITY) { add(s, id, record); }
+                        else if (const auto victim = below(stratum.population); victim < CAPACITY) { replace(s, victim, id, record); }
+                }
+                else if (below(unpaired) < stratum.sampled_removals)
+                {
+                        --stratum.sampled_removals;
+                        add(s, id, record);
+                }
+                else { --stratum.other_removals; }
+        }
+
+        /// @brief Counts the removal of the record with `id`, dropping it from the sample if it was in it.
+        auto erase(Id id, const Record& record)
+        {
+                const auto s = Strata::of(record);
+                if (s >= strata.size()) { return; }
+
+                auto&      stratum = strata[s];
+                const auto pslot   = slots.find(id);
+                --stratum.population;
+                if (pslot == slots.end())
+                {
+                        ++stratum.other_removals;
+                        return;
+                }
+
+                const auto pos = pslot->second;
+                slots.erase(pslot);
+                stratum.values.swap_erase(pos);
+                stratum.ids[pos] = stratum.ids.back();
+                stratum.ids.pop_back();
+                if (pos < stratum.ids.size()) { slots[stratum.ids[pos]] = pos; }
+                ++stratum.sampled_removals;
+        }
+
+        /// @brief Follows a change to the record with `id`, which moves it to another stratum if its stratum changes.
+        auto update(Id id, const Record& old_record, const Record& new_record)
+        {
+                if (Strata::of(old_record) != Strata::of(new_record))
+                {
+                        erase(id, old_record);
+                        insert(id, new_record);
+                }
+                else if (const auto pslot = slots.find(id); pslot != slots.end())
+                {
+                        strata[Strata::of(new_record)].values.assign(pslot->second, new_record);
+                }
+        }
+
+        /// @brief Estimates the totals of `N` variables over all records, stratum by stratum.
+        ///
+        /// `fn(values, rows)` is called with the sampled fields of each stratum that has any and sets `rows[i]` to the variables of the
+        /// record at position `i`, or leaves them 0 for records that do not count. Strata whose sample has been emptied by removals and not
+        /// refilled yet are left out.
+        template<std::size_t N, typename Fn>
+        auto estimate(Fn&& fn) const
+        {
+                SampleEstimate<N>                  result;
+                std::vector<std::array<double, N>> rows;
+                for (const auto& stratum : strata)
+                {
+                        const auto n = stratum.ids.size();
+                        result.records += stratum.population;
+                        result.sampled += n;
+                        if (n == 0) { continue; }
+
+                        rows.assign(n, {});
+                        fn(stratum.values, rows);
+
+                        std::array<double, N>                sums {};
+                        std::array<std::array<double, N>, N> products {};
+                        for (const auto& row : rows)
+                        {
+                                for (std::size_t i = 0; i < N; ++i)
+                                {
+                                        sums[i] += row[i];
+                                        for (std::size_t j = 0; j <= i; ++j) { products[i][j] += row[i] * row[j]; }
+                                }
+                        }
+
+                        // expanding the sample means to the stratum, and their covariances with the finite population correction, which
+                        // makes strata sampled in full exact
+                        const auto size   = static_cast<double>(stratum.population);
+                        const auto count  = static_cast<double>(n);
+                        const auto expand = n < 2 ? 0.0 : size * size * (1.0 - count / size) / count / (count - 1.0);
+                        for (std::size_t i = 0; i < N; ++i)
+                        {
+                                result.totals[i].total += size * sums[i] / count;
+                                for (std::size_t j = 0; j <= i; ++j)
+                                {
+                                        const auto covariance = expand * (products[i][j] - sums[i] * sums[j] / count);
+                                        result.covariance[i][j] += covariance;
+                                        if (j != i) { result.covariance[j][i] += covariance; }
+                                }
+                        }
+                }
+                for (std::size_t i = 0; i < N; ++i) { result.totals[i].variance = result.covariance[i][i]; }
+                return result;
+        }
+
+        /// @brief Appends the state of the sample to `out`: the counters of every stratum and the ids of the records it samples. The
+        /// sampled fields are not saved, as they are those of the records.
+        auto save(std::string& out) const
+        {
+                for (const auto& stratum : strata)
+                {
+                        put(out, std::uint64_t {stratum.population});
+                        put(out, std::uint64_t {stratum.sampled_removals});
+                        put(out, std::uint64_t {stratum.other_removals});
+                        put(out, std::uint64_t {stratum.ids.size()});
+                        out.append(reinterpret_cast<const char*>(stratum.ids.data()), stratum.ids.size() * sizeof(Id));
+                        out.append(stratum.ids.size() % 2 * sizeof(Id), '\0');        // keeps what follows 8-byte aligned
+                }
+        }
+
+        /// @brief Restores the state written by `save` from `data` and advances it, taking the sampled fields from the records that
+        /// `record_of(id)` returns.
+        ///
+        /// @returns false if `data` is truncated, or names a record `record_of` does not know and returns nullptr for.
+        template<typename RecordOf>
+        auto load(const char*& data, const char* end, RecordOf&& record_of)
+        {
+                *this = {};
+                for (std::size_t s = 0; s < strata.size(); ++s)
+                {
+                        auto&         stratum = strata[s];
+                        std::uint64_t counters[4] {};
+                        if (!get(data, end, counters) || counters[3] > CAPACITY) { return false; }
+
+                        stratum.population       = counters[0];
+                        stratum.sampled_removals = counters[1];
+                        stratum.other_removals   = counters[2];
+                        for (std::uint64_t i = 0; i < counters[3]; ++i)
+                        {
+                                Id         id {};
+                                const auto record = get(data, end, id) ? record_of(id) : nullptr;
+                                if (record == nullptr) { return false; }
+
+                                add(s, id, *record);
+                        }
+                        std::uint32_t padding {};
+                        if (counters[3] % 2 != 0 && !get(data, end, padding)) { return false; }
+                }
+                return true;
+        }
+
+private:
+        std::unordered_map<Id, std::size_t> slots;                    // position of every sampled record in its stratum's sample
+        std::mt19937_64                     random {0x5A3D1EU};        // fixed seed, as the records do not depend on it
+
+        /// @brief Returns a random number below `n`.
+        auto below(std::size_t n) { return std::uniform_int_distribution<std::size_t> {0, n - 1}(random); }
+
+        auto add(std::size_t s, Id id, const Record& record) -> void
+        {
+                auto& stratum = strata[s];
+                slots[id]     = stratum.ids.size();
+                stratum.ids.push_back(id);
+                stratum.values.push_back(record);
+        }
+
+        auto replace(std::size_t s, std::size_t pos, Id id, const Record& record) -> void
+        {
+                auto& stratum = strata[s];
+                slots.erase(stratum.ids[pos]);
+                slots[id]        = pos;
+                stratum.ids[pos] = id;
+                stratum.values.assign(pos, record);
+        }
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Compile-time description of a record type, from which its columnar storage, encodings, listing and input prompts are generated.
+///
+/// A schema is a tuple of `Field`s, one per member of the record. A field knows the member's type and reaches it through `of`, a generic
+/// accessor that works on any struct with the same member names, so one schema serves a record and its views alike. Code generated from a
+/// schema is expanded field by field at compile time and compiles to what it would be if written out by hand.
+
+/// Describes one member of a record.
+template<typename T, typename Access>
+struct Field
+{
+        using type = T;
+
+        std::string_view label;         // column heading in listings
+        std::string_view prompt;        // asked when the user enters a record
+        int              width;         // characters the field takes in a listing
+        bool             delta;         // journalled as the change from the previous value, for counters
+        Access           of;            // `of(record)` returns a reference to the member
+};
+
+/// @brief Makes the description of a member of type `T`.
+template<typename T, typename Access>
+constexpr auto field(std::string_view label, std::string_view prompt, int width, Access of, bool delta = false)
+{
+        return Field<T, Access> {label, prompt, width, delta, of};
+}
+
+/// @brief Checks whether a field of type `T` has a fixed size. Those are kept in columns and in the fixed part of encoded records; strings
+/// stay with the records and follow the fixed part.
+template<typename T>
+constexpr auto is_fixed_field = !std::is_same_v<T, std::string>;
+
+/// @brief Returns the type of a field description.
+template<typename F>
+using field_t = typename std::decay_t<F>::type;
+
+template<typename Schema, typename Fn, std::size_t... I>
+constexpr auto for_each_field(const Schema& schema, Fn&& fn, std::index_sequence<I...>)
+{
+        (fn(std::get<I>(schema), std::integral_constant<std::size_t, I> {}), ...);
+}
+
+/// @brief Calls `fn(field, index)` for every field of `schema` in order. `index` is a `std::integral_constant`, so it can pick a column.
+template<typename Schema, typename Fn>
+constexpr auto for_each_field(const Schema& schema, Fn&& fn)
+{
+        for_each_field(schema, fn, std::make_index_sequence<std::tuple_size_v<Schema>> {});
+}
+
+/// @brief Calls `fn(field, index)` for every field of `schema` in the order they are encoded: fixed-size fields first, then strings.
+template<typename Schema, typename Fn>
+constexpr auto for_each_encoded_field(const Schema& schema, Fn&& fn)
+{
+        for_each_field(schema, [&](const auto& field, auto index) {
+                if constexpr (is_fixed_field<field_t<decltype(field)>>) { fn(field, index); }
+        });
+        for_each_field(schema, [&](const auto& field, auto index) {
+                if constexpr (!is_fixed_field<field_t<decltype(field)>>) { fn(field, index); }
+        });
+}
+
+/// Stands in for the column of a field without a fixed size, which is only kept in the records.
+struct NoColumn
+{
+};
+
+template<typename... Fields>
+auto columns_of(const std::tuple<Fields...>&)
+        -> std::tuple<std::conditional_t<is_fixed_field<typename Fields::type>, std::vector<typename Fields::type>, NoColumn>...>;
+
+/// The fixed-size fields of a sequence of records stored column by column, so that a scan testing one or two fields reads only those.
+///
+/// Position `i` of every column belongs to the `i`th record; the owner keeps them in step with its records.
+template<const auto& SCHEMA>
+struct Columns
+{
+        decltype(columns_of(SCHEMA)) columns;
+
+        /// @brief Returns the column of the field at `I` in the schema.
+        template<std::size_t I>
+        auto column() const -> const auto&
+        {
+                return std::get<I>(columns);
+        }
+
+        auto reserve(std::size_t n)
+        {
+                each([&](auto& column, const auto&) { column.reserve(n); });
+        }
+
+        template<typename Record>
+        auto push_back(const Record& record)
+        {
+                each([&](auto& column, const auto& field) { column.push_back(field.of(record)); });
+        }
+
+        template<typename Record>
+        auto assign(std::size_t pos, const Record& record)
+        {
+                each([&](auto& column, const auto& field) { column[pos] = field.of(record); });
+        }
+
+        template<typename Record>
+        auto insert(std::size_t pos, const Record& record)
+        {
+                each([&](auto& column, const auto& field) { column.insert(column.begin() + static_cast<std::ptrdiff_t>(pos), field.of(record)); });
+        }
+
+        auto erase(std::size_t pos)
+        {
+                each([&](auto& column, const auto&) { column.erase(column.begin() + static_cast<std::ptrdiff_t>(pos)); });
+        }
+
+        /// @brief Removes position `pos` by moving the last position into it, for owners that do not keep their records in order.
+        auto swap_erase(std::size_t pos)
+        {
+                each([&](auto& column, const auto&) {
+                        column[pos] = column.back();
+                        column.pop_back();
+                });
+        }
+
+private:
+        /// @brief Calls `fn(column, field)` for every field that has a column.
+        template<typename Fn>
+        auto each(Fn&& fn)
+        {
+                for_each_field(SCHEMA, [&](const auto& field, auto index) {
+                        if constexpr (is_fixed_field<field_t<decltype(field)>>) { fn(std::get<index>(columns), field); }
+                });
+        }
+};
+
+/// @brief Prints a field in a listing column `width` characters wide.
+inline auto print_field(int width, float value) { std::printf("%*.2f", width, static_cast<double>(value)); }
+inline auto print_field(int width, int value) { std::printf("%*d", width, value); }
+inline auto print_field(int width, std::string_view value) { std::printf("%*.*s", width, static_cast<int>(value.size()), value.data()); }
+
+/// @brief Prints the column headings of a listing of records.
+template<typename Schema>
+auto print_record_header(const Schema& schema)
+{
+        for_each_field(schema, [](const auto& field, auto) { print_field(field.width, field.label); });
+        std::printf("\n");
+}
+
+/// @brief Prints a record as a row of a listing.
+template<typename Schema, typename Record>
+auto print_record(const Schema& schema, const Record& record)
+{
+        for_each_field(schema, [&](const auto& field, auto) { print_field(field.width, field.of(record)); });
+        std::printf("\n");
+}
+
+/// @brief Asks the user for a field.
+///
+/// @returns false if the answer is not a valid value, in which case it is asked for again.
+template<typename T>
+auto read_field(std::string_view prompt, T& value) -> std::enable_if_t<std::is_arithmetic_v<T>, bool>
+{
+        std::printf("%.*s", static_cast<int>(prompt.size()), prompt.data());
+        std::cin >> value;
+        return true;
+}
+
+inline auto read_field(std::string_view prompt, std::string& value)
+{
+        // NOTE(CA, 28.03.2022) - Important to note that we need to consume the whitespaces from user input when using getline
+        std::printf("%.*s", static_cast<int>(prompt.size()), prompt.data());
+        std::getline(std::cin >> std::ws, value);
+        return true;
+}
+
+/// @brief Asks the user for every field of a record in turn.
+template<typename Schema, typename Record>
+auto read_record(const Schema& schema, Record& record)
+{
+        for_each_field(schema, [&](const auto& field, auto) {
+                while (!read_field(field.prompt, field.of(record))) { std::printf("Invalid option selected. Please try again.\n"); }
+        });
+}
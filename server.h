@@ -0,0 +1,738 @@
+#pragma once
+
+#include "inventory.h"
+#include "net.h"
+#include "protocol.h"
+#include "query.h"
+#include "price_schedule.h"
+#include "reservations.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <vector>
+
+constexpr auto MAX_CLIENT_IN_FLIGHT = std::size_t {128};             // requests queued per connection before it is no longer read from
+constexpr auto MAX_CLIENT_OUT_BYTES = std::size_t {4U << 20U};       // unsent response bytes per connection before it is no longer served
+constexpr auto MAX_RECV_BYTES       = std::size_t {1U << 20U};       // bytes read from one connection per round
+constexpr auto TILL_BATCH           = std::size_t {256};             // till requests run per round
+constexpr auto BULK_SLICE_US        = 500;                           // default time given to back-office work per round
+constexpr auto SLICE_CHECK_ITEMS    = std::size_t {256};             // items a sliced request handles between looks at the clock
+
+/// Deadline by which requests that do not set one are ordered, by `Priority`. They are run by it but never expire.
+constexpr std::uint32_t DEFAULT_DEADLINE_MS[NPRIORITIES] = {20, 10000};
+
+/// Single threaded, poll() based loop serving framed requests on a TCP port, with admission control and deadline scheduling.
+///
+/// Complete requests are queued by priority, as offsets into the connection's receive buffer, and passed to `handler` as views into it.
+/// `handler` appends the response frames to the connection's output. Each round runs up to `TILL_BATCH` till requests, then back-office
+/// work for `bulk_slice`. Within a class the request with the earliest deadline runs first, so a pipelining client cannot hold up the
+/// others, and requests whose sender set a deadline that has passed are answered with `Expired` instead of being run. Requests on a
+/// connection run in order within their class, but a till request may overtake a listing sent before it.
+///
+/// Long back-office requests, such as bulk imports and full listings, are not run to completion: `handler` returns a `Job` that does
+/// the rest a slice at a time. Between slices the loop goes back to poll() and runs the till requests that came in meanwhile, so till
+/// latency is bounded by the slice length rather than by the largest request any client sends.
+///
+/// Work is bounded in two ways. A connection with `MAX_CLIENT_IN_FLIGHT` requests queued, or with `MAX_CLIENT_OUT_BYTES` of responses it
+/// has not read, is not read from until it drains, which pushes back on the client through TCP. A request arriving when its queue already
+/// holds `max_queued` requests from all connections together is answered with `Overloaded` straight away, without being run.
+///
+/// Between rounds the loop calls `background`, which returns true while it has more work to do. Another thread with work for `background`
+/// makes `wake_fd` readable to wake the loop up when it is waiting in poll().
+struct FrameServer
+{
+        using Clock = std::chrono::steady_clock;
+
+        /// The rest of a request that runs in slices. Works until `until`, but always makes some progress, and returns true once it
+        /// has appended its final response frame.
+        using Job = std::function<bool(std::string& out, Clock::time_point until)>;
+
+        /// Handles a request, which is only valid for the duration of the call. Returns the `Job` that finishes it, which has to copy
+        /// what it needs from the request, or an empty one if the response is complete. Only back-office requests may return a job.
+        using Handler    = std::function<Job(const FrameView& request, std::string& out)>;
+        using Background = std::function<bool()>;
+
+        /// A request waiting to be run.
+        struct Queued
+        {
+                std::size_t       offset;         // of the frame in the connection's receive buffer
+                Clock::time_point due;            // deadline, or the default of its class if the sender did not set one
+                bool              expires;        // whether the sender set the deadline, so that the request is dropped after it
+        };
+
+        /// A client connection, the requests queued on it and the bytes waiting to be sent.
+        struct Client
+        {
+                UniqueFd           sock;
+                std::string        in;
+                std::size_t        parsed {0};                // offset in `in` of the first request not queued yet
+                std::deque<Queued> queues[NPRIORITIES];        // by `Priority`
+                Job                job;                       // back-office request being run in slices
+                Clock::time_point  job_due;
+                std::string        out;
+                std::size_t        out_pos {0};
+
+                auto in_flight() const { return queues[0].size() + queues[1].size() + (job ? 1 : 0); }
+                auto unsent() const { return out.size() - out_pos; }
+                auto paused() const { return in_flight() >= MAX_CLIENT_IN_FLIGHT || unsent() >= MAX_CLIENT_OUT_BYTES; }
+        };
+
+        UniqueFd                             listener;
+        std::vector<std::unique_ptr<Client>> clients;
+        Handler                              handler;
+        Background                           background;
+        std::atomic<bool>                    stopping {false};                 // may be set from another thread
+        std::size_t                          max_queued[NPRIORITIES] {4096, 256};
+        std::chrono::microseconds            bulk_slice {BULK_SLICE_US};
+        int                                  wake_fd {-1};
+        ServerStats                          stats {};
+
+        /// @brief Starts listening on `port`, sharing it with other servers in the process if `reuse_port` is set.
+        ///
+        /// @returns false if the port could not be bound.
+        auto listen(std::uint16_t port, bool reuse_port = false)
+        {
+                listener = listen_tcp(port, 128, reuse_port);
+                return listener && set_nonblocking(listener.fd);
+        }
+
+        /// @brief Serves requests until `stopping` is set.
+        auto run()
+        {
+                std::vector<pollfd> fds;
+                auto                busy = false;
+                while (!stopping)
+                {
+                        busy = (background && background()) || busy;
+                        if (stopping) { break; }
+
+                        fds.clear();
+                        fds.push_back({listener.fd, POLLIN, 0});
+                        for (const auto& client : clients)
+                        {
+                                const auto events = (client->paused() ? 0 : POLLIN) | (client->unsent() > 0 ? POLLOUT : 0);
+                                fds.push_back({client->sock.fd, static_cast<short>(events), 0});
+                        }
+                        if (wake_fd >= 0) { fds.push_back({wake_fd, POLLIN, 0}); }
+
+                        if (poll(fds.data(), fds.size(), busy ? 0 : 1000) < 0 && errno != EINTR) { return; }
+
+                        // iterate backwards so that closed clients can be removed without disturbing the indices still to visit
+                        for (auto i = clients.size(); i > 0; --i)
+                        {
+                                auto&      client = *clients[i - 1];
+                                const auto events = fds[i].revents;
+                                const auto ok     = !(events & (POLLERR | POLLHUP | POLLNVAL)) && (!(events & POLLIN) || receive(client)) &&
+                                                (!(events & POLLOUT) || transmit(client));
+                                if (!ok) { close_client(i - 1); }
+                        }
+
+                        if (fds[0].revents & POLLIN) { accept_clients(); }
+                        busy = serve();
+                }
+        }
+
+        /// @brief Serves a connection accepted elsewhere, such as by the process this one took over from.
+        auto adopt(UniqueFd sock)
+        {
+                const int one {1};
+                setsockopt(sock.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                set_nonblocking(sock.fd);
+
+                auto client  = std::make_unique<Client>();
+                client->sock = std::move(sock);
+                clients.push_back(std::move(client));
+                stats.clients = static_cast<std::uint32_t>(clients.size());
+        }
+
+        /// @brief Stops serving the connections that are between requests, with nothing received, queued or left to send, and returns
+        /// them so that another server can carry on where this one left off.
+        auto release_idle_clients()
+        {
+                std::vector<UniqueFd> released;
+                for (auto i = clients.size(); i > 0; --i)
+                {
+                        auto& client = *clients[i - 1];
+                        if (client.in_flight() == 0 && client.unsent() == 0 && client.parsed == client.in.size())
+                        {
+                                released.push_back(std::move(client.sock));
+                                close_client(i - 1);
+                        }
+                }
+                return released;
+        }
+
+        /// @brief Sends what is left of the responses already made, blocking for at most `timeout`. Meant for after `run` has returned.
+        auto drain(Clock::duration timeout)
+        {
+                const auto          until = Clock::now() + timeout;
+                std::vector<pollfd> fds;
+                for (auto now = Clock::now(); now < until; now = Clock::now())
+                {
+                        fds.clear();
+                        for (const auto& client : clients)
+                        {
+                                if (client->unsent() > 0) { fds.push_back({client->sock.fd, POLLOUT, 0}); }
+                        }
+                        if (fds.empty()) { return; }
+
+                        const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count();
+                        if (poll(fds.data(), fds.size(), static_cast<int>(wait) + 1) < 0 && errno != EINTR) { return; }
+
+                        for (auto i = clients.size(); i > 0; --i)
+                        {
+                                if (clients[i - 1]->unsent() > 0 && !transmit(*clients[i - 1])) { close_client(i - 1); }
+                        }
+                }
+        }
+
+private:
+        auto accept_clients() -> void
+        {
+                for (int fd = accept(listener.fd, nullptr, nullptr); fd >= 0; fd = accept(listener.fd, nullptr, nullptr)) { adopt(UniqueFd {fd}); }
+        }
+
+        auto close_client(std::size_t i) -> void
+        {
+                for (std::size_t p = 0; p < NPRIORITIES; ++p) { stats.queued[p] -= static_cast<std::uint32_t>(clients[i]->queues[p].size()); }
+                clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i));
+                stats.clients = static_cast<std::uint32_t>(clients.size());
+        }
+
+        /// @brief Reads what is available, up to `MAX_RECV_BYTES`, and queues the complete requests.
+        ///
+        /// @returns false if the connection was closed or sent a bad frame.
+        auto receive(Client& client) -> bool
+        {
+                char        buf[1U << 16U];
+                std::size_t received {0};
+                while (received < MAX_RECV_BYTES)
+                {
+                        const auto n = recv(client.sock.fd, buf, sizeof(buf), 0);
+                        if (n == 0) { return false; }
+                        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { break; }
+                        if (n < 0 && errno == EINTR) { continue; }
+                        if (n < 0) { return false; }
+
+                        client.in.append(buf, static_cast<std::size_t>(n));
+                        received += static_cast<std::size_t>(n);
+                }
+                return admit(client);
+        }
+
+        /// @brief Queues the complete requests received on a connection, as long as it has room for them. Answers `Stats` straight away,
+        /// and requests whose queue is full with `Overloaded`.
+        ///
+        /// @returns false if the connection sent a bad frame.
+        auto admit(Client& client) -> bool
+        {
+                const auto now = Clock::now();
+                while (client.in_flight() < MAX_CLIENT_IN_FLIGHT)
+                {
+                        const auto start = client.parsed;
+                        const auto frame = decode_frame(client.in, client.parsed);
+                        if (!frame) { break; }
+
+                        const auto type     = frame->header.type;
+                        const auto id       = frame->header.request_id;
+                        const auto p        = static_cast<std::size_t>(request_priority(type));
+                        const auto deadline = frame->header.deadline_ms;
+                        if (type == MessageType::Stats)
+                        {
+                                encode_frame(client.out, type, Status::Ok, id, {reinterpret_cast<const char*>(&stats), sizeof(stats)});
+                        }
+                        else if (stats.queued[p] >= max_queued[p])
+                        {
+                                ++stats.rejected[p];
+                                encode_frame(client.out, type, Status::Overloaded, id, {});
+                        }
+                        else
+                        {
+                                ++stats.accepted[p];
+                                stats.max_queued[p] = std::max(stats.max_queued[p], ++stats.queued[p]);
+                                const auto due      = now + std::chrono::milliseconds {deadline != 0 ? deadline : DEFAULT_DEADLINE_MS[p]};
+                                client.queues[p].push_back({start, due, deadline != 0});
+                        }
+                }
+
+                FrameHeader next {};
+                if (client.in.size() - client.parsed >= sizeof(next)) { std::memcpy(&next, client.in.data() + client.parsed, sizeof(next)); }
+                return next.length <= MAX_FRAME_BYTES;
+        }
+
+        /// @brief Runs one round: till requests, then back-office work until `bulk_slice` is used up.
+        ///
+        /// @returns true if work is still waiting that could run now.
+        auto serve() -> bool
+        {
+                auto budget = TILL_BATCH;
+                for (auto i = earliest(Priority::Till); i < clients.size() && budget > 0; i = earliest(Priority::Till), --budget)
+                {
+                        run_front(*clients[i], Priority::Till);
+                }
+
+                const auto until = Clock::now() + bulk_slice;
+                auto       more  = budget == 0;
+                for (auto i = earliest(Priority::BackOffice); i < clients.size(); i = earliest(Priority::BackOffice))
+                {
+                        if (Clock::now() >= until)
+                        {
+                                more = true;
+                                break;
+                        }
+
+                        auto& client = *clients[i];
+                        if (!client.job) { run_front(client, Priority::BackOffice); }
+                        else if (client.job(client.out, until))
+                        {
+                                client.job = nullptr;
+                                ++stats.handled[static_cast<std::size_t>(Priority::BackOffice)];
+                        }
+                }
+
+                for (auto i = clients.size(); i > 0; --i)
+                {
+                        auto& client = *clients[i - 1];
+                        if ((client.unsent() > 0 && !transmit(client)) || !admit(client)) { close_client(i - 1); }
+                }
+                const auto paused = [](const auto& client) { return client->paused(); };
+                stats.paused      = static_cast<std::uint32_t>(std::count_if(clients.begin(), clients.end(), paused));
+                return more;
+        }
+
+        /// @brief Finds the connection whose next piece of work of the given class is due first, leaving out connections with
+        /// `MAX_CLIENT_OUT_BYTES` of unsent responses. A back-office job in progress counts as due by the deadline of its request.
+        ///
+        /// @returns `clients.size()` if there is no such connection.
+        auto earliest(Priority priority) const -> std::size_t
+        {
+                const auto p    = static_cast<std::size_t>(priority);
+                auto       best = clients.size();
+                auto       due  = Clock::time_point::max();
+                for (std::size_t i = 0; i < clients.size(); ++i)
+                {
+                        const auto& client  = *clients[i];
+                        const auto  has_job = priority == Priority::BackOffice && client.job;
+                        if ((!has_job && client.queues[p].empty()) || client.unsent() >= MAX_CLIENT_OUT_BYTES) { continue; }
+
+                        const auto next = has_job ? client.job_due : client.queues[p].front().due;
+                        if (next < due)
+                        {
+                                best = i;
+                                due  = next;
+                        }
+                }
+                return best;
+        }
+
+        /// @brief Runs the oldest queued request of the given class on a connection, or answers it with `Expired` if its sender has
+        /// given up on it.
+        auto run_front(Client& client, Priority priority) -> void
+        {
+                const auto p       = static_cast<std::size_t>(priority);
+                const auto request = client.queues[p].front();
+                auto       pos     = request.offset;
+                const auto frame   = *decode_frame(client.in, pos);
+                client.queues[p].pop_front();
+                --stats.queued[p];
+
+                if (request.expires && Clock::now() > request.due)
+                {
+                        ++stats.expired[p];
+                        encode_frame(client.out, frame.header.type, Status::Expired, frame.header.request_id, {});
+                }
+                else if (auto job = handler(frame, client.out))
+                {
+                        client.job     = std::move(job);
+                        client.job_due = request.due;
+                }
+                else { ++stats.handled[p]; }
+
+                // drop the requests that have been run from the front of the buffer, once there is enough of it to be worth moving the rest
+                auto first = client.parsed;
+                for (const auto& queue : client.queues)
+                {
+                        if (!queue.empty()) { first = std::min(first, queue.front().offset); }
+                }
+                if (first < (1U << 16U) && first < client.parsed) { return; }
+
+                client.in.erase(0, first);
+                client.parsed -= first;
+                for (auto& queue : client.queues)
+                {
+                        for (auto& queued : queue) { queued.offset -= first; }
+                }
+        }
+
+        /// @brief Sends as much of the pending output as the socket accepts.
+        ///
+        /// @returns false if the connection failed.
+        static auto transmit(Client& client) -> bool
+        {
+                while (client.out_pos < client.out.size())
+                {
+                        const auto n = send(client.sock.fd, client.out.data() + client.out_pos, client.out.size() - client.out_pos, MSG_NOSIGNAL);
+                        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { return true; }
+                        if (n < 0 && errno == EINTR) { continue; }
+                        if (n < 0) { return false; }
+
+                        client.out_pos += static_cast<std::size_t>(n);
+                }
+                client.out.clear();
+                client.out_pos = 0;
+                return true;
+        }
+};
+
+/// @brief Prints the admission control counters of a server.
+inline auto print_server_stats(const ServerStats& stats)
+{
+        std::printf("%-12s%12s%12s%12s%12s%10s%12s\n", "Class", "Accepted", "Rejected", "Expired", "Handled", "Queued", "Max queued");
+        for (std::size_t p = 0; p < NPRIORITIES; ++p)
+        {
+                std::printf("%-12s%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%10u%12u\n", p == 0 ? "till" : "back-office",
+                            stats.accepted[p], stats.rejected[p], stats.expired[p], stats.handled[p], stats.queued[p], stats.max_queued[p]);
+        }
+        std::printf("%u clients, %u paused\n", stats.clients, stats.paused);
+}
+
+/// @brief Returns how durable the change made by a request of `type` must be before it is answered. A checkout takes stock that has
+/// been sold, so it is synced straight away; edits, imports and scheduled prices, which the back office can send again, go out with the
+/// next journal block.
+inline auto durability_of(MessageType type)
+{
+        switch (type)
+        {
+                case MessageType::Commit: return Durability::Sync;
+                default: return Durability::Buffered;
+        }
+}
+
+/// Serves an `Inventory` over the inventory protocol, identifying items by model code.
+///
+/// Keeps an index from the shard hash of each model code to the item's handle. It finds items by model code without building a
+/// `std::string` from the request, and lets a router move a range of the hash ring to another server without the server scanning every
+/// item.
+struct InventoryService
+{
+        Inventory&    inventory;
+        Reservations  reservations;        // stock held for baskets
+        PriceSchedule prices;              // price changes yet to take effect
+
+        explicit InventoryService(Inventory& inventory) : inventory {inventory}, reservations {inventory}, prices {inventory} {}
+
+        /// @brief Look for the item with the given model code.
+        ///
+        /// @returns `inventory.items.end()` if there is no such item.
+        auto get(std::string_view name) { return inventory.find_by<ModelCodeKey>(name); }
+
+        /// @brief Adds the item, or replaces the item with the same model code.
+        ///
+        /// @returns false if the change could not be journalled as `durability` asks, though it was made.
+        auto put(const Item& item, Durability durability = Durability::Buffered)
+        {
+                const auto pitem = get(item.name);
+                if (pitem != inventory.items.end()) { return inventory.update(pitem, item, durability); }
+
+                return inventory.add(item, durability);
+        }
+
+        /// @brief Removes the item with the given model code.
+        ///
+        /// @returns `NotFound` if there is no such item, or `Error` if the removal could not be journalled as `durability` asks, though
+        /// it was made.
+        auto remove(std::string_view name, Durability durability = Durability::Buffered)
+        {
+                const auto pitem = get(name);
+                if (pitem == inventory.items.end()) { return Status::NotFound; }
+
+                return inventory.remove(pitem, durability) ? Status::Ok : Status::Error;
+        }
+
+        /// @brief Puts back the stock of the reservations that have expired. Call it between rounds of the server.
+        auto expire_reservations() { return reservations.expire(); }
+
+        /// @brief Makes the scheduled price changes that have come due take effect, all at once. Call it between rounds of the server.
+        auto apply_price_changes() { return prices.apply(); }
+
+        /// @brief Appends the reservations held and the price changes yet to take effect to `out`, for a server taking over.
+        auto save_state(std::string& out) const
+        {
+                reservations.save(out);
+                prices.save(out);
+        }
+
+        /// @brief Restores the reservations and price changes written by `save_state`. Call it before serving.
+        ///
+        /// @returns false if `state` is truncated or corrupt.
+        auto load_state(std::string_view state)
+        {
+                const auto* data = state.data();
+                const auto* end  = state.data() + state.size();
+                return reservations.load(data, end) && prices.load(data, end) && data == end;
+        }
+
+        /// @brief Handles one request, appending the response frames to `out`.
+        ///
+        /// @returns the job that finishes an import or an unordered listing a slice at a time, or an empty one if the response is complete.
+        auto handle(const FrameView& request, std::string& out) -> FrameServer::Job
+        {
+                const auto type = request.header.type;
+                const auto id   = request.header.request_id;
+                if (type == MessageType::List || type == MessageType::Query)
+                {
+                        const auto query = parse_query(request);
+                        if (!query) { encode_frame(out, type, Status::Error, id, {}); }
+                        else if (query->order == QueryOrder::None) { return select(type, id, *query); }
+                        else { encode_result(out, type, id, run_query(inventory, *query)); }        // needs every match before the first
+                        return {};
+                }
+                if (type == MessageType::Import)
+                {
+                        if (ItemsView::parse(request.payload)) { return import(type, id, std::string {request.payload}); }
+
+                        encode_frame(out, type, Status::Error, id, {});
+                        return {};
+                }
+                if (type == MessageType::SyncSince)
+                {
+                        sync(request, out);
+                        return {};
+                }
+
+                std::string payload;
+                const auto  status = dispatch(request, payload);
+                encode_frame(out, type, status, id, payload);
+                return {};
+        }
+
+private:
+        /// @brief Starts a job streaming the items matching an unordered query in the order of their handles, `RESULT_CHUNK_ITEMS` per
+        /// frame. Like a `Scan` it carries on after the last handle it looked at, so an item changed between slices is sent as it is when
+        /// the job gets to it, and items added or removed behind it are missed.
+        auto select(MessageType type, std::uint32_t request_id, const Query& query) -> FrameServer::Job
+        {
+                return [this, type, request_id, filter = QueryFilter::compile(query), after = Handle {0}, count = std::uint32_t {0},
+                        payload = std::string {}](std::string& out, FrameServer::Clock::time_point until) mutable {
+                        const auto& handles = inventory.handles;
+                        const auto  limit   = filter.query.limit;
+                        auto        pos     = static_cast<std::size_t>(std::upper_bound(handles.begin(), handles.end(), after) - handles.begin());
+                        const auto  done    = [&] { return pos == handles.size() || (limit != 0 && count == limit); };
+                        do {
+                                const auto end = std::min(handles.size(), pos + SLICE_CHECK_ITEMS);
+                                pos            = filter.for_each_match(inventory.columns, pos, end, [&](std::size_t match) {
+                                        encode_item(payload, inventory.items[match]);
+                                        if (++count % RESULT_CHUNK_ITEMS == 0)
+                                        {
+                                                encode_frame(out, type, Status::Partial, request_id, payload);
+                                                payload.clear();
+                                        }
+                                        return limit == 0 || count != limit;
+                                });
+                                if (pos != 0) { after = handles[pos - 1]; }
+                        } while (!done() && FrameServer::Clock::now() < until);
+                        if (!done()) { return false; }
+
+                        encode_frame(out, type, Status::Ok, request_id, payload);
+                        return true;
+                };
+        }
+
+        /// @brief Starts a job adding or replacing the items in `records`, which have been checked already. Tills may see some of the
+        /// items before the import has finished. Answers `Error` if any of the changes could not be journalled.
+        auto import(MessageType type, std::uint32_t request_id, std::string records) -> FrameServer::Job
+        {
+                return [this, type, request_id, records = std::move(records), pos = std::size_t {0}, count = std::uint64_t {0},
+                        recorded = true](std::string& out, FrameServer::Clock::time_point until) mutable {
+                        do {
+                                for (std::size_t n = 0; n < SLICE_CHECK_ITEMS && pos < records.size(); ++n, ++count)
+                                {
+                                        const auto item = *ItemView::parse(std::string_view {records}.substr(pos));
+                                        recorded        = put(item.to_item(), durability_of(type)) && recorded;
+                                        pos += item.record.size();
+                                }
+                        } while (pos < records.size() && FrameServer::Clock::now() < until);
+                        if (pos < records.size()) { return false; }
+
+                        std::string payload;
+                        ::put(payload, count);
+                        encode_frame(out, type, recorded ? Status::Ok : Status::Error, request_id, payload);
+                        return true;
+                };
+        }
+
+        /// @brief Answers a `SyncSince` request from the inventory's version index, streaming `RESULT_CHUNK_ITEMS` changes per frame.
+        auto sync(const FrameView& request, std::string& out) -> void
+        {
+                Version     since {0};
+                const auto* data = request.payload.data();
+                if (!::get(data, data + request.payload.size(), since))
+                {
+                        encode_frame(out, request.header.type, Status::Error, request.header.request_id, {});
+                        return;
+                }
+
+                std::string payload;
+                SyncHeader  header {inventory.version, 0, 0};
+                const auto  start = out.size();
+                ::put(payload, header);
+
+                const auto add = [&](const Item& item, Version version, bool removed) {
+                        ::put(payload, DeltaHeader {version, removed, 0});
+                        encode_item(payload, item);
+                        if (++header.count % RESULT_CHUNK_ITEMS == 0)
+                        {
+                                encode_frame(out, request.header.type, Status::Partial, request.header.request_id, payload);
+                                payload.clear();
+                        }
+                };
+                const auto changed = [&](const Item& item, Version version) { add(item, version, false); };
+                const auto removed = [&](const Tombstone& tombstone, Version version) {
+                        add({Product {}, tombstone.item.name, 0, 0}, version, true);
+                };
+
+                // removals older than the tombstones kept cannot be sent, so the client gets everything and starts over
+                if (!inventory.changes_since(since, changed, removed))
+                {
+                        header.full = 1;
+                        for (std::size_t i = 0; i < inventory.items.size(); ++i) { changed(inventory.items[i], inventory.versions[i]); }
+                }
+                encode_frame(out, request.header.type, Status::Ok, request.header.request_id, payload);
+
+                // the count is only known now, fill it in where the header went out at the start of the first frame
+                std::memcpy(out.data() + start + sizeof(FrameHeader), &header, sizeof(header));
+        }
+
+        auto dispatch(const FrameView& request, std::string& payload) -> Status
+        {
+                switch (request.header.type)
+                {
+                        case MessageType::Get:
+                        {
+                                const auto pitem = get(request.payload);
+                                if (pitem == inventory.items.end()) { return Status::NotFound; }
+
+                                encode_item(payload, *pitem);
+                                return Status::Ok;
+                        }
+                        case MessageType::Put:
+                        {
+                                const auto item = ItemView::parse(request.payload);
+                                if (!item) { return Status::Error; }
+
+                                return put(item->to_item(), durability_of(request.header.type)) ? Status::Ok : Status::Error;
+                        }
+                        case MessageType::Remove: return remove(request.payload, durability_of(request.header.type));
+                        case MessageType::Scan:
+                        {
+                                ScanRequest scan {};
+                                const auto* data = request.payload.data();
+                                if (!::get(data, data + request.payload.size(), scan)) { return Status::Error; }
+
+                                // handles are sorted, so the page starts with a binary search for the cursor; the item count and the
+                                // amount of work per page are both bounded whatever the size of the inventory
+                                const auto  max_items = std::min(scan.max_items == 0 ? SCAN_PAGE_ITEMS : scan.max_items, SCAN_PAGE_ITEMS);
+                                const auto  after     = static_cast<Handle>(std::min<std::uint64_t>(scan.after, UINT32_MAX));
+                                const auto  first     = std::upper_bound(inventory.handles.begin(), inventory.handles.end(), after);
+                                auto        pos       = static_cast<std::size_t>(first - inventory.handles.begin());
+                                const auto  start     = pos;
+                                const auto  end       = std::min(inventory.items.size(), pos + SCAN_PAGE_EXAMINED);
+                                const auto  filter    = QueryFilter::compile(scan.filter);
+                                ScanHeader  header {scan.after, 0, 0};
+                                ::put(payload, header);
+                                pos = filter.for_each_match(inventory.columns, pos, end, [&](std::size_t match) {
+                                        encode_item(payload, inventory.items[match]);
+                                        return ++header.count < max_items;
+                                });
+                                if (pos != start) { header.next = inventory.handles[pos - 1]; }
+                                header.done = pos == inventory.items.size();
+                                std::memcpy(payload.data(), &header, sizeof(header));
+                                return Status::Ok;
+                        }
+                        case MessageType::ScanHashRange:
+                        {
+                                HashRange   range {};
+                                const auto* data = request.payload.data();
+                                if (!::get(data, data + request.payload.size(), range)) { return Status::Error; }
+
+                                const auto& by_hash = inventory.index<ModelCodeKey>();
+                                auto        pos     = by_hash.lower_bound({range.lo, 0});
+                                for (std::uint32_t n = 0; n < range.limit && pos != by_hash.end() && pos->first <= range.hi; ++n, ++pos)
+                                {
+                                        encode_item(payload, *inventory.find(pos->second));
+                                }
+                                return Status::Ok;
+                        }
+                        case MessageType::Reserve:
+                        {
+                                ReserveRequest reserve {};
+                                const auto*    data = request.payload.data();
+                                if (!::get(data, data + request.payload.size(), reserve) || reserve.quantity == 0) { return Status::Error; }
+
+                                const auto pitem = get(*model_code_of(request));
+                                if (pitem == inventory.items.end()) { return Status::NotFound; }
+
+                                const auto quantity = static_cast<int>(std::min<std::uint32_t>(reserve.quantity, INT_MAX));
+                                const auto id       = reservations.reserve(pitem, quantity, std::chrono::milliseconds {reserve.ttl_ms});
+                                if (!id) { return Status::OutOfStock; }
+
+                                ::put(payload, ReservationRef {*id});
+                                return Status::Ok;
+                        }
+                        case MessageType::Commit:
+                        case MessageType::Release:
+                        {
+                                ReservationRef ref {};
+                                const auto*    data = request.payload.data();
+                                if (!::get(data, data + request.payload.size(), ref)) { return Status::Error; }
+
+                                const auto pitem = get(*model_code_of(request));
+                                if (pitem == inventory.items.end()) { return Status::NotFound; }
+
+                                if (request.header.type == MessageType::Release)
+                                {
+                                        return reservations.release(ref.id, pitem) ? Status::Ok : Status::NotFound;
+                                }
+
+                                const auto recorded = reservations.commit(ref.id, pitem, durability_of(request.header.type));
+                                if (!recorded) { return Status::NotFound; }
+
+                                return *recorded ? Status::Ok : Status::Error;
+                        }
+                        case MessageType::SchedulePrice:
+                        {
+                                PriceChange change {};
+                                const auto* data = request.payload.data();
+                                if (!::get(data, data + request.payload.size(), change) || !(change.price >= 0)) { return Status::Error; }
+
+                                const auto pitem = get(*model_code_of(request));
+                                if (pitem == inventory.items.end()) { return Status::NotFound; }
+
+                                prices.schedule(pitem, change.price, change.effective_ms);
+                                return Status::Ok;
+                        }
+                        case MessageType::Aggregate:
+                        {
+                                Query       query {};
+                                const auto* data = request.payload.data();
+                                if (!::get(data, data + request.payload.size(), query)) { return Status::Error; }
+
+                                ::put(payload, estimate_aggregate(inventory, query));
+                                return Status::Ok;
+                        }
+                        default: return Status::Unsupported;
+                }
+        }
+};
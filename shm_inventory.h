@@ -0,0 +1,391 @@
+#pragma once
+
+#include "inventory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr auto SHM_MAGIC            = std::uint64_t {0x494E56454E544F52};        // "INVENTOR"
+constexpr auto SHM_MIN_CAPACITY     = std::uint32_t {1024};
+
+/// Item as it is laid out in the shared memory segment. It holds no pointers so it reads the same from any process.
+struct ShmItem
+{
+        Product id;                          // Product category that item falls into
+        float   price;                       // Price in GBP
+        int     nstock;                      // No. of units in stock
+        char    name[MAX_MODEL_NAME];        // Null terminated model code
+
+        /// @brief Copies the given item into the flat layout, truncating the name to fit.
+        auto assign(const Item& item)
+        {
+                id     = item.id;
+                price  = item.price;
+                nstock = item.nstock;
+                std::strncpy(name, item.name.c_str(), MAX_MODEL_NAME - 1);
+                name[MAX_MODEL_NAME - 1] = '\0';
+        }
+
+        auto to_item() const { return Item {id, name, price, nstock}; }
+};
+
+/// Start of the shared memory segment. Items are found at `items_offset` bytes from the start of the header, never through a pointer.
+struct ShmHeader
+{
+        std::uint64_t              magic;
+        std::uint32_t              capacity;            // Max no. of items the segment can hold
+        std::uint32_t              items_offset;        // Byte offset of the first item from the header
+        std::atomic<std::uint32_t> seq;                 // Seqlock counter, odd while the writer is updating
+        std::uint32_t              count;               // No. of items currently published
+        std::atomic<std::uint32_t> generation;          // Bumped once the writer has moved to a larger segment under the same name
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "seqlock counter must be usable across processes");
+
+/// Maps a POSIX shared memory segment holding an inventory. Unmaps (but does not unlink) on destruction.
+struct ShmSegment
+{
+        ShmSegment() = default;
+        ShmSegment(const ShmSegment&) = delete;
+        ShmSegment(ShmSegment&& other) noexcept { *this = std::move(other); }
+        ~ShmSegment() { unmap(); }
+
+        auto operator=(const ShmSegment&) -> ShmSegment& = delete;
+        auto operator=(ShmSegment&& other) noexcept -> ShmSegment&
+        {
+                std::swap(base, other.base);
+                std::swap(length, other.length);
+                return *this;
+        }
+
+        static auto segment_size(std::uint32_t capacity) { return items_offset() + sizeof(ShmItem) * capacity; }
+
+        static constexpr auto items_offset() -> std::uint32_t
+        {
+                // keep items aligned to a cache line so readers never straddle the header
+                return (sizeof(ShmHeader) + 63U) & ~63U;
+        }
+
+        auto header() const { return static_cast<ShmHeader*>(base); }
+        auto items() const { return reinterpret_cast<ShmItem*>(static_cast<char*>(base) + header()->items_offset); }
+
+        /// @brief Maps `fd` into memory.
+        ///
+        /// @returns false if the mapping failed.
+        auto map(int fd, std::size_t size, bool writable)
+        {
+                const auto prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+                void*      addr = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+                if (addr == MAP_FAILED) { return false; }
+
+                base   = addr;
+                length = size;
+                return true;
+        }
+
+private:
+        void*       base {nullptr};
+        std::size_t length {0};
+
+        auto        unmap() -> void
+        {
+                if (base != nullptr) { munmap(base, length); }
+                base = nullptr;
+        }
+};
+
+/// The single process allowed to modify the shared inventory. Every update is wrapped in a seqlock write section.
+///
+/// Removes the segment name on destruction, unless another writer has created a segment under the name since.
+struct ShmInventoryWriter
+{
+        ShmInventoryWriter() = default;
+        ShmInventoryWriter(const ShmInventoryWriter&) = delete;
+        ShmInventoryWriter(ShmInventoryWriter&& other) noexcept { *this = std::move(other); }
+        ~ShmInventoryWriter() { unlink(); }
+
+        auto operator=(const ShmInventoryWriter&) -> ShmInventoryWriter& = delete;
+        auto operator=(ShmInventoryWriter&& other) noexcept -> ShmInventoryWriter&
+        {
+                std::swap(segment, other.segment);
+                std::swap(name, other.name);
+                std::swap(inode, other.inode);
+                return *this;
+        }
+
+        /// @brief Returns the capacity to give a segment that must hold `count` items, leaving room for as many again.
+        static auto capacity_for(std::size_t count) -> std::uint32_t
+        {
+                return static_cast<std::uint32_t>(std::clamp<std::size_t>(count * 2, SHM_MIN_CAPACITY, UINT32_MAX / sizeof(ShmItem)));
+        }
+
+        /// @brief Creates the named segment large enough for `capacity` items, in place of any segment of that name. Readers still
+        /// attached to the old segment keep it, rather than seeing it truncated under them.
+        ///
+        /// @returns std::nullopt if the segment could not be created.
+        static auto create(const std::string& name, std::uint32_t capacity) -> std::optional<ShmInventoryWriter>
+        {
+                shm_unlink(name.c_str());
+                const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+                if (fd < 0) { return {}; }
+
+                const auto         size = ShmSegment::segment_size(capacity);
+                ShmInventoryWriter writer;
+                struct stat        st {};
+                const auto         ok = ftruncate(fd, static_cast<off_t>(size)) == 0 && fstat(fd, &st) == 0 && writer.segment.map(fd, size, true);
+                close(fd);
+                if (!ok) { return {}; }
+
+                auto* hdr         = writer.segment.header();
+                hdr->capacity     = capacity;
+                hdr->items_offset = ShmSegment::items_offset();
+                hdr->count        = 0;
+                hdr->seq.store(0, std::memory_order_relaxed);
+                hdr->generation.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                hdr->magic = SHM_MAGIC;
+
+                writer.name  = name;
+                writer.inode = st.st_ino;
+                return writer;
+        }
+
+        /// @brief Removes the segment name so no new readers can attach, unless it now names another writer's segment. Mapped readers
+        /// keep working.
+        auto unlink() -> void
+        {
+                if (name.empty()) { return; }
+
+                const int   fd = shm_open(name.c_str(), O_RDONLY, 0);
+                struct stat st {};
+                if (fd >= 0 && fstat(fd, &st) == 0 && st.st_ino == inode) { shm_unlink(name.c_str()); }
+                if (fd >= 0) { close(fd); }
+                name.clear();
+        }
+
+        auto capacity() const { return segment.header()->capacity; }
+
+        /// @brief Returns the no. of published items.
+        auto size() const { return segment.header()->count; }
+
+        /// @brief Moves the published items to a new segment under the same name, large enough for `capacity` items. Readers of the
+        /// old segment see its generation change and attach to the new one.
+        ///
+        /// @returns false if the new segment could not be created. The items stay where they are, but new readers cannot find them.
+        auto grow(std::uint32_t capacity) -> bool
+        {
+                auto* old        = segment.header();
+                auto  generation = old->generation.load(std::memory_order_relaxed) + 1;
+                auto  larger     = create(name, capacity);
+                if (!larger) { return false; }
+
+                larger->segment.header()->generation.store(generation, std::memory_order_relaxed);
+                larger->write([&](ShmItem* items, std::uint32_t& count) {
+                        count = old->count;
+                        std::memcpy(items, segment.items(), sizeof(ShmItem) * count);
+                });
+                old->generation.store(generation, std::memory_order_release);
+
+                // the old segment goes with `larger`, which leaves the name alone as it now refers to the new segment
+                std::swap(*this, *larger);
+                return true;
+        }
+
+        /// @brief Replaces the published items with the contents of the inventory, growing the segment if they do not fit.
+        ///
+        /// @returns false if the segment could not grow. Readers then see no items rather than only some of them.
+        auto publish(const Inventory& inventory)
+        {
+                const auto fits = inventory.items.size() <= capacity() || grow(capacity_for(inventory.items.size()));
+                write([&](ShmItem* items, std::uint32_t& count) {
+                        count = 0;
+                        if (!fits) { return; }
+
+                        for (const auto& item : inventory.items) { items[count++].assign(item); }
+                });
+                return fits;
+        }
+
+        /// @brief Appends a single item, growing the segment if it is full.
+        ///
+        /// @returns false if the segment is full and could not grow.
+        auto append(const Item& item)
+        {
+                if (size() == capacity() && !grow(capacity_for(size() + 1U))) { return false; }
+
+                write([&](ShmItem* items, std::uint32_t& count) { items[count++].assign(item); });
+                return true;
+        }
+
+        /// @brief Overwrites the item at position `pos` in place.
+        ///
+        /// @returns false if no item is published at `pos`.
+        auto assign(std::uint32_t pos, const Item& item)
+        {
+                if (pos >= size()) { return false; }
+
+                write([&](ShmItem* items, std::uint32_t&) { items[pos].assign(item); });
+                return true;
+        }
+
+        /// @brief Removes the item at position `pos`, keeping the order of the remaining items as `Inventory::remove` does.
+        ///
+        /// @returns false if no item is published at `pos`.
+        auto erase(std::uint32_t pos)
+        {
+                if (pos >= size()) { return false; }
+
+                write([&](ShmItem* items, std::uint32_t& count) {
+                        std::memmove(items + pos, items + pos + 1, sizeof(ShmItem) * (count - pos - 1));
+                        --count;
+                });
+                return true;
+        }
+
+        /// @brief Makes the change `mutation` made to `inventory`, whose items have been published, to the published items. Meant to
+        /// be called from `Inventory::on_mutation`, which is called before an update is made and after the other changes.
+        ///
+        /// Items are published in the order of their handles, as the inventory keeps them, so the position of the change follows from its
+        /// handle. If the published items do not line up with the inventory around it, publishes the whole inventory instead.
+        ///
+        /// @returns false if the inventory does not fit in the segment and it could not grow.
+        auto mirror(const Inventory& inventory, const Mutation& mutation)
+        {
+                const auto& handles = inventory.handles;
+                const auto  pos     = static_cast<std::uint32_t>(std::lower_bound(handles.begin(), handles.end(), mutation.handle) - handles.begin());
+                const auto  count   = inventory.items.size();
+
+                auto applied = false;
+                switch (mutation.op)
+                {
+                        case Mutation::Op::Add: applied = size() == pos && pos + 1 == count && append(*mutation.item); break;
+                        case Mutation::Op::Update: applied = size() == count && assign(pos, *mutation.item); break;
+                        case Mutation::Op::Remove: applied = size() == count + 1 && erase(pos); break;
+                }
+                if (applied) { return true; }
+
+                // an update is only made to the inventory once it has been told of, so its new value is published on top
+                const auto ok = publish(inventory);
+                if (ok && mutation.op == Mutation::Op::Update) { assign(pos, *mutation.item); }
+                return ok;
+        }
+
+private:
+        ShmSegment  segment;
+        std::string name;
+        ino_t       inode {0};        // of the segment we created, to tell whether `name` still refers to it
+
+        /// @brief Runs `fn` inside a seqlock write section. Readers that overlap it will retry.
+        template<typename Fn>
+        auto write(Fn&& fn) -> void
+        {
+                auto*      hdr = segment.header();
+                const auto seq = hdr->seq.load(std::memory_order_relaxed);
+                hdr->seq.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                fn(segment.items(), hdr->count);
+
+                hdr->seq.store(seq + 2, std::memory_order_release);
+        }
+};
+
+/// Read-only view of a shared inventory. Queries run directly against the mapped items; nothing is copied unless returned.
+struct ShmInventoryReader
+{
+        /// @brief Attaches to an existing segment created by a `ShmInventoryWriter`.
+        ///
+        /// @returns std::nullopt if the segment does not exist or is not an inventory.
+        static auto open(const std::string& name) -> std::optional<ShmInventoryReader>
+        {
+                const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+                if (fd < 0) { return {}; }
+
+                struct stat st {};
+                ShmInventoryReader reader;
+                const auto         ok = fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(ShmHeader) &&
+                                reader.segment.map(fd, static_cast<std::size_t>(st.st_size), false);
+                close(fd);
+                if (!ok) { return {}; }
+
+                const auto* hdr = reader.segment.header();
+                if (hdr->magic != SHM_MAGIC || ShmSegment::segment_size(hdr->capacity) > static_cast<std::size_t>(st.st_size)) { return {}; }
+
+                reader.name       = name;
+                reader.generation = hdr->generation.load(std::memory_order_acquire);
+                return reader;
+        }
+
+        /// @brief Runs `fn(first, last)` over the published items until it observes a consistent snapshot, first attaching to the
+        /// writer's new segment if it has moved to a larger one.
+        ///
+        /// `fn` may be called more than once if the writer is active, so it must not have side effects besides its return value.
+        template<typename Fn>
+        auto read(Fn&& fn)
+        {
+                do {
+                        const auto* hdr = segment.header();
+                        if (hdr->generation.load(std::memory_order_acquire) != generation)
+                        {
+                                // if the writer has gone since, the items it last published here are all there is to read
+                                generation = hdr->generation.load(std::memory_order_relaxed);
+                                if (auto moved = open(name)) { *this = std::move(*moved); }
+                                continue;
+                        }
+
+                        const auto begin_seq = hdr->seq.load(std::memory_order_acquire);
+                        if (begin_seq & 1U) { continue; }        // writer in progress
+
+                        const auto  count  = std::min(hdr->count, hdr->capacity);
+                        const auto* first  = segment.items();
+                        auto        result = fn(first, first + count);
+
+                        std::atomic_thread_fence(std::memory_order_acquire);
+                        if (hdr->seq.load(std::memory_order_relaxed) == begin_seq) { return result; }
+                } while (true);
+        }
+
+        /// @brief Look for the item for which the given predicate returns true.
+        ///
+        /// @returns std::nullopt if item is not found else a copy of the item.
+        template<typename Pred>
+        auto search(Pred&& pred) -> std::optional<Item>
+        {
+                return read([&](const ShmItem* first, const ShmItem* last) -> std::optional<Item> {
+                        const auto pitem = std::find_if(first, last, pred);
+                        if (pitem != last) { return pitem->to_item(); }
+
+                        return {};
+                });
+        }
+
+        /// @brief Returns the number of published items.
+        auto size()
+        {
+                return read([](const ShmItem* first, const ShmItem* last) { return static_cast<std::size_t>(last - first); });
+        }
+
+        /// @brief Prints a table listing the published items, in the same format as `Inventory::list`.
+        auto list()
+        {
+                // copy out first so that a torn read never reaches stdout
+                const auto items = read([](const ShmItem* first, const ShmItem* last) { return std::vector<ShmItem>(first, last); });
+
+                print_record_header(ITEM_SCHEMA);
+                std::for_each(items.begin(), items.end(), [](const auto& item) { print_record(ITEM_SCHEMA, item); });
+                std::printf("---------------\n");
+        }
+
+private:
+        ShmSegment    segment;
+        std::string   name;
+        std::uint32_t generation {0};        // of the segment we are attached to
+};
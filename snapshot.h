@@ -0,0 +1,369 @@
+#pragma once
+
+#include "bytes.h"
+#include "inventory.h"
+#include "unique_fd.h"
+#include "wire.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+constexpr auto SNAPSHOT_MAGIC   = std::uint32_t {0x504E5349};        // "ISNP"
+constexpr auto SNAPSHOT_VERSION = std::uint32_t {6};
+
+/// Fixed header at the start of every snapshot file. The file ends with the FNV-1a checksum of everything before it.
+struct SnapshotHeader
+{
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t count;                    // No. of items that follow
+        std::uint64_t lsn;                      // Last journal record included in the snapshot
+        Handle        next_handle;              // Handle the next added item will get
+        std::uint32_t nindexes;                 // No. of key indexes saved after the items
+        Version       inventory_version;        // Version of the last change included in the snapshot
+};
+
+/// Measurements taken while writing a snapshot.
+struct SnapshotStats
+{
+        bool          ok {false};
+        std::uint64_t bytes {0};              // Size of the snapshot file
+        std::uint64_t duration_us {0};        // Time spent serialising and syncing the file
+        std::uint64_t fork_us {0};            // Time the forking process was paused in fork()
+        std::uint64_t cow_bytes {0};          // Memory duplicated by copy-on-write while a forked child was writing
+};
+
+/// An entry of an index saved in a snapshot. Holds no pointers or positions, so it means the same wherever the file is loaded, and is
+/// laid out as a `FlatIndex` keeps its pairs, so that a saved index is loaded in one copy.
+struct SnapshotIndexEntry
+{
+        std::uint64_t key;
+        Handle        handle;
+        std::uint32_t reserved;
+};
+
+static_assert(sizeof(SnapshotIndexEntry) == sizeof(std::pair<std::uint64_t, Handle>), "a saved index must be laid out as a FlatIndex array");
+
+/// Smallest an item can take in a snapshot: its handle, its version and a record with an empty model code.
+constexpr auto SNAPSHOT_MIN_ITEM_SIZE = sizeof(std::uint64_t) + sizeof(Version) + wire_header_size<std::decay_t<decltype(ITEM_SCHEMA)>>;
+
+/// @brief Writes `bytes` to an open file and adds them to `checksum`.
+inline auto write_checksummed(std::FILE* file, std::string_view bytes, std::uint32_t& checksum)
+{
+        checksum = fnv1a(bytes.data(), bytes.size(), checksum);
+        return std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+}
+
+/// @brief Writes an index to an open file: the no. of entries, then the entries in index order, which is the sorted array a
+/// `FlatIndex` keeps them in.
+template<typename K>
+auto write_index(std::FILE* file, const FlatIndex<K, Handle>& index, std::uint32_t& checksum)
+{
+        std::string block;
+        put(block, std::uint64_t {index.size()});
+        auto ok = true;
+        for (auto pentry = index.begin(); ok && pentry != index.end(); ++pentry)
+        {
+                put(block, SnapshotIndexEntry {pentry->first, pentry->second, 0});
+                if (block.size() >= (1U << 16U))
+                {
+                        ok = write_checksummed(file, block, checksum);
+                        block.clear();
+                }
+        }
+        return ok && write_checksummed(file, block, checksum);
+}
+
+/// @brief Reads an index written by `write_index` from `data` into `index` and advances `data`. The index must hold `count` entries.
+///
+/// The entries are taken as the index's array in one copy. Whether they name items of the inventory is not checked: the snapshot's
+/// checksum already says they are the ones that were saved with the items.
+///
+/// @returns false if the index is truncated, out of order or of another size.
+template<typename K>
+auto read_index(const char*& data, const char* end, FlatIndex<K, Handle>& index, std::uint64_t count)
+{
+        static_assert(sizeof(K) == sizeof(SnapshotIndexEntry::key), "keys are saved as 8 bytes");
+
+        std::uint64_t saved_count {};
+        if (!get(data, end, saved_count) || saved_count != count || count > static_cast<std::uint64_t>(end - data) / sizeof(SnapshotIndexEntry))
+        {
+                return false;
+        }
+
+        const auto* entries = data;
+        data += count * sizeof(SnapshotIndexEntry);
+        return index.assign(entries, static_cast<std::size_t>(count));
+}
+
+/// @brief Serialises all items to an open file, followed by the indexes.
+///
+/// Each item is stored as its handle, widened to 8 bytes, and its version, followed by its wire record, the same record the protocol
+/// sends, so its records could be sent to another server as they are.
+///
+/// After the items come the key indexes, `by_version` and the state of the sample, so that loading copies each index's array as it is
+/// instead of inserting every item into it again. Last comes the checksum of all of it.
+inline auto write_items(std::FILE* file, const Inventory& inventory, std::uint64_t lsn)
+{
+        std::uint32_t nindexes {0};
+        inventory.for_each_index([&](const auto&) { ++nindexes; });
+
+        const SnapshotHeader hdr {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, inventory.items.size(), lsn, inventory.next_handle, nindexes, inventory.version};
+        std::uint32_t        checksum = fnv1a(nullptr, 0);
+        auto                 ok       = write_checksummed(file, {reinterpret_cast<const char*>(&hdr), sizeof(hdr)}, checksum);
+
+        std::string record;
+        for (std::size_t i = 0; ok && i < inventory.items.size(); ++i)
+        {
+                record.clear();
+                put(record, std::uint64_t {inventory.handles[i]});
+                put(record, inventory.versions[i]);
+                encode_item(record, inventory.items[i]);
+                ok = write_checksummed(file, record, checksum);
+        }
+
+        inventory.for_each_index([&](const auto& index) { ok = ok && write_index(file, index, checksum); });
+        ok = ok && write_index(file, inventory.by_version, checksum);
+
+        std::string sample;
+        inventory.sample.save(sample);
+        ok = ok && write_checksummed(file, sample, checksum);
+        return ok && std::fwrite(&checksum, sizeof(checksum), 1, file) == 1;
+}
+
+/// @brief Writes the inventory to `path` so that the file is either the old or the complete new snapshot, never a partial one.
+///
+/// `lsn` records the last journal record that is already reflected in the inventory.
+inline auto write_snapshot(const Inventory& inventory, const std::string& path, std::uint64_t lsn = 0) -> SnapshotStats
+{
+        const auto    start = std::chrono::steady_clock::now();
+        const auto    tmp   = path + ".tmp";
+        SnapshotStats stats;
+
+        std::FILE*    file = std::fopen(tmp.c_str(), "wb");
+        if (file == nullptr) { return stats; }
+
+        stats.ok    = write_items(file, inventory, lsn) && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+        stats.bytes = static_cast<std::uint64_t>(std::ftell(file));
+        stats.ok    = std::fclose(file) == 0 && stats.ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        stats.duration_us  = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        return stats;
+}
+
+/// @brief Reads an inventory from the bytes of a snapshot, with its indexes as they were saved. Set `rebuild_indexes` to build them
+/// from the items instead, e.g. to measure the difference. The items are copied out, so `data` need not outlive the inventory.
+///
+/// @returns std::nullopt if `data` is truncated, corrupt or not a snapshot. Otherwise stores the journal position of the snapshot in `lsn`.
+inline auto parse_snapshot(std::string_view data, std::uint64_t* lsn = nullptr, bool rebuild_indexes = false) -> std::optional<Inventory>
+{
+        std::uint32_t checksum {};
+        if (data.size() < sizeof(SnapshotHeader) + sizeof(checksum)) { return {}; }
+
+        std::memcpy(&checksum, data.data() + data.size() - sizeof(checksum), sizeof(checksum));
+        data.remove_suffix(sizeof(checksum));
+        Inventory      inventory;
+        SnapshotHeader hdr {};
+        const auto*    pos = data.data();
+        auto           ok  = fnv1a(data.data(), data.size()) == checksum && get(pos, data.data() + data.size(), hdr) &&
+                  hdr.magic == SNAPSHOT_MAGIC && hdr.version == SNAPSHOT_VERSION;
+
+        // every item takes some bytes, so a corrupt count cannot make us reserve more than the file could hold
+        std::string_view rest {pos, ok ? data.size() - sizeof(hdr) : 0};
+        ok = ok && hdr.count <= rest.size() / SNAPSHOT_MIN_ITEM_SIZE;
+        inventory.items.reserve(ok ? hdr.count : 0);
+        inventory.columns.reserve(ok ? hdr.count : 0);
+        inventory.handles.reserve(ok ? hdr.count : 0);
+        inventory.versions.reserve(ok ? hdr.count : 0);
+        for (std::uint64_t i = 0; ok && i < hdr.count; ++i)
+        {
+                std::uint64_t handle {};
+                Version       version {};
+                const auto*   record = rest.data();
+                const auto*   end    = rest.data() + rest.size();
+                const auto    fixed  = get(record, end, handle) && get(record, end, version);
+                const auto    item   = fixed ? ItemView::parse({record, static_cast<std::size_t>(end - record)}) : std::nullopt;
+                ok                   = item.has_value();
+                if (!ok) { break; }
+
+                if (rebuild_indexes) { inventory.restore(static_cast<Handle>(handle), item->to_item(), version); }
+                else { inventory.restore_unindexed(static_cast<Handle>(handle), item->to_item(), version); }
+                rest.remove_prefix(static_cast<std::size_t>(record - rest.data()) + item->record.size());
+        }
+
+        if (ok && !rebuild_indexes)
+        {
+                // only items changed since they were added have an entry in `by_version`
+                const auto    nchanged = static_cast<std::uint64_t>(
+                        std::count_if(inventory.versions.begin(), inventory.versions.end(), [](Version version) { return version != 0; }));
+                std::uint32_t nindexes {0};
+                const auto*   indexes = rest.data();
+                const auto*   end     = rest.data() + rest.size();
+                inventory.for_each_index(
+                        [&](auto& index) { ok = ok && ++nindexes <= hdr.nindexes && read_index(indexes, end, index, hdr.count); });
+                ok = ok && nindexes == hdr.nindexes && read_index(indexes, end, inventory.by_version, nchanged);
+                ok = ok && inventory.sample.load(indexes, end, [&](Handle handle) {
+                        const auto pitem = inventory.find(handle);
+                        return pitem == inventory.items.end() ? nullptr : &*pitem;
+                });
+        }
+        if (!ok) { return {}; }
+
+        // removals are not kept in snapshots, so clients that synced before this one need a full copy
+        inventory.next_handle = std::max(inventory.next_handle, hdr.next_handle);
+        inventory.version     = std::max(inventory.version, hdr.inventory_version);
+        inventory.forgotten   = inventory.version;
+        if (lsn != nullptr) { *lsn = hdr.lsn; }
+        return inventory;
+}
+
+/// @brief Reads an inventory written by `write_snapshot`, as `parse_snapshot` does.
+///
+/// @returns std::nullopt if the file is missing, truncated or not a snapshot. Otherwise stores the journal position of the snapshot in `lsn`.
+inline auto load_snapshot(const std::string& path, std::uint64_t* lsn = nullptr, bool rebuild_indexes = false) -> std::optional<Inventory>
+{
+        const UniqueFd fd {open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+        struct stat    st {};
+        if (!fd || fstat(fd.fd, &st) != 0 || st.st_size <= 0) { return {}; }
+
+        // the file is mapped rather than read into a buffer, so the records and indexes are parsed where they lie in the page cache
+        const auto size = static_cast<std::size_t>(st.st_size);
+        auto*      data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.fd, 0);
+        if (data == MAP_FAILED) { return {}; }
+
+        madvise(data, size, MADV_SEQUENTIAL);
+        auto inventory = parse_snapshot({static_cast<const char*>(data), size}, lsn, rebuild_indexes);
+        munmap(data, size);
+        return inventory;
+}
+
+/// @brief Returns the `Private_Dirty` memory of the given process in bytes, or 0 if it cannot be read.
+inline auto private_dirty_bytes(pid_t pid) -> std::uint64_t
+{
+        const auto path = "/proc/" + std::to_string(pid) + "/smaps_rollup";
+        std::FILE* file = std::fopen(path.c_str(), "r");
+        if (file == nullptr) { return 0; }
+
+        char          line[256];
+        std::uint64_t kb {0};
+        while (std::fgets(line, sizeof(line), file) != nullptr)
+        {
+                if (std::sscanf(line, "Private_Dirty: %" SCNu64 " kB", &kb) == 1) { break; }
+        }
+        std::fclose(file);
+        return kb * 1024;
+}
+
+/// A snapshot being written by a forked child process.
+///
+/// The child sees the inventory exactly as it was at the time of the fork, while the parent keeps modifying its own copy. The kernel only
+/// duplicates the pages the parent touches in the meantime; that duplicated memory is reported as `SnapshotStats::cow_bytes`.
+///
+/// NOTE: Only the forking thread exists in the child, so the child must not take any lock another thread might have held.
+///
+/// Owns the child: destroying a snapshot still being written waits for the child to finish, so that it is never left behind as a zombie.
+struct BackgroundSnapshot
+{
+        pid_t         pid {-1};
+        UniqueFd      fd;                  // read end of the pipe the child reports its stats on
+        std::uint64_t fork_us {0};
+
+        BackgroundSnapshot(pid_t pid, UniqueFd fd, std::uint64_t fork_us) : pid {pid}, fd {std::move(fd)}, fork_us {fork_us} {}
+        BackgroundSnapshot(const BackgroundSnapshot&) = delete;
+        BackgroundSnapshot(BackgroundSnapshot&& other) noexcept
+                : pid {std::exchange(other.pid, -1)}, fd {std::move(other.fd)}, fork_us {other.fork_us}
+        {
+        }
+        ~BackgroundSnapshot()
+        {
+                if (pid > 0) { finish(0); }
+        }
+
+        auto operator=(const BackgroundSnapshot&) -> BackgroundSnapshot& = delete;
+        auto operator=(BackgroundSnapshot&& other) noexcept -> BackgroundSnapshot&
+        {
+                std::swap(pid, other.pid);
+                std::swap(fd, other.fd);
+                std::swap(fork_us, other.fork_us);
+                return *this;
+        }
+
+        /// @brief Forks a child that writes the inventory to `path`.
+        ///
+        /// @returns std::nullopt if the process could not be forked.
+        static auto start(const Inventory& inventory, const std::string& path, std::uint64_t lsn = 0) -> std::optional<BackgroundSnapshot>
+        {
+                int fds[2];
+                if (pipe(fds) != 0) { return {}; }
+
+                UniqueFd read_end {fds[0]};
+                UniqueFd write_end {fds[1]};
+                std::fflush(nullptr);        // don't let the child flush the parent's buffered output a second time
+                const auto start = std::chrono::steady_clock::now();
+                const auto pid   = fork();
+                if (pid < 0) { return {}; }
+
+                if (pid == 0)
+                {
+                        read_end.reset();
+                        const auto dirty_at_fork = private_dirty_bytes(getpid());
+                        auto       stats         = write_snapshot(inventory, path, lsn);
+
+                        // pages that are no longer shared with the parent were copied by one of us
+                        const auto dirty = private_dirty_bytes(getpid());
+                        stats.cow_bytes  = dirty > dirty_at_fork ? dirty - dirty_at_fork : 0;
+
+                        const auto written = write(write_end.fd, &stats, sizeof(stats));
+                        _exit(written == sizeof(stats) && stats.ok ? 0 : 1);
+                }
+
+                write_end.reset();
+                const auto elapsed = std::chrono::steady_clock::now() - start;
+                return BackgroundSnapshot {pid, std::move(read_end),
+                                           static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count())};
+        }
+
+        /// @brief Checks whether the child has finished without blocking.
+        ///
+        /// @returns std::nullopt while the snapshot is still being written.
+        auto poll() -> std::optional<SnapshotStats> { return finish(WNOHANG); }
+
+        /// @brief Blocks until the child has finished.
+        auto wait() -> SnapshotStats { return *finish(0); }
+
+private:
+        auto finish(int options) -> std::optional<SnapshotStats>
+        {
+                int  status {};
+                auto rc = waitpid(pid, &status, options);
+                while (rc < 0 && errno == EINTR) { rc = waitpid(pid, &status, options); }
+                if (rc == 0) { return {}; }
+
+                SnapshotStats stats;
+                if (read(fd.fd, &stats, sizeof(stats)) != sizeof(stats)) { stats = {}; }
+                stats.fork_us = fork_us;
+                stats.ok      = stats.ok && rc == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+                fd.reset();
+                pid = -1;
+                return stats;
+        }
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+/// Bounded queue with exactly one producer thread and one consumer thread, and no locks.
+///
+/// Each side owns one index and only reads the other's, with acquire/release ordering so that a slot is fully written before the consumer
+/// sees it and fully read before the producer reuses it. Both sides keep a cached copy of the other's index and only reload it when the
+/// queue looks full or empty, so in steady state a push or pop touches no cache line the other thread is writing.
+template<typename T, std::size_t N>
+struct SpscQueue
+{
+        static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+        /// @brief Appends `value`. Producer only.
+        ///
+        /// @returns false, leaving `value` as it was, if the queue is full.
+        auto push(T&& value)
+        {
+                const auto tail = producer.tail.load(std::memory_order_relaxed);
+                if (tail - producer.head_cache == N)
+                {
+                        producer.head_cache = consumer.head.load(std::memory_order_acquire);
+                        if (tail - producer.head_cache == N) { return false; }
+                }
+
+                slots[tail & (N - 1)] = std::move(value);
+                producer.tail.store(tail + 1, std::memory_order_release);
+                return true;
+        }
+
+        /// @brief Takes the oldest value. Consumer only.
+        ///
+        /// @returns std::nullopt if the queue is empty.
+        auto pop() -> std::optional<T>
+        {
+                const auto head = consumer.head.load(std::memory_order_relaxed);
+                if (head == consumer.tail_cache)
+                {
+                        consumer.tail_cache = producer.tail.load(std::memory_order_acquire);
+                        if (head == consumer.tail_cache) { return {}; }
+                }
+
+                std::optional<T> value {std::move(slots[head & (N - 1)])};
+                consumer.head.store(head + 1, std::memory_order_release);
+                return value;
+        }
+
+private:
+        // the two sides' indices on separate cache lines, so that they do not bounce between the cores on every operation
+        struct alignas(64) Producer
+        {
+                std::atomic<std::size_t> tail {0};              // next slot to write
+                std::size_t              head_cache {0};        // `consumer.head` as last seen
+        };
+        struct alignas(64) Consumer
+        {
+                std::atomic<std::size_t> head {0};              // next slot to read
+                std::size_t              tail_cache {0};        // `producer.tail` as last seen
+        };
+
+        Producer producer;
+        Consumer consumer;
+        T        slots[N] {};
+};
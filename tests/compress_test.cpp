@@ -0,0 +1,59 @@
+#include "compress.h"
+#include "test.h"
+
+#include <cstdint>
+#include <string>
+
+namespace
+{
+
+/// @brief Compresses `data` and returns whether it decompresses to the same bytes, and to nothing else when asked for another size.
+auto round_trips(const std::string& data)
+{
+        std::string compressed;
+        lz_compress(data.data(), data.size(), compressed);
+
+        std::string out(data.size() + 1, '\0');
+        const auto  ok = lz_decompress(compressed.data(), compressed.size(), out.data(), data.size()) && out.compare(0, data.size(), data) == 0;
+        return ok && !lz_decompress(compressed.data(), compressed.size(), out.data(), data.size() + 1);
+}
+
+auto test_compress()
+{
+        std::string incompressible;
+        std::uint32_t state {2463534242U};        // xorshift, so the bytes look random to the compressor
+        for (int i = 0; i < 100000; ++i)
+        {
+                state ^= state << 13U;
+                state ^= state >> 17U;
+                state ^= state << 5U;
+                incompressible.push_back(static_cast<char>(state));
+        }
+
+        std::string text;
+        for (int i = 0; i < 5000; ++i) { text += "Jeans model " + std::to_string(i % 97) + " in stock; "; }
+
+        EXPECT(round_trips(""));
+        EXPECT(round_trips("abc"));
+        EXPECT(round_trips("0123456789abcdef"));
+        EXPECT(round_trips(std::string(70000, 'a')));        // one match longer than many length extensions
+        EXPECT(round_trips(incompressible));
+        EXPECT(round_trips(text));
+
+        std::string compressed;
+        lz_compress(text.data(), text.size(), compressed);
+        EXPECT(compressed.size() < text.size() / 4);
+
+        // a match reaching back before the start of the output is corrupt
+        const char  corrupt[] = {0x10, 'a', 0x05, 0x00};
+        std::string out(16, '\0');
+        EXPECT(!lz_decompress(corrupt, sizeof(corrupt), out.data(), 5));
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_compress();
+        return test_result();
+}
@@ -0,0 +1,57 @@
+#include "journal.h"
+#include "test.h"
+
+#include <filesystem>
+#include <string_view>
+
+namespace
+{
+
+auto test_journal_mixed_durability()
+{
+        const auto dir = journal_dir("mixed");
+        {
+                Inventory inventory;
+                auto      journal = open_journal(dir, inventory);
+                EXPECT(journal != nullptr);
+
+                // a change from a value the journal never saw must not be replayed against the value it did see
+                inventory.add({Product::Jeans, "A", 1, 10}, Durability::Sync);
+                auto item   = inventory.items[0];
+                item.nstock = 8;
+                inventory.update(inventory.items.begin(), item, Durability::Memory);
+                item.nstock = 7;
+                inventory.update(inventory.items.begin(), item, Durability::Sync);
+                item.nstock = 5;
+                inventory.update(inventory.items.begin(), item, Durability::Sync);
+
+                // an item only ever added in memory is journalled whole once it is changed durably
+                inventory.add({Product::Jeans, "B", 2, 10}, Durability::Memory);
+                inventory.add({Product::Jeans, "C", 3, 10}, Durability::Memory);
+                item        = inventory.items[1];
+                item.nstock = 3;
+                EXPECT(inventory.update(inventory.items.begin() + 1, item, Durability::Sync));
+                inventory.remove(inventory.items.begin() + 2, Durability::Sync);
+                inventory.add({Product::Jeans, "D", 4, 10}, Durability::Sync);
+        }
+
+        Inventory     inventory;
+        RecoveryStats stats;
+        auto          journal = open_journal(dir, inventory, &stats);
+        EXPECT(journal != nullptr);
+        EXPECT(stats.failed == 0);
+        EXPECT(inventory.items.size() == 3);
+        EXPECT(inventory.items.size() == 3 && inventory.items[0].nstock == 5);
+        EXPECT(inventory.items.size() == 3 && inventory.items[1].name == "B" && inventory.items[1].nstock == 3);
+        EXPECT(inventory.find_by<ModelCodeKey>(std::string_view {"C"}) == inventory.items.end());
+        EXPECT(inventory.find_by<ModelCodeKey>(std::string_view {"D"}) != inventory.items.end());
+        std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_journal_mixed_durability();
+        return test_result();
+}
@@ -0,0 +1,61 @@
+#include "journal.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+auto test_journal_torn_tail()
+{
+        const auto dir = journal_dir("torn");
+        {
+                Inventory inventory;
+                auto      journal = open_journal(dir, inventory);
+                EXPECT(journal != nullptr);
+                EXPECT(inventory.add({Product::Jeans, "A", 1, 10}, Durability::Sync));
+        }
+
+        // as if the machine crashed half way through writing the next block to the last segment
+        std::vector<std::string> segments;
+        for (const auto& entry : std::filesystem::directory_iterator(dir))
+        {
+                if (entry.path().extension() == ".log") { segments.push_back(entry.path().string()); }
+        }
+        std::sort(segments.begin(), segments.end());
+        EXPECT(!segments.empty());
+
+        const std::string torn = "torn block";
+        std::FILE*        file = segments.empty() ? nullptr : std::fopen(segments.back().c_str(), "ab");
+        EXPECT(file != nullptr && std::fwrite(torn.data(), 1, torn.size(), file) == torn.size());
+        if (file != nullptr) { std::fclose(file); }
+
+        for (int restart = 0; restart < 2; ++restart)
+        {
+                Inventory     inventory;
+                RecoveryStats stats;
+                auto          journal = open_journal(dir, inventory, &stats);
+                EXPECT(journal != nullptr);
+                EXPECT(inventory.items.size() == 1U + restart);
+                EXPECT(stats.truncated == (restart == 0 ? torn.size() : 0));
+                EXPECT(stats.failed == 0);
+                EXPECT(inventory.add({Product::Jeans, "B" + std::to_string(restart), 1, 10}, Durability::Sync));
+        }
+
+        Inventory inventory;
+        auto      journal = open_journal(dir, inventory);
+        EXPECT(inventory.items.size() == 3);
+        std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_journal_torn_tail();
+        return test_result();
+}
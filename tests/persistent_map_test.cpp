@@ -0,0 +1,63 @@
+#include "persistent_map.h"
+#include "test.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+
+auto test_persistent_map()
+{
+        PersistentMap<std::uint32_t, int> map;
+        for (std::uint32_t key = 0; key < 1000; ++key) { map.assign(key, static_cast<int>(key)); }
+        EXPECT(map.size() == 1000);
+        EXPECT(map.find(999) != nullptr && *map.find(999) == 999);
+        EXPECT(map.find(1000) == nullptr);
+
+        // 1 and 33 share their lowest 5 bits, so they sit in a node of their own until one goes and the other is pulled back up
+        PersistentMap<std::uint32_t, int> pair;
+        pair.assign(1, 1);
+        pair.assign(33, 33);
+        EXPECT(pair.erase(33) == 1);
+        EXPECT(pair.erase(33) == 0);
+        EXPECT(pair.find(1) != nullptr && *pair.find(1) == 1);
+        pair.assign(33, 34);
+        EXPECT(pair.find(33) != nullptr && *pair.find(33) == 34);
+
+        // equal keys fall into a bucket below the last level
+        pair.emplace(7, 1);
+        pair.emplace(7, 2);
+        pair.emplace(7, 3);
+        EXPECT(pair.erase_if(7, [](int value) { return value == 2; }) == 1);
+        std::vector<int> sevens;
+        pair.for_each_equal(7, [&](int value) {
+                sevens.push_back(value);
+                return true;
+        });
+        EXPECT((sevens == std::vector<int> {1, 3}));
+        EXPECT(pair.size() == 4);
+
+        // changing a copy leaves the original as it was, and the other way round
+        auto clone = map;
+        for (std::uint32_t key = 0; key < 1000; key += 2) { clone.erase(key); }
+        clone.assign(1, -1);
+        map.assign(3, -3);
+        EXPECT(map.size() == 1000 && clone.size() == 500);
+        EXPECT(map.find(0) != nullptr && clone.find(0) == nullptr);
+        EXPECT(*map.find(1) == 1 && *clone.find(1) == -1);
+        EXPECT(*map.find(3) == -3 && *clone.find(3) == 3);
+
+        std::size_t visited {0};
+        clone.for_each([&](std::uint32_t key, int) { visited += key % 2; });
+        EXPECT(visited == 500);
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_persistent_map();
+        return test_result();
+}
@@ -0,0 +1,134 @@
+#include "inventory.h"
+#include "query.h"
+#include "test.h"
+
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+/// @brief Returns an inventory of `n` items spread over the categories, with prices and stock levels that repeat, some on the bounds the
+/// queries below use.
+auto make_inventory(std::size_t n)
+{
+        Inventory inventory;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+                const auto id    = static_cast<Product>(i % 5);
+                const auto price = static_cast<float>(i * 37 % 100);
+                inventory.add({id, "Q" + std::to_string(i), price, static_cast<int>(i * 13 % 20)});
+        }
+        return inventory;
+}
+
+/// @brief Returns one query of every filter shape, with bounds that fall on item prices and stock levels as well as between them.
+auto make_queries()
+{
+        std::vector<Query> queries;
+        for (unsigned shape = 0; shape < FILTER_SHAPES; ++shape)
+        {
+                for (int variant = 0; variant < 3; ++variant)
+                {
+                        Query query;
+                        if ((shape & FILTER_CATEGORY) != 0) { query.category = variant + 1; }
+                        if ((shape & FILTER_PRICE) != 0)
+                        {
+                                query.min_price = 10.0F * static_cast<float>(variant);
+                                query.max_price = variant == 2 ? FLT_MAX : 40.0F + 1.5F * static_cast<float>(variant);
+                        }
+                        if ((shape & FILTER_STOCK) != 0) { query.below_stock = 5 + variant * 6; }
+                        queries.push_back(query);
+                }
+        }
+        return queries;
+}
+
+/// @brief Returns the positions of the items from `pos` up to `end` that `filter` selects.
+auto select(const QueryFilter& filter, const Inventory& inventory, std::size_t pos, std::size_t end)
+{
+        std::vector<std::size_t> selected;
+        filter.for_each_match(inventory.columns, pos, end, [&](std::size_t match) {
+                selected.push_back(match);
+                return true;
+        });
+        return selected;
+}
+
+/// @brief Checks that the kernels of scan `mode` select what its interpreter does, for every filter shape, over ranges that start and
+/// end inside a block as well as on its bounds.
+auto check_kernels(ScanMode mode)
+{
+        const auto inventory = make_inventory(3 * FILTER_BLOCK + 17);
+        const auto n         = inventory.items.size();
+        for (const auto& query : make_queries())
+        {
+                const auto kernel      = QueryFilter::compile(query, mode);
+                const auto interpreter = QueryFilter::compile(query, mode, true);
+                EXPECT(!interpreter.compiled());
+                EXPECT(select(kernel, inventory, 0, n) == select(interpreter, inventory, 0, n));
+                EXPECT(select(kernel, inventory, 5, n - 3) == select(interpreter, inventory, 5, n - 3));
+                EXPECT(select(kernel, inventory, FILTER_BLOCK, 2 * FILTER_BLOCK) == select(interpreter, inventory, FILTER_BLOCK, 2 * FILTER_BLOCK));
+        }
+}
+
+auto test_branching_kernels()
+{
+        check_kernels(ScanMode::Branching);
+
+        // the interpreter against the filter spelled out, so that the kernels are not only checked against themselves
+        const auto inventory = make_inventory(500);
+        for (const auto& query : make_queries())
+        {
+                std::vector<std::size_t> expected;
+                for (std::size_t pos = 0; pos < inventory.items.size(); ++pos)
+                {
+                        const auto& item = inventory.items[pos];
+                        if ((query.category < 0 || item.id == static_cast<Product>(query.category)) && item.price >= query.min_price &&
+                            item.price <= query.max_price && (query.below_stock <= 0 || item.nstock < query.below_stock))
+                        {
+                                expected.push_back(pos);
+                        }
+                }
+                EXPECT(select(QueryFilter::compile(query, ScanMode::Branching, true), inventory, 0, inventory.items.size()) == expected);
+        }
+
+        // the common shapes have kernels of their own
+        Query category;
+        category.category = 1;
+        EXPECT(QueryFilter::compile(category, ScanMode::Branching).compiled());
+        EXPECT(QueryFilter::compile(Query {}, ScanMode::Branching).compiled());
+}
+
+auto test_masked_kernels()
+{
+        check_kernels(ScanMode::Masked);
+
+        // both modes select the same items, and a block of the masked interpreter starts where the last ended
+        const auto inventory = make_inventory(2 * FILTER_BLOCK + 1);
+        const auto n         = inventory.items.size();
+        for (const auto& query : make_queries())
+        {
+                const auto masked    = QueryFilter::compile(query, ScanMode::Masked, true);
+                const auto branching = QueryFilter::compile(query, ScanMode::Branching, true);
+                EXPECT(select(masked, inventory, 0, n) == select(branching, inventory, 0, n));
+                EXPECT(select(masked, inventory, 1, n) == select(branching, inventory, 1, n));
+        }
+
+        const std::uint8_t mask[] = {1, 0, 0, 1, 1, 0};
+        std::uint32_t      out[6] {};
+        EXPECT(compact_selection(mask, 6, 10, out) == 3);
+        EXPECT(out[0] == 10 && out[1] == 13 && out[2] == 14);
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_branching_kernels();
+        test_masked_kernels();
+        return test_result();
+}
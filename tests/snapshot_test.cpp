@@ -0,0 +1,86 @@
+#include "flat_index.h"
+#include "snapshot.h"
+#include "test.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+/// @brief Returns an index as `write_index` saves it, with `count` in place of the no. of entries.
+auto saved_index(std::uint64_t count, const std::vector<SnapshotIndexEntry>& entries)
+{
+        std::string block;
+        put(block, count);
+        for (const auto& entry : entries) { put(block, entry); }
+        return block;
+}
+
+/// @brief Reads `block` into `index` with `read_index`, expecting `count` entries.
+///
+/// @returns whether it was read, and whether the whole of it was.
+auto read_block(const std::string& block, FlatIndex<std::uint64_t, Handle>& index, std::uint64_t count)
+{
+        const auto* data = block.data();
+        return read_index(data, block.data() + block.size(), index, count) && data == block.data() + block.size();
+}
+
+auto test_read_index()
+{
+        const std::vector<SnapshotIndexEntry> sorted = {{1, 7, 0}, {1, 9, 0}, {4, 2, 0}};
+        FlatIndex<std::uint64_t, Handle>      index;
+        EXPECT(read_block(saved_index(3, sorted), index, 3));
+        EXPECT(index.size() == 3 && index.begin()->first == 1 && index.begin()->second == 7);
+
+        // fewer entries than the header says, more than the inventory has, or none at all
+        EXPECT(!read_block(saved_index(3, sorted).substr(0, 40), index, 3));
+        EXPECT(!read_block(saved_index(3, sorted), index, 2));
+        EXPECT(!read_block(saved_index(std::uint64_t {1} << 60U, sorted), index, std::uint64_t {1} << 60U));
+        EXPECT(!read_block(std::string {}, index, 0));
+
+        // entries out of order or twice over would break the lookups of the index, so they leave it empty
+        EXPECT(!read_block(saved_index(3, {{4, 2, 0}, {1, 7, 0}, {1, 9, 0}}), index, 3));
+        EXPECT(index.empty());
+        EXPECT(!read_block(saved_index(2, {{1, 7, 0}, {1, 7, 0}}), index, 2));
+        EXPECT(index.empty());
+}
+
+auto test_snapshot_round_trip()
+{
+        Inventory inventory;
+        for (int i = 0; i < 100; ++i) { inventory.add({static_cast<Product>(i % 4), "S" + std::to_string(i), 1.0F + i, i}); }
+        auto item   = inventory.items[10];
+        item.nstock = 500;
+        inventory.update(inventory.items.begin() + 10, item);
+        inventory.remove(inventory.items.begin() + 20);
+
+        const auto    path = journal_dir("snapshot") + ".snapshot";
+        std::uint64_t lsn {0};
+        EXPECT(write_snapshot(inventory, path, 42).ok);
+        auto loaded = load_snapshot(path, &lsn);
+        EXPECT(loaded && lsn == 42 && loaded->items.size() == 99);
+        EXPECT(loaded && loaded->find_by<ModelCodeKey>(std::string_view {"S10"})->nstock == 500);
+        EXPECT(loaded && loaded->find_by<ModelCodeKey>(std::string_view {"S20"}) == loaded->items.end());
+        EXPECT(loaded && loaded->by_version.size() == inventory.by_version.size());
+
+        // one flipped byte fails the checksum
+        std::FILE* file = std::fopen(path.c_str(), "r+b");
+        EXPECT(file != nullptr && std::fseek(file, 100, SEEK_SET) == 0 && std::fputc('\x7F', file) != EOF);
+        if (file != nullptr) { std::fclose(file); }
+        EXPECT(!load_snapshot(path));
+        EXPECT(!load_snapshot(path + ".missing"));
+        std::filesystem::remove(path);
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_read_index();
+        test_snapshot_round_trip();
+        return test_result();
+}
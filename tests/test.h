@@ -0,0 +1,49 @@
+#pragma once
+
+#include "journal.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+/// Checks shared by the test executables. Every check runs, and the exit status of the executable says whether any failed.
+
+inline int failures {0};
+
+/// @brief Reports a failed check and counts it.
+inline auto expect(bool ok, const char* what, int line)
+{
+        if (!ok)
+        {
+                std::printf("FAILED line %d: %s\n", line, what);
+                ++failures;
+        }
+        return ok;
+}
+
+#define EXPECT(cond) expect((cond), #cond, __LINE__)
+
+/// @brief Prints the outcome of the checks and returns the exit status for it.
+inline auto test_result()
+{
+        if (failures == 0) { std::printf("All tests passed.\n"); }
+        return failures == 0 ? 0 : 1;
+}
+
+/// @brief Returns an empty directory for a journal, named after `name`.
+inline auto journal_dir(const char* name)
+{
+        const auto dir = std::filesystem::temp_directory_path() / ("inventory-tests-" + std::to_string(getpid()) + "-" + name);
+        std::filesystem::remove_all(dir);
+        return dir.string();
+}
+
+/// @brief Opens the journal in `dir` into `inventory` and sends every change of the inventory to it.
+inline auto open_journal(const std::string& dir, Inventory& inventory, RecoveryStats* stats = nullptr)
+{
+        auto journal = Journal::open(dir, inventory, stats);
+        if (journal) { inventory.on_mutation = [journal = journal.get()](const Mutation& mutation) { return journal->append(mutation); }; }
+        return journal;
+}
@@ -0,0 +1,49 @@
+#include "test.h"
+#include "timer_wheel.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+
+auto test_timer_wheel()
+{
+        // timers past the reach of level 0, and of level 1, come down through the levels as they turn
+        TimerWheel<std::uint64_t> wheel(60);
+        const std::vector<std::uint64_t> ticks = {60, 63, 64, 65, 127, 128, 4095, 4096, 4097, 70000, 1U << 25U};
+        for (const auto tick : ticks) { wheel.arm(tick, tick); }
+
+        std::vector<std::uint64_t> fired;
+        wheel.advance(1U << 25U, [&](std::uint64_t tick) {
+                EXPECT(tick == wheel.current());
+                fired.push_back(tick);
+        });
+        EXPECT(fired == ticks);
+        EXPECT(wheel.size() == 0);
+
+        // a timer cancelled while its slot is being fired does not fire, and its id cannot cancel another timer
+        TimerWheel<int> due;
+        const auto      first  = due.arm(5, 1);
+        const auto      second = due.arm(5, 2);
+        std::vector<int> values;
+        due.advance(5, [&](int value) {
+                values.push_back(value);
+                if (values.size() == 1) { EXPECT(due.cancel(value == 1 ? second : first).has_value()); }
+        });
+        EXPECT(values.size() == 1);
+        EXPECT(due.size() == 0);
+        EXPECT(!due.cancel(first) && !due.cancel(second));
+
+        const auto reused = due.arm(6, 3);
+        EXPECT(!due.cancel(first) && !due.cancel(second));
+        EXPECT(due.cancel(reused) == 3);
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_timer_wheel();
+        return test_result();
+}
@@ -0,0 +1,57 @@
+#include "inventory.h"
+#include "test.h"
+#include "wire.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace
+{
+
+auto test_wire_decode_bounds()
+{
+        const Item  item {Product::Skirts, "PLEATED-MIDI", 24.5F, 3};
+        std::string record;
+        encode_item(record, item);
+        EXPECT(record.size() % WIRE_ALIGN == 0);
+
+        const auto parsed = ItemView::parse(record);
+        EXPECT(parsed && parsed->record.size() == record.size() && parsed->name == "PLEATED-MIDI" && parsed->nstock == 3);
+
+        // a record cut short anywhere, even in its padding, is not a record
+        for (std::size_t size = 0; size < record.size(); ++size) { EXPECT(!ItemView::parse(std::string_view {record}.substr(0, size))); }
+
+        // a length running past the end of the buffer is refused rather than read past it or wrapped around
+        constexpr auto header_size = wire_header_size<std::decay_t<decltype(ITEM_SCHEMA)>>;
+        auto           refused     = 0;
+        for (std::size_t pos = 0; pos + sizeof(std::uint32_t) <= header_size; pos += sizeof(std::uint32_t))
+        {
+                auto                corrupt = record;
+                const std::uint32_t huge {0xFFFFFFFFU};
+                std::memcpy(corrupt.data() + pos, &huge, sizeof(huge));
+
+                Item       decoded;
+                const auto size = wire_decode(std::string_view {corrupt}, ITEM_SCHEMA, decoded);
+                EXPECT(size <= corrupt.size());
+                refused += size == 0 ? 1 : 0;
+        }
+        EXPECT(refused == 1);
+
+        // a sequence must be whole records
+        std::string records = record + record;
+        EXPECT(ItemsView::parse(records) && ItemsView::parse(records)->size() == 2);
+        records.push_back('\0');
+        EXPECT(!ItemsView::parse(records));
+        EXPECT(ItemsView::parse({}) && ItemsView::parse({})->empty());
+}
+
+} // namespace
+
+auto main() -> int
+{
+        test_wire_decode_bounds();
+        return test_result();
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+constexpr auto TIMER_WHEEL_BITS   = 6U;        // slots a level are 1 << TIMER_WHEEL_BITS
+constexpr auto TIMER_WHEEL_LEVELS = 4U;        // levels, covering 1 << 24 ticks ahead; later timers come round again until they are due
+
+/// Identifies a timer armed on a `TimerWheel`. Never 0, and never reused, so a stale id cannot cancel another timer.
+using TimerId = std::uint64_t;
+
+/// Timers that fire a value at a given tick, kept in a hierarchical timing wheel (Varghese and Lauck, 1987) so that arming and
+/// cancelling are O(1) however many timers there are, and expiring them costs O(1) a timer plus a constant a tick.
+///
+/// Level 0 has a slot for each of the next `1 << TIMER_WHEEL_BITS` ticks, and each level above has slots that span a whole turn of the
+/// level below. A timer goes into the lowest level whose span reaches its tick, and when a lower level has turned, the timers of the next
+/// slot above are spread into it, each one level lower at a time. Timers live in one pool, linked into their slot's list by index, and
+/// the id of a timer is its index in the pool with the generation of the entry, which counts up every time the entry is freed.
+template<typename T>
+struct TimerWheel
+{
+        using Tick = std::uint64_t;
+
+        /// @brief Starts the wheel at tick `now`, the first to be processed.
+        explicit TimerWheel(Tick now = 0) : now {now}
+        {
+                for (auto& level : slots) { level.fill(NONE); }
+        }
+
+        /// @brief Returns the no. of timers armed.
+        auto size() const { return count; }
+
+        /// @brief Returns the next tick to be processed.
+        auto current() const { return now; }
+
+        /// @brief Arms a timer that fires `value` at tick `expires`, or on the next tick processed if that is later.
+        auto arm(Tick expires, T value) -> TimerId
+        {
+                auto index = free_head;
+                if (index != NONE) { free_head = timers[index].next; }
+                else
+                {
+                        index = static_cast<std::uint32_t>(timers.size());
+                        timers.emplace_back().generation = first_generation;
+                }
+
+                auto& timer   = timers[index];
+                timer.expires = expires;
+                timer.value   = std::move(value);
+                timer.armed   = true;
+                link(index);
+                ++count;
+                return id_of(index);
+        }
+
+        /// @brief Returns the value of a timer still armed, or nullptr if it has fired or been cancelled.
+        auto find(TimerId id) -> T*
+        {
+                const auto index = lookup(id);
+                return index == NONE ? nullptr : &timers[index].value;
+        }
+
+        /// @brief Disarms a timer.
+        ///
+        /// @returns the value of the timer, or std::nullopt if it has fired or been cancelled already.
+        auto cancel(TimerId id) -> std::optional<T>
+        {
+                const auto index = lookup(id);
+                if (index == NONE) { return {}; }
+
+                unlink(index);
+                return release(index);
+        }
+
+        /// @brief Calls `fn(id, expires, value)` for every timer armed, in the order of the indexes of their ids.
+        template<typename Fn>
+        auto for_each(Fn&& fn) const
+        {
+                for (std::uint32_t index = 0; index < timers.size(); ++index)
+                {
+                        if (timers[index].armed) { fn(id_of(index), timers[index].expires, timers[index].value); }
+                }
+        }
+
+        /// @brief Returns a generation above that of every id given out so far, for a wheel carrying on from this one to start at.
+        auto next_generation() const
+        {
+                std::uint32_t generation {first_generation};
+                for (const auto& timer : timers) { generation = std::max(generation, timer.generation + (timer.armed ? 1U : 0U)); }
+                return generation;
+        }
+
+        /// @brief Makes this wheel carry on from another, e.g. in a process taking over from the one that armed the timers: entries of
+        /// the pool start at `generation`, which the other's `next_generation` returned, so no id the other gave out matches a timer of
+        /// this one unless `restore` brought the timer over. Call it before arming any timer.
+        auto carry_on(std::uint32_t generation) { first_generation = std::max(generation, first_generation); }
+
+        /// @brief Arms a timer under the id the wheel this one carries on from gave it. Timers are restored in the order `for_each`
+        /// reports them, before any is armed.
+        ///
+        /// @returns false if `id` is out of that order or was not given out before `carry_on`'s generation.
+        auto restore(TimerId id, Tick expires, T value) -> bool
+        {
+                const auto index      = static_cast<std::uint32_t>(id);
+                const auto generation = static_cast<std::uint32_t>(id >> 32U);
+                if (index == NONE || index < timers.size() || generation == 0 || generation >= first_generation) { return false; }
+
+                // the entries in between were free in the other wheel too
+                while (timers.size() < index)
+                {
+                        auto& timer      = timers.emplace_back();
+                        timer.generation = first_generation;
+                        timer.next       = free_head;
+                        free_head        = static_cast<std::uint32_t>(timers.size() - 1);
+                }
+
+                auto& timer      = timers.emplace_back();
+                timer.generation = generation;
+                timer.expires    = expires;
+                timer.value      = std::move(value);
+                timer.armed      = true;
+                link(index);
+                ++count;
+                return true;
+        }
+
+        /// @brief Processes the ticks up to and including `to`, calling `fn(value)` for every timer due by then, in the order of their ticks.
+        /// `fn` may arm and cancel timers; those it arms for a tick already processed fire before the call returns.
+        ///
+        /// @returns the no. of timers fired.
+        template<typename Fn>
+        auto advance(Tick to, Fn&& fn)
+        {
+                std::size_t fired {0};
+                for (; now <= to; ++now)
+                {
+                        if (count == 0)
+                        {
+                                now = to;
+                                continue;
+                        }
+
+                        const auto slot = static_cast<std::size_t>(now & MASK);
+                        if (slot == 0) { cascade(1); }
+
+                        // timers armed by `fn` for this tick join the slot while it is being processed, so take it until it stays empty
+                        while (slots[0][slot] != NONE)
+                        {
+                                due.clear();
+                                for (auto index = std::exchange(slots[0][slot], NONE); index != NONE; index = timers[index].next)
+                                {
+                                        timers[index].level = DETACHED;
+                                        due.push_back(id_of(index));
+                                }
+                                for (const auto id : due)
+                                {
+                                        const auto index = lookup(id);
+                                        if (index == NONE) { continue; }        // cancelled by `fn`
+                                        if (timers[index].expires > now)
+                                        {
+                                                link(index);        // was further ahead than the wheel reaches
+                                                continue;
+                                        }
+
+                                        fn(release(index));
+                                        ++fired;
+                                }
+                        }
+                }
+                return fired;
+        }
+
+private:
+        static constexpr auto NONE      = std::uint32_t {0xFFFFFFFF};
+        static constexpr auto DETACHED  = static_cast<std::uint8_t>(TIMER_WHEEL_LEVELS);        // taken out of its slot to fire
+        static constexpr auto MASK      = (Tick {1} << TIMER_WHEEL_BITS) - 1;
+        static constexpr auto MAX_AHEAD = (Tick {1} << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+        /// An entry of the pool: an armed timer, linked into the list of its slot, or a free entry, linked into the free list by `next`.
+        struct Timer
+        {
+                Tick          expires {0};
+                std::uint32_t prev {NONE};
+                std::uint32_t next {NONE};
+                std::uint32_t generation {1};
+                std::uint8_t  level {0};
+                std::uint8_t  slot {0};
+                bool          armed {false};
+                T             value {};
+        };
+
+        std::vector<Timer>                                                      timers;
+        std::array<std::array<std::uint32_t, MASK + 1>, TIMER_WHEEL_LEVELS>     slots;         // first timer of every slot
+        std::uint32_t                                                           free_head {NONE};
+        std::uint32_t                                                           first_generation {1};        // of entries added to the pool
+        std::size_t                                                             count {0};
+        Tick                                                                    now;
+        std::vector<TimerId>                                                    due;           // timers of the slot being fired
+
+        auto id_of(std::uint32_t index) const { return (TimerId {timers[index].generation} << 32U) | index; }
+
+        /// @brief Returns the index of the armed timer with `id`, or `NONE`.
+        auto lookup(TimerId id) const
+        {
+                const auto index = static_cast<std::uint32_t>(id);
+                const auto valid = index < timers.size() && timers[index].armed && timers[index].generation == id >> 32U;
+                return valid ? index : NONE;
+        }
+
+        /// @brief Puts the timer in the slot of the lowest level that reaches its tick.
+        auto link(std::uint32_t index) -> void
+        {
+                auto&      timer   = timers[index];
+                const auto expires = std::clamp(timer.expires, now, now + MAX_AHEAD);
+                const auto ahead   = expires - now;
+
+                std::uint8_t level {0};
+                while (level + 1U < TIMER_WHEEL_LEVELS && ahead >> (TIMER_WHEEL_BITS * (level + 1U)) != 0) { ++level; }
+
+                const auto slot = static_cast<std::uint8_t>((expires >> (TIMER_WHEEL_BITS * level)) & MASK);
+                auto&      head = slots[level][slot];
+                timer.level     = level;
+                timer.slot      = slot;
+                timer.prev      = NONE;
+                timer.next      = head;
+                if (head != NONE) { timers[head].prev = index; }
+                head = index;
+        }
+
+        auto unlink(std::uint32_t index) -> void
+        {
+                auto& timer = timers[index];
+                if (timer.level == DETACHED) { return; }
+
+                if (timer.prev != NONE) { timers[timer.prev].next = timer.next; }
+                else { slots[timer.level][timer.slot] = timer.next; }
+                if (timer.next != NONE) { timers[timer.next].prev = timer.prev; }
+        }
+
+        /// @brief Frees the entry of a timer taken out of its slot and returns its value.
+        auto release(std::uint32_t index) -> T
+        {
+                auto& timer = timers[index];
+                auto  value = std::move(timer.value);
+                timer.value = T {};
+                timer.armed = false;
+                ++timer.generation;
+                timer.next = free_head;
+                free_head  = index;
+                --count;
+                return value;
+        }
+
+        /// @brief Spreads the timers of the slot of `level` that has come round into the levels below, then does the same for the level
+        /// above if this one has turned too.
+        auto cascade(unsigned level) -> void
+        {
+                if (level >= TIMER_WHEEL_LEVELS) { return; }
+
+                const auto slot = static_cast<std::size_t>((now >> (TIMER_WHEEL_BITS * level)) & MASK);
+                for (auto index = std::exchange(slots[level][slot], NONE); index != NONE;)
+                {
+                        const auto next = timers[index].next;
+                        link(index);
+                        index = next;
+                }
+                if (slot == 0) { cascade(level + 1); }
+        }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <unistd.h>
+#include <utility>
+
+/// Owns a file descriptor and closes it on destruction.
+struct UniqueFd
+{
+        int fd {-1};
+
+        UniqueFd() = default;
+        explicit UniqueFd(int fd) : fd {fd} {}
+        UniqueFd(const UniqueFd&) = delete;
+        UniqueFd(UniqueFd&& other) noexcept : fd {std::exchange(other.fd, -1)} {}
+        ~UniqueFd() { reset(); }
+
+        auto operator=(const UniqueFd&) -> UniqueFd& = delete;
+        auto operator=(UniqueFd&& other) noexcept -> UniqueFd&
+        {
+                std::swap(fd, other.fd);
+                return *this;
+        }
+
+        explicit operator bool() const { return fd >= 0; }
+
+        /// @brief Closes the current descriptor, if any, and takes ownership of `new_fd`.
+        auto reset(int new_fd = -1) -> void
+        {
+                if (fd >= 0) { close(fd); }
+                fd = new_fd;
+        }
+
+        /// @brief Gives up ownership without closing.
+        auto release() { return std::exchange(fd, -1); }
+};
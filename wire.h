@@ -0,0 +1,196 @@
+#pragma once
+
+#include "inventory.h"
+#include "schema.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+/// Flat encoding of items shared by the network protocol and snapshot files.
+///
+/// Every record is a fixed header generated from `ITEM_SCHEMA`, holding the fixed-size fields and the length of the model code, followed by
+/// the model code, padded with zeros to a multiple of `WIRE_ALIGN` bytes. As long as a buffer starts aligned, so does every record in it,
+/// so items are read where they lie and the model code is returned as a view into the buffer rather than copied into a `std::string`.
+
+constexpr auto WIRE_ALIGN = std::size_t {8};
+
+/// @brief Rounds `size` up to the next multiple of `WIRE_ALIGN`.
+constexpr auto wire_align(std::size_t size) { return (size + WIRE_ALIGN - 1) & ~(WIRE_ALIGN - 1); }
+
+/// @brief Appends the zeros that pad `out` to a multiple of `WIRE_ALIGN`.
+inline auto wire_pad(std::string& out) { out.append(wire_align(out.size()) - out.size(), '\0'); }
+
+/// @brief Returns how a fixed-size field of type `T` is stored in a record: enums as their underlying integer, anything else as it is.
+template<typename T>
+using wire_t = typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::common_type<T>>::type;
+
+/// @brief Returns the no. of bytes a field of type `T` takes in the fixed part of a record. Strings store their length there.
+template<typename T>
+constexpr auto wire_slot_size = is_fixed_field<T> ? sizeof(wire_t<T>) : sizeof(std::uint32_t);
+
+/// @brief Returns the size of the fixed part of a record of `Schema`: every fixed-size field in order, then the length of every string.
+template<typename Schema>
+constexpr std::size_t wire_header_size = 0;
+template<typename... Fields>
+constexpr std::size_t wire_header_size<std::tuple<Fields...>> = wire_align((wire_slot_size<typename Fields::type> + ... + 0));
+
+/// @brief Appends the record of `record` to `out`, which must hold whole records already: the fixed part, then the bytes of every string,
+/// padded to `WIRE_ALIGN`.
+template<typename Schema, typename Record>
+auto wire_encode(std::string& out, const Schema& schema, const Record& record)
+{
+        char        header[wire_header_size<Schema>] {};
+        std::size_t pos {0};
+        for_each_encoded_field(schema, [&](const auto& field, auto) {
+                using T = field_t<decltype(field)>;
+                if constexpr (is_fixed_field<T>)
+                {
+                        const auto value = static_cast<wire_t<T>>(field.of(record));
+                        std::memcpy(header + pos, &value, sizeof(value));
+                }
+                else
+                {
+                        const auto size = static_cast<std::uint32_t>(field.of(record).size());
+                        std::memcpy(header + pos, &size, sizeof(size));
+                }
+                pos += wire_slot_size<T>;
+        });
+
+        out.append(header, sizeof(header));
+        for_each_encoded_field(schema, [&](const auto& field, auto) {
+                if constexpr (!is_fixed_field<field_t<decltype(field)>>) { out.append(field.of(record)); }
+        });
+        wire_pad(out);
+}
+
+/// @brief Reads the record at the start of `data` into `record`, which takes strings as views into `data`.
+///
+/// @returns the size of the record including padding, or 0 if `data` does not start with a complete record.
+template<typename Schema, typename Record>
+auto wire_decode(std::string_view data, const Schema& schema, Record& record)
+{
+        constexpr auto header_size = wire_header_size<Schema>;
+        if (data.size() < header_size) { return std::size_t {0}; }
+
+        auto        ok = true;
+        std::size_t pos {0};
+        std::size_t size {header_size};
+        for_each_encoded_field(schema, [&](const auto& field, auto) {
+                using T = field_t<decltype(field)>;
+                if constexpr (is_fixed_field<T>)
+                {
+                        wire_t<T> value {};
+                        std::memcpy(&value, data.data() + pos, sizeof(value));
+                        field.of(record) = static_cast<T>(value);
+                }
+                else
+                {
+                        std::uint32_t length {};
+                        std::memcpy(&length, data.data() + pos, sizeof(length));
+                        ok = ok && length <= data.size() - size;
+                        if (ok) { field.of(record) = data.substr(size, length); }
+                        size += length;
+                }
+                pos += wire_slot_size<T>;
+        });
+
+        size = wire_align(size);
+        return ok && data.size() >= size ? size : 0;
+}
+
+/// An item read in place from a buffer holding its record. Mirrors the fields of `Item` so that code templated on the record type, such
+/// as query ordering, works on either; `name` points into the buffer and is only valid as long as it is.
+struct ItemView
+{
+        Product          id {};
+        float            price {};
+        int              nstock {};
+        std::string_view name;
+        std::string_view record;        // the whole record including padding, to forward it without re-encoding
+
+        /// @brief Reads the record at the start of `data`.
+        ///
+        /// @returns std::nullopt if `data` does not start with a complete record.
+        static auto parse(std::string_view data) -> std::optional<ItemView>
+        {
+                ItemView   item;
+                const auto size = wire_decode(data, ITEM_SCHEMA, item);
+                if (size == 0) { return {}; }
+
+                item.record = data.substr(0, size);
+                return item;
+        }
+
+        /// @brief Copies the item out of the buffer.
+        auto to_item() const
+        {
+                Item item;
+                for_each_field(ITEM_SCHEMA, [&](const auto& field, auto) { field.of(item) = field_t<decltype(field)> {field.of(*this)}; });
+                return item;
+        }
+};
+
+/// @brief Appends the record of an item to `out`, which must hold whole records already.
+inline auto encode_item(std::string& out, const Item& item) { wire_encode(out, ITEM_SCHEMA, item); }
+
+/// @brief Appends the record of an item selected by a query without copying it first.
+inline auto encode_item(std::string& out, const Item* item) { encode_item(out, *item); }
+
+/// @brief Appends a record read from another buffer to `out` as it is.
+inline auto encode_item(std::string& out, const ItemView& item) { out.append(item.record); }
+
+/// A sequence of item records, such as the payload of a result, iterated without copying.
+struct ItemsView
+{
+        /// Forward iterator over the records. The sequence has been checked by `parse`, so iterating does not check again.
+        struct iterator
+        {
+                using iterator_category = std::forward_iterator_tag;
+                using value_type        = ItemView;
+                using difference_type   = std::ptrdiff_t;
+                using pointer           = void;
+                using reference         = ItemView;
+
+                std::string_view rest;
+
+                auto operator*() const { return *ItemView::parse(rest); }
+                auto operator++() -> iterator&
+                {
+                        rest.remove_prefix((**this).record.size());
+                        return *this;
+                }
+                auto operator==(const iterator& other) const { return rest.data() == other.rest.data(); }
+                auto operator!=(const iterator& other) const { return !(*this == other); }
+        };
+
+        std::string_view data;
+        std::size_t      count {0};
+
+        /// @brief Checks that `data` is a sequence of complete records.
+        ///
+        /// @returns std::nullopt if a record is truncated or corrupt.
+        static auto parse(std::string_view data) -> std::optional<ItemsView>
+        {
+                std::size_t count {0};
+                for (auto rest = data; !rest.empty(); ++count)
+                {
+                        const auto item = ItemView::parse(rest);
+                        if (!item) { return {}; }
+
+                        rest.remove_prefix(item->record.size());
+                }
+                return ItemsView {data, count};
+        }
+
+        auto begin() const { return iterator {data}; }
+        auto end() const { return iterator {data.substr(data.size())}; }
+        auto size() const { return count; }
+        auto empty() const { return count == 0; }
+};